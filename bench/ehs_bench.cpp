@@ -0,0 +1,443 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+/*
+ * Microbenchmarks for the hot paths of EHS.
+ *
+ * Each stage is measured on its own: parsing requests (HttpRequest::ParseData
+ * and ParseBody), routing through a tree of registered EHS instances,
+ * constructing and serializing responses, and Datum conversions.
+ * For every benchmark, the time and the number of heap allocations
+ * per operation are reported.
+ *
+ * Usage:
+ *   ehs_bench [-time=<seconds per benchmark>] [filter ...]
+ * Only benchmarks whose name contains one of the filters are run.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "ehs.h"
+#include "networkabstraction.h"
+#include "ehsconnection.h"
+#include "inputbuffer.h"
+#include "socket.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <time.h>
+
+using namespace std;
+
+/// number of heap allocations so far
+static unsigned long long g_nAllocs = 0;
+
+void *operator new(size_t size)
+{
+    ++g_nAllocs;
+    void *p = malloc(size ? size : 1);
+    if (NULL == p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) throw()
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) throw()
+{
+    free(p);
+}
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// A connection endpoint that discards everything sent.
+class NullNetwork : public NetworkAbstraction {
+    public:
+        NullNetwork() : m_nSent(0) { }
+        virtual void RegisterBindHelper(PrivilegedBindHelper *) { }
+        virtual void SetBindAddress(const char *) { }
+        virtual string GetRemoteAddress() const { return "127.0.0.1"; }
+        virtual int GetRemotePort() const { return 0; }
+        virtual string GetLocalAddress() const { return "127.0.0.1"; }
+        virtual int GetLocalPort() const { return 0; }
+        virtual string GetPeer() const { return "127.0.0.1:0"; }
+        virtual void Init(int) { }
+        virtual ehs_socket_t GetFd() const { return INVALID_SOCKET; }
+        virtual int Read(void *, int) { return 0; }
+        virtual int Send(const void *, size_t buflen, int)
+        {
+            m_nSent += buflen;
+            return static_cast<int>(buflen);
+        }
+        virtual void Close() { }
+        virtual NetworkAbstraction *Accept() { return NULL; }
+        virtual bool IsSecure() const { return false; }
+        virtual void ThreadCleanup() { }
+        unsigned long long m_nSent;
+};
+
+/// A leaf of the routing tree.
+class Leaf : public EHS {
+    public:
+        ResponseCode HandleRequest(HttpRequest *, HttpResponse *response)
+        {
+            response->SetBody("ok", 2);
+            return HTTPRESPONSECODE_200_OK;
+        }
+};
+
+/**
+ * Runs the benchmarks.
+ * A friend of EHSConnection and HttpRequest, for invoking the
+ * parser and the serializer directly.
+ */
+class EHSBenchmark {
+    public:
+        EHSBenchmark(double seconds, const vector<string> & filters) :
+            m_nSeconds(seconds),
+            m_oFilters(filters),
+            m_oBuffer(),
+            m_sInput(),
+            m_poRoot(NULL),
+            m_oTree(),
+            m_sUri(),
+            m_poNetwork(new NullNetwork()),
+            m_poConnection(new EHSConnection(m_poNetwork, NULL)),
+            m_poResponse(NULL)
+        {
+        }
+
+        ~EHSBenchmark()
+        {
+            delete m_poResponse;
+            delete m_poConnection;
+            // children unregister from their parent
+            for (vector<EHS *>::reverse_iterator i = m_oTree.rbegin(); i != m_oTree.rend(); ++i) {
+                delete *i;
+            }
+        }
+
+        void RunAll()
+        {
+            printf("%-28s %12s %12s %14s\n", "benchmark", "ns/op", "allocs/op", "ops");
+            ParseBenchmarks();
+            RouteBenchmarks();
+            ResponseBenchmarks();
+            DatumBenchmarks();
+        }
+
+    private:
+        EHSBenchmark(const EHSBenchmark &);
+        EHSBenchmark & operator=(const EHSBenchmark &);
+
+        typedef void (EHSBenchmark::*Operation)();
+
+        bool Selected(const string & name) const
+        {
+            if (m_oFilters.empty()) {
+                return true;
+            }
+            for (vector<string>::const_iterator i = m_oFilters.begin(); i != m_oFilters.end(); ++i) {
+                if (string::npos != name.find(*i)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// Runs op repeatedly for the configured time, doubling the batch size.
+        void Measure(const string & name, Operation op)
+        {
+            if (!Selected(name)) {
+                return;
+            }
+            // warm up caches and lazily initialized statics
+            (this->*op)();
+            unsigned long long ops = 0;
+            unsigned long long allocs = g_nAllocs;
+            double start = Now();
+            double elapsed = 0;
+            for (unsigned long long batch = 1; elapsed < m_nSeconds; batch *= 2) {
+                for (unsigned long long i = 0; i < batch; ++i) {
+                    (this->*op)();
+                }
+                ops += batch;
+                elapsed = Now() - start;
+            }
+            allocs = g_nAllocs - allocs;
+            printf("%-28s %12.1f %12.2f %14llu\n", name.c_str(), elapsed * 1e9 / ops,
+                    static_cast<double>(allocs) / ops, ops);
+        }
+
+        // Parsing
+
+        void Parse()
+        {
+            m_oBuffer.Append(m_sInput.data(), m_sInput.length());
+            while (0 < m_oBuffer.Length()) {
+                HttpRequest req(1, m_poConnection, "");
+                if (HttpRequest::HTTPPARSESTATE_COMPLETEREQUEST != req.ParseData(m_oBuffer)) {
+                    cerr << "Benchmark input is invalid or incomplete" << endl;
+                    exit(1);
+                }
+                req.ParseBody();
+            }
+        }
+
+        void ParseBenchmarks()
+        {
+            m_sInput =
+                "GET /index.html HTTP/1.1\r\n"
+                "Host: www.example.com\r\n"
+                "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:68.0) Gecko/20100101 Firefox/68.0\r\n"
+                "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                "Accept-Language: en-US,en;q=0.5\r\n"
+                "Accept-Encoding: gzip, deflate\r\n"
+                "Connection: keep-alive\r\n\r\n";
+            Measure("parse/small-get", &EHSBenchmark::Parse);
+
+            ostringstream cookies;
+            cookies << "GET /app/dashboard?tab=overview&range=7d HTTP/1.1\r\n"
+                "Host: www.example.com\r\n"
+                "Accept: */*\r\n"
+                "Cookie: ";
+            for (int i = 0; i < 30; ++i) {
+                cookies << (i ? "; " : "") << "cookie" << i << "=value-" << i << "-0123456789abcdef";
+            }
+            cookies << "\r\n\r\n";
+            m_sInput = cookies.str();
+            Measure("parse/cookie-heavy", &EHSBenchmark::Parse);
+
+            ostringstream chunked;
+            chunked << "POST /upload HTTP/1.1\r\n"
+                "Host: www.example.com\r\n"
+                "Content-Type: application/json\r\n"
+                "Transfer-Encoding: chunked\r\n\r\n";
+            for (int i = 0; i < 16; ++i) {
+                chunked << "100\r\n" << string(256, 'a' + i) << "\r\n";
+            }
+            chunked << "0\r\n\r\n";
+            m_sInput = chunked.str();
+            Measure("parse/chunked-4k", &EHSBenchmark::Parse);
+
+            ostringstream body;
+            for (int i = 0; i < 8; ++i) {
+                body << "------------------------------735323031399963166993862150\r\n"
+                    "Content-Disposition: form-data; name=\"field" << i << "\"\r\n\r\n"
+                    "value " << i << "\r\n";
+            }
+            body << "------------------------------735323031399963166993862150\r\n"
+                "Content-Disposition: form-data; name=\"file\"; filename=\"data.bin\"\r\n"
+                "Content-Type: application/octet-stream\r\n\r\n"
+                << string(8192, 'x') << "\r\n"
+                "------------------------------735323031399963166993862150--\r\n";
+            ostringstream multipart;
+            multipart << "POST /form HTTP/1.1\r\n"
+                "Host: www.example.com\r\n"
+                "Content-Type: multipart/form-data; boundary=---------------------------735323031399963166993862150\r\n"
+                "Content-Length: " << body.str().length() << "\r\n\r\n" << body.str();
+            m_sInput = multipart.str();
+            Measure("parse/multipart-9parts", &EHSBenchmark::Parse);
+        }
+
+        // Routing
+
+        void Route()
+        {
+            HttpRequest req(1, m_poConnection, "");
+            req.m_sUri = m_sUri;
+            req.m_sHttpVersionNumber = "1.1";
+            ehs_autoptr<HttpResponse> response(m_poRoot->RouteRequest(&req));
+        }
+
+        void RouteBenchmarks()
+        {
+            // depth 6, fan-out 8: the route to the last leaf
+            m_poRoot = new EHS();
+            m_oTree.push_back(m_poRoot);
+            EHS *parent = m_poRoot;
+            ostringstream uri;
+            for (int depth = 0; depth < 6; ++depth) {
+                EHS *next = NULL;
+                for (int i = 0; i < 8; ++i) {
+                    ostringstream name;
+                    name << "level" << depth << "node" << i;
+                    EHS *child = new Leaf();
+                    m_oTree.push_back(child);
+                    parent->RegisterEHS(child, name.str().c_str());
+                    next = child;
+                }
+                uri << "/level" << depth << "node7";
+                parent = next;
+            }
+            m_sUri = uri.str() + "/index.html";
+            Measure("route/depth-6", &EHSBenchmark::Route);
+            m_sUri = "/index.html";
+            Measure("route/root", &EHSBenchmark::Route);
+            m_sUri = "/level0node7/missing/index.html";
+            Measure("route/404", &EHSBenchmark::Route);
+        }
+
+        // Responses
+
+        void ConstructResponse()
+        {
+            HttpResponse response(1, m_poConnection);
+            response.SetHeader("Content-Type", "application/json");
+            response.SetBody("{\"status\":\"ok\"}", 15);
+        }
+
+        void SerializeResponse()
+        {
+            GenericResponse *response = m_poResponse;
+            m_poConnection->SendResponses(&response, 1, m_poConnection->m_sSendBuffer);
+        }
+
+        void ResponseBenchmarks()
+        {
+            Measure("response/construct", &EHSBenchmark::ConstructResponse);
+            m_poResponse = new HttpResponse(1, m_poConnection);
+            m_poResponse->SetHeader("Content-Type", "application/json");
+            m_poResponse->SetHeader("Cache-Control", "no-cache");
+            m_poResponse->SetBody("{\"status\":\"ok\"}", 15);
+            Measure("response/serialize", &EHSBenchmark::SerializeResponse);
+            string big(65536, 'x');
+            m_poResponse->SetBody(big.data(), big.length());
+            Measure("response/serialize-64k", &EHSBenchmark::SerializeResponse);
+        }
+
+        // Datum conversions
+
+        void DatumFromInt()
+        {
+            Datum d;
+            d = 8080;
+        }
+
+        void DatumToInt()
+        {
+            Datum d;
+            d = "8080";
+            m_nSink += d.GetInt();
+        }
+
+        void DatumParams()
+        {
+            EHSServerParameters & params = m_oTree.front()->m_oParams;
+            m_nSink += static_cast<unsigned long>(params["maxrequestsize"]);
+            m_nSink += (params["mode"] == "threadpool") ? 1 : 0;
+        }
+
+        void DatumBenchmarks()
+        {
+            Measure("datum/from-int", &EHSBenchmark::DatumFromInt);
+            Measure("datum/to-int", &EHSBenchmark::DatumToInt);
+            if (m_oTree.empty()) {
+                m_oTree.push_back(new EHS());
+            }
+            EHSServerParameters & params = m_oTree.front()->m_oParams;
+            params["maxrequestsize"] = 1048576;
+            params["mode"] = "threadpool";
+            params["port"] = 8080;
+            Measure("datum/param-lookup", &EHSBenchmark::DatumParams);
+        }
+
+        double m_nSeconds;
+
+        vector<string> m_oFilters;
+
+        InputBuffer m_oBuffer;
+
+        string m_sInput;
+
+        EHS *m_poRoot;
+
+        vector<EHS *> m_oTree; ///< all EHS instances of the routing tree
+
+        string m_sUri;
+
+        NullNetwork *m_poNetwork; ///< owned by m_poConnection
+
+        EHSConnection *m_poConnection;
+
+        HttpResponse *m_poResponse;
+
+    public:
+        /// keeps results from being optimized away
+        static unsigned long m_nSink;
+};
+
+unsigned long EHSBenchmark::m_nSink = 0;
+
+int main(int argc, char **argv)
+{
+    double seconds = 0.5;
+    vector<string> filters;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (0 == arg.find("-time=")) {
+            seconds = atof(arg.c_str() + 6);
+        } else if ('-' == arg[0]) {
+            cerr << "Usage: " << argv[0] << " [-time=<seconds>] [filter ...]" << endl;
+            return 2;
+        } else {
+            filters.push_back(arg);
+        }
+    }
+    EHSBenchmark bench(seconds, filters);
+    bench.RunAll();
+    return 0;
+}
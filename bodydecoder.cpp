@@ -0,0 +1,109 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "bodydecoder.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+
+using namespace std;
+
+// amount by which the output grows per call of inflate
+static const size_t DECODE_CHUNK = 16384;
+
+BodyDecoder *BodyDecoder::Create(const string & encoding)
+{
+    // Only a single coding is supported, both with and without the
+    // legacy x- prefix. deflate means the zlib format (RFC 7230, Section 4.2.2).
+    if (!(boost::iequals(encoding, "gzip") || boost::iequals(encoding, "x-gzip") ||
+                boost::iequals(encoding, "deflate"))) {
+        return NULL;
+    }
+    BodyDecoder *ret = new BodyDecoder();
+    // 15 + 32: maximum window size, detect gzip or zlib header
+    if (Z_OK != inflateInit2(&ret->m_oStream, 15 + 32)) {
+        delete ret;
+        return NULL;
+    }
+    return ret;
+}
+
+BodyDecoder::BodyDecoder() :
+    m_oStream(),
+    m_nMaxSize(0),
+    m_nMaxRatio(0),
+    m_nIn(0),
+    m_nOut(0),
+    m_bFinished(false)
+{
+}
+
+BodyDecoder::~BodyDecoder()
+{
+    inflateEnd(&m_oStream);
+}
+
+BodyDecoder::DecodeResult BodyDecoder::Decode(const char *data, size_t len, string & out)
+{
+    if (0 == len) {
+        return DECODE_OK;
+    }
+    m_oStream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    m_oStream.avail_in = len;
+    m_nIn += len;
+    do {
+        if (m_bFinished) {
+            // Concatenated gzip members are one body, anything else is junk.
+            m_bFinished = false;
+            if (Z_OK != inflateReset(&m_oStream)) {
+                return DECODE_INVALID;
+            }
+        }
+        size_t used = out.length();
+        out.resize(used + DECODE_CHUNK);
+        m_oStream.next_out = reinterpret_cast<Bytef *>(&out[used]);
+        m_oStream.avail_out = DECODE_CHUNK;
+        int r = inflate(&m_oStream, Z_NO_FLUSH);
+        size_t n = DECODE_CHUNK - m_oStream.avail_out;
+        out.resize(used + n);
+        m_nOut += n;
+        if (Z_STREAM_END == r) {
+            m_bFinished = true;
+        } else if ((Z_OK != r) && (Z_BUF_ERROR != r)) {
+            return DECODE_INVALID;
+        }
+        if ((0 != m_nMaxSize) && (m_nOut > m_nMaxSize)) {
+            return DECODE_TOOLARGE;
+        }
+        if ((0 != m_nMaxRatio) && (m_nOut > MIN_RATIO_CHECK) &&
+                ((m_nOut / m_nMaxRatio) > (m_nIn - m_oStream.avail_in))) {
+            return DECODE_TOOLARGE;
+        }
+    } while ((0 < m_oStream.avail_in) || ((0 == m_oStream.avail_out) && !m_bFinished));
+    return DECODE_OK;
+}
@@ -0,0 +1,187 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "bytescan.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+# define EHS_SCAN_SSE2 1
+# include <emmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+
+#if defined(EHS_SCAN_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define EHS_SCAN_AVX2 1
+# include <immintrin.h>
+#endif
+
+/**
+ * Describes the set of bytes that terminate a scan:
+ * Every byte <= lim (except allow) and the bytes stop1 and stop2.
+ */
+struct ScanSpec {
+    unsigned char lim;
+    unsigned char allow;
+    unsigned char stop1;
+    unsigned char stop2;
+};
+
+static const ScanSpec s_oValueSpec = { 0x1f, '\t', 0x7f, 0x7f };
+static const ScanSpec s_oUriSpec = { 0x20, 0xff, 0x7f, 0x7f };
+static const ScanSpec s_oNameSpec = { 0x20, 0xff, 0x7f, ':' };
+static const ScanSpec s_oLineEndSpec = { 0x00, 0x00, '\r', '\n' };
+static const ScanSpec s_oUrlEscapeSpec = { 0x00, 0x00, '%', '+' };
+
+static inline const char *ScanScalar(const char *p, const char *end, const ScanSpec &s)
+{
+    for (; p < end; ++p) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (((c <= s.lim) && (c != s.allow)) || (c == s.stop1) || (c == s.stop2)) {
+            break;
+        }
+    }
+    return p;
+}
+
+#ifdef EHS_SCAN_SSE2
+static inline int LowestBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static const char *ScanSse2(const char *p, const char *end, const ScanSpec &s)
+{
+    const __m128i lim = _mm_set1_epi8(static_cast<char>(s.lim));
+    const __m128i allow = _mm_set1_epi8(static_cast<char>(s.allow));
+    const __m128i stop1 = _mm_set1_epi8(static_cast<char>(s.stop1));
+    const __m128i stop2 = _mm_set1_epi8(static_cast<char>(s.stop2));
+    while ((end - p) >= 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        // unsigned x <= lim  <=>  min(x, lim) == x
+        __m128i m = _mm_andnot_si128(_mm_cmpeq_epi8(x, allow),
+                _mm_cmpeq_epi8(_mm_min_epu8(x, lim), x));
+        m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(x, stop1), _mm_cmpeq_epi8(x, stop2)));
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(m));
+        if (0 != mask) {
+            return p + LowestBit(mask);
+        }
+        p += 16;
+    }
+    return ScanScalar(p, end, s);
+}
+#endif
+
+#ifdef EHS_SCAN_AVX2
+__attribute__((target("avx2")))
+static const char *ScanAvx2(const char *p, const char *end, const ScanSpec &s)
+{
+    const __m256i lim = _mm256_set1_epi8(static_cast<char>(s.lim));
+    const __m256i allow = _mm256_set1_epi8(static_cast<char>(s.allow));
+    const __m256i stop1 = _mm256_set1_epi8(static_cast<char>(s.stop1));
+    const __m256i stop2 = _mm256_set1_epi8(static_cast<char>(s.stop2));
+    while ((end - p) >= 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i m = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, allow),
+                _mm256_cmpeq_epi8(_mm256_min_epu8(x, lim), x));
+        m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(x, stop1), _mm256_cmpeq_epi8(x, stop2)));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(m));
+        if (0 != mask) {
+            return p + LowestBit(mask);
+        }
+        p += 32;
+    }
+    return ScanSse2(p, end, s);
+}
+#endif
+
+typedef const char *(*ScanFunc)(const char *, const char *, const ScanSpec &);
+
+static ScanFunc SelectScanFunc(const char **name)
+{
+#ifdef EHS_SCAN_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return ScanAvx2;
+    }
+#endif
+#ifdef EHS_SCAN_SSE2
+    *name = "sse2";
+    return ScanSse2;
+#else
+    *name = "scalar";
+    return ScanScalar;
+#endif
+}
+
+static const char *s_pszScanName = "scalar";
+
+static inline ScanFunc Scanner()
+{
+    static const ScanFunc scan = SelectScanFunc(&s_pszScanName);
+    return scan;
+}
+
+const char *ScanHeaderValue(const char *p, const char *end)
+{
+    return Scanner()(p, end, s_oValueSpec);
+}
+
+const char *ScanUri(const char *p, const char *end)
+{
+    return Scanner()(p, end, s_oUriSpec);
+}
+
+const char *ScanHeaderName(const char *p, const char *end)
+{
+    return Scanner()(p, end, s_oNameSpec);
+}
+
+const char *ScanLineEnd(const char *p, const char *end)
+{
+    return Scanner()(p, end, s_oLineEndSpec);
+}
+
+const char *ScanUrlEscape(const char *p, const char *end)
+{
+    return Scanner()(p, end, s_oUrlEscapeSpec);
+}
+
+const char *ByteScanImplementation()
+{
+    Scanner();
+    return s_pszScanName;
+}
@@ -0,0 +1,131 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "cachedclock.h"
+#include "mutexhelper.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// Names are fixed by RFC 1123, so neither strftime nor the locale is used.
+static const char *s_aDays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *s_aMonths[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+pthread_mutex_t CachedClock::s_oMutex = PTHREAD_MUTEX_INITIALIZER;
+time_t CachedClock::s_nNow = 0;
+char CachedClock::s_sDate[DATE_BUFSIZE] = "";
+
+void CachedClock::Update()
+{
+    time_t now = time(NULL);
+    MutexHelper mh(&s_oMutex);
+    if (now != s_nNow) {
+        Set(now);
+    }
+}
+
+time_t CachedClock::Now()
+{
+    MutexHelper mh(&s_oMutex);
+    if (0 == s_nNow) {
+        Set(time(NULL));
+    }
+    return s_nNow;
+}
+
+string CachedClock::Date()
+{
+    MutexHelper mh(&s_oMutex);
+    if (0 == s_nNow) {
+        Set(time(NULL));
+    }
+    return string(s_sDate);
+}
+
+void CachedClock::AppendDate(string &out)
+{
+    MutexHelper mh(&s_oMutex);
+    if (0 == s_nNow) {
+        Set(time(NULL));
+    }
+    out.append(s_sDate);
+}
+
+string CachedClock::Format(time_t stamp)
+{
+    char buf[DATE_BUFSIZE];
+    Format(stamp, buf, sizeof(buf));
+    return string(buf);
+}
+
+void CachedClock::Format(time_t stamp, char *buf, size_t len)
+{
+    struct tm t;
+#ifdef _WIN32
+    gmtime_s(&t, &stamp);
+#else
+    gmtime_r(&stamp, &t);
+#endif
+    snprintf(buf, len, "%s, %02d %s %04d %02d:%02d:%02d GMT", s_aDays[t.tm_wday],
+            t.tm_mday, s_aMonths[t.tm_mon], t.tm_year + 1900, t.tm_hour, t.tm_min, t.tm_sec);
+}
+
+time_t CachedClock::Parse(const string & date)
+{
+    // e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+    char month[4];
+    int day, year, hour, min, sec, n = 0;
+    if ((6 != sscanf(date.c_str(), "%*3s, %2d %3s %4d %2d:%2d:%2d GMT%n",
+                    &day, month, &year, &hour, &min, &sec, &n)) ||
+            (0 == n) || (1970 > year) || (23 < hour) || (59 < min) || (60 < sec)) {
+        return -1;
+    }
+    int mon = 0;
+    while ((12 > mon) && (0 != strcmp(month, s_aMonths[mon]))) {
+        mon++;
+    }
+    if ((12 == mon) || (1 > day) || (31 < day)) {
+        return -1;
+    }
+    // Days since the epoch of the proleptic Gregorian calendar, which
+    // avoids timegm (not portable) and mktime (local time).
+    int y = year - ((2 > mon) ? 1 : 0);
+    int m = (mon + 10) % 12; // March = 0
+    long days = 365L * y + y / 4 - y / 100 + y / 400 + (153 * m + 2) / 5 + day - 1 - 719468L;
+    return static_cast<time_t>(days) * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+void CachedClock::Set(time_t now)
+{
+    s_nNow = now;
+    Format(now, s_sDate, sizeof(s_sDate));
+}
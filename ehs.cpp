@@ -36,6 +36,7 @@
 #include "ehs.h"
 #include "networkabstraction.h"
 #include "ehsconnection.h"
+#include "cachedclock.h"
 #include "ehsserver.h"
 #include "socket.h"
 #include "securesocket.h"
@@ -107,6 +108,141 @@ class EHSThreadHandlerHelper
         EHSThreadHandlerHelper & operator=(const EHSThreadHandlerHelper& other) { m_pEHS = other.m_pEHS;  return *this; }
 };
 
+/**
+ * The default Executor of an EHSServer.
+ * Invokes the thread hooks of the top level EHS instance for each of its threads.
+ */
+class EHSWorkerPool : public ThreadPoolExecutor
+{
+    public:
+        EHSWorkerPool(EHSServer *server, int threads, size_t stacksize)
+            : ThreadPoolExecutor(0)
+            , m_poServer(server)
+        {
+            Start(threads, stacksize);
+        }
+
+        ~EHSWorkerPool()
+        {
+            Stop();
+        }
+
+    protected:
+        bool ThreadInitHandler()
+        {
+            return m_poServer->m_poTopLevelEHS->ThreadInitHandler();
+        }
+
+        void ThreadExitHandler()
+        {
+            m_poServer->m_poTopLevelEHS->ThreadExitHandler();
+            m_poServer->m_poNetworkAbstraction->ThreadCleanup();
+        }
+
+    private:
+        EHSServer *m_poServer;
+        EHSWorkerPool(const EHSWorkerPool &);
+        EHSWorkerPool & operator=(const EHSWorkerPool &);
+};
+
+/**
+ * Task for processing a single pending request of an EHSServer.
+ * The server counts its tasks and doesn't go away, before all of them
+ * have been destroyed, whether they have been run or dropped by
+ * the Executor.
+ */
+class EHSRequestTask : public ExecutorTask
+{
+    public:
+        EHSRequestTask(EHSServer *server) : m_poServer(server) { }
+
+        ~EHSRequestTask()
+        {
+            m_poServer->TaskDone();
+        }
+
+        void Run()
+        {
+            m_poServer->HandleRequestTask();
+        }
+
+    private:
+        EHSServer *m_poServer;
+        EHSRequestTask(const EHSRequestTask &);
+        EHSRequestTask & operator=(const EHSRequestTask &);
+};
+
+/**
+ * Task for invoking an application timer of an EHSServer.
+ * Counted like EHSRequestTask.
+ */
+class EHSTimerTask : public ExecutorTask
+{
+    public:
+        EHSTimerTask(EHSServer *server, TimerHandler *handler, int id, bool periodic)
+            : m_poServer(server), m_poHandler(handler), m_nId(id), m_bPeriodic(periodic) { }
+
+        ~EHSTimerTask()
+        {
+            m_poServer->TaskDone();
+        }
+
+        void Run()
+        {
+            m_poServer->HandleTimerTask(m_poHandler, m_nId, m_bPeriodic);
+        }
+
+    private:
+        EHSServer *m_poServer;
+        TimerHandler *m_poHandler;
+        int m_nId;
+        bool m_bPeriodic;
+        EHSTimerTask(const EHSTimerTask &);
+        EHSTimerTask & operator=(const EHSTimerTask &);
+};
+
+/**
+ * Wrapper for tasks, running on an Executor provided by the application.
+ * Since we don't own those threads, the thread hooks of the top level
+ * EHS instance and the per-thread cleanup of the network abstraction
+ * are invoked around each single task.
+ */
+class EHSForeignTask : public ExecutorTask
+{
+    public:
+        EHSForeignTask(EHSServer *server, ExecutorTask *task)
+            : m_poServer(server), m_poTask(task) { }
+
+        void Run()
+        {
+            {
+                // The task is run even if the init hook fails, because
+                // its server is waiting for it to finish.
+                EHSThreadHandlerHelper hooks(m_poServer->m_poTopLevelEHS);
+                m_poTask->Run();
+            }
+            m_poServer->m_poNetworkAbstraction->ThreadCleanup();
+        }
+
+    private:
+        EHSServer *m_poServer;
+        ehs_autoptr<ExecutorTask> m_poTask;
+        EHSForeignTask(const EHSForeignTask &);
+        EHSForeignTask & operator=(const EHSForeignTask &);
+};
+
+/// Returns the time of a monotonic clock in milliseconds
+static unsigned long long MonotonicMillis()
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
 int EHSServer::CreateFdSet()
 {
     // don't lock mutex, as this is only called from within a locked section
@@ -114,11 +250,23 @@ int EHSServer::CreateFdSet()
     // add the accepting FD	
     FD_SET(m_poNetworkAbstraction->GetFd(), &m_oReadFds);
     ehs_socket_t nHighestFd = m_poNetworkAbstraction->GetFd();
+    // add the wakeup pipe
+    if (INVALID_SOCKET != m_aWakeupFds[0]) {
+        FD_SET(m_aWakeupFds[0], &m_oReadFds);
+        if (m_aWakeupFds[0] > nHighestFd) {
+            nHighestFd = m_aWakeupFds[0];
+        }
+    }
     for (EHSConnectionList::iterator i = m_oEHSConnectionList.begin();
             i != m_oEHSConnectionList.end(); ++i) {
-        /// skip this one if it's already been used
-        if ((*i)->StillReading()) {
+        /// skip this one if it's already been used or paused
+        if ((*i)->StillReading() && !(*i)->ReadPaused()) {
             ehs_socket_t nCurrentFd = (*i)->GetNetworkAbstraction()->GetFd();
+#ifndef _WIN32
+            if (nCurrentFd >= FD_SETSIZE) {
+                continue;
+            }
+#endif
             // EHS_TRACE("Adding %d to FD SET", nCurrentFd);
             FD_SET(nCurrentFd, &m_oReadFds);
             // store the highest FD in the set to return it
@@ -128,7 +276,7 @@ int EHSServer::CreateFdSet()
         } else {
             EHS_TRACE("FD %d isn't reading anymore",
                     (*i)->GetNetworkAbstraction()->GetFd());
-            if (time(NULL) - (*i)->LastActivity() > (5 * m_nIdleTimeout)) {
+            if (CachedClock::Now() - (*i)->LastActivity() > (5 * m_nIdleTimeout)) {
             }
         }
     }
@@ -138,12 +286,14 @@ int EHSServer::CreateFdSet()
 void EHSServer::ClearIdleConnections()
 {
     // don't lock mutex, as this is only called from within locked sections
+    time_t now = CachedClock::Now();
     for (EHSConnectionList::iterator i = m_oEHSConnectionList.begin();
             i != m_oEHSConnectionList.end(); ++i) {
         // if it's been more than N seconds since a response has been
         //   sent and there are no pending requests
-        if ((*i)->StillReading() &&
-                time(NULL) - (*i)->LastActivity() > m_nIdleTimeout &&
+        // paused connections are waiting for the application, not the client
+        if ((*i)->StillReading() && !(*i)->ReadPaused() &&
+                now - (*i)->LastActivity() > m_nIdleTimeout &&
                 (!(*i)->RequestsPending())) {
             EHS_TRACE("Done reading because of idle timeout", "");
             (*i)->DoneReading(false);
@@ -181,7 +331,7 @@ EHSConnection::EHSConnection(NetworkAbstraction *ipoNetworkAbstraction,
     m_nResponses(0),
     m_nActiveRequests(0),
     m_poNetworkAbstraction(ipoNetworkAbstraction),
-    m_sBuffer(""),
+    m_oInputBuffer(),
     m_oResponseQueue(ResponseQueue()),
     m_oHttpRequestList(HttpRequestList()),
     m_sRemoteAddress(ipoNetworkAbstraction->GetRemoteAddress()),
@@ -189,7 +339,16 @@ EHSConnection::EHSConnection(NetworkAbstraction *ipoNetworkAbstraction,
     m_nRemotePort(ipoNetworkAbstraction->GetRemotePort()),
     m_nLocalPort(ipoNetworkAbstraction->GetLocalPort()),
     m_nMaxRequestSize(MAX_REQUEST_SIZE_DEFAULT),
+    m_nMultipartSpillSize(0),
+    m_bInflateBodies(false),
+    m_nMaxInflatedSize(0),
+    m_nMaxInflateRatio(0),
     m_sParseContentType(""),
+    m_bReadPaused(false),
+    m_bReadResumed(false),
+    m_nRejectCode(HTTPRESPONSECODE_INVALID),
+    m_bSending(false),
+    m_sSendBuffer(""),
     m_oMutex(pthread_mutex_t())
 {
     UpdateLastActivity();
@@ -207,6 +366,11 @@ EHSConnection::~EHSConnection()
         }
     }
     delete m_poCurrentHttpRequest;
+    // requests, whose tasks have been dropped by a stopped Executor
+    while (!m_oHttpRequestList.empty()) {
+        delete m_oHttpRequestList.front();
+        m_oHttpRequestList.pop_front();
+    }
     delete m_poNetworkAbstraction;
     pthread_mutex_destroy(&m_oMutex);
 }
@@ -232,6 +396,33 @@ NetworkAbstraction *EHSConnection::GetNetworkAbstraction()
 
 
 // adds data to the current buffer for this connection
+char *EHSConnection::GetReadBuffer(size_t & rnSize)
+{
+    MutexHelper mh(&m_oMutex);
+    // Offer one byte beyond the limit, so that an oversized request gets detected.
+    size_t len = m_oInputBuffer.Length();
+    size_t limit = (len < m_nMaxRequestSize) ? (m_nMaxRequestSize - len + 1) : 1;
+    return m_oInputBuffer.WriteSpace(limit, rnSize);
+}
+
+    EHSConnection::AddBufferResult
+EHSConnection::AddBuffer(int inSize ///< size of new data
+        )
+{
+    MutexHelper mh(&m_oMutex);
+    // make sure we actually got some data
+    if ( inSize <= 0 ) {
+        return ADDBUFFER_INVALID;
+    }
+    m_oInputBuffer.Commit(inSize);
+    // make sure the buffer doesn't grow too big
+    if (m_oInputBuffer.Length() > m_nMaxRequestSize) {
+        EHS_TRACE("MaxRequestSize (%lu) exceeded.", m_nMaxRequestSize);
+        return ADDBUFFER_TOOBIG;
+    }
+    return ParseInput(mh);
+}
+
     EHSConnection::AddBufferResult
 EHSConnection::AddBuffer(char *ipsData, ///< new data to be added
         int inSize ///< size of new data
@@ -243,12 +434,47 @@ EHSConnection::AddBuffer(char *ipsData, ///< new data to be added
         return ADDBUFFER_INVALID;
     }
     // make sure the buffer doesn't grow too big
-    if ((m_sBuffer.length() + inSize) > m_nMaxRequestSize) {
+    if ((m_oInputBuffer.Length() + inSize) > m_nMaxRequestSize) {
         EHS_TRACE("MaxRequestSize (%lu) exceeded.", m_nMaxRequestSize);
         return ADDBUFFER_TOOBIG;
     }
-    // this is binary safe -- only the single argument char* constructor looks for NULL
-    m_sBuffer += string ( ipsData, inSize );
+    m_oInputBuffer.Append(ipsData, inSize);
+    return ParseInput(mh);
+}
+
+    EHSConnection::AddBufferResult
+EHSConnection::ParseResumedInput()
+{
+    MutexHelper mh(&m_oMutex);
+    if (!m_bReadResumed) {
+        return ADDBUFFER_INVALID;
+    }
+    m_bReadResumed = false;
+    return ParseInput(mh);
+}
+
+void EHSConnection::ResumeReading()
+{
+    {
+        MutexHelper mh(&m_oMutex);
+        if (!m_bReadPaused) {
+            return;
+        }
+        m_bReadPaused = false;
+        m_bReadResumed = true;
+        UpdateLastActivity();
+    }
+    // let the server loop parse the buffered data and select on our socket again
+    m_poEHSServer->Wakeup();
+}
+
+    EHSConnection::AddBufferResult
+EHSConnection::ParseInput(MutexHelper & mh)
+{
+    // a RequestBodyHandler doesn't want more data right now
+    if (m_bReadPaused) {
+        return ADDBUFFER_OK;
+    }
     // need to run through our buffer until we don't get a full result out
     do {
         // if we need to make a new request object, do that now
@@ -260,7 +486,11 @@ EHSConnection::AddBuffer(char *ipsData, ///< new data to be added
                 m_poEHSServer->IncrementRequestsPending();
                 // wake up everyone
                 pthread_cond_broadcast(& m_poEHSServer->m_oDoneAccepting);
-                if (m_poEHSServer->m_nServerRunningStatus == EHSServer::SERVERRUNNING_ONETHREADPERREQUEST ) {
+                if (m_poEHSServer->m_nServerRunningStatus == EHSServer::SERVERRUNNING_THREADPOOL) {
+                    mh.Unlock();
+                    m_poEHSServer->DispatchRequest();
+                    mh.Lock();
+                } else if (m_poEHSServer->m_nServerRunningStatus == EHSServer::SERVERRUNNING_ONETHREADPERREQUEST ) {
                     // create a thread if necessary
                     pthread_t oThread;
                     mh.Unlock();
@@ -278,17 +508,99 @@ EHSConnection::AddBuffer(char *ipsData, ///< new data to be added
             // create the initial request
             m_poCurrentHttpRequest = new HttpRequest(++m_nRequests, this, m_sParseContentType);
             m_poCurrentHttpRequest->m_bSecure = m_poNetworkAbstraction->IsSecure();
+            m_poCurrentHttpRequest->m_poBodyHandler = m_poEHSServer->m_poTopLevelEHS->GetRequestBodyHandler();
+            m_poCurrentHttpRequest->m_nMultipartSpillSize = m_nMultipartSpillSize;
+            m_poCurrentHttpRequest->m_nMaxBodySize = m_nMaxRequestSize;
+            m_poCurrentHttpRequest->m_bInflateBody = m_bInflateBodies;
+            m_poCurrentHttpRequest->m_nMaxInflatedSize = m_nMaxInflatedSize;
+            m_poCurrentHttpRequest->m_nMaxInflateRatio = m_nMaxInflateRatio;
         }
         // parse through the current data
-        m_poCurrentHttpRequest->ParseData(m_sBuffer);
+        m_poCurrentHttpRequest->ParseData(m_oInputBuffer);
+        if (m_poCurrentHttpRequest->m_bExpectPending) {
+            AddBufferResult res = HandleExpectation();
+            if (ADDBUFFER_OK != res) {
+                return res;
+            }
+            // go on with the body
+            m_poCurrentHttpRequest->ParseData(m_oInputBuffer);
+        }
     } while (m_poCurrentHttpRequest->m_nCurrentHttpParseState ==
             HttpRequest::HTTPPARSESTATE_COMPLETEREQUEST);
+    if (m_poCurrentHttpRequest->m_bPauseReading) {
+        EHS_TRACE("RequestBodyHandler paused reading", "");
+        m_poCurrentHttpRequest->m_bPauseReading = false;
+        m_bReadPaused = true;
+    }
     if ( m_poCurrentHttpRequest->m_nCurrentHttpParseState == HttpRequest::HTTPPARSESTATE_INVALIDREQUEST ) {
-        return ADDBUFFER_INVALIDREQUEST;
+        if (m_poCurrentHttpRequest->m_bUnsupportedEncoding) {
+            m_nRejectCode = HTTPRESPONSECODE_415_UNSUPPORTEDMEDIATYPE;
+            return ADDBUFFER_REJECTED;
+        }
+        return m_poCurrentHttpRequest->m_bBodyTooLarge ? ADDBUFFER_TOOBIG : ADDBUFFER_INVALIDREQUEST;
     }
     return ADDBUFFER_OK;
 }
 
+    EHSConnection::AddBufferResult
+EHSConnection::HandleExpectation()
+{
+    HttpRequest *req = m_poCurrentHttpRequest;
+    req->m_bExpectPending = false;
+    const string & sExpect = req->m_oRequestHeaders.find(HEADER_EXPECT)->second;
+    // 100-continue is the only expectation defined (RFC 7231, Section 5.1.1)
+    if (0 != strcasecmp(sExpect.c_str(), "100-continue")) {
+        EHS_TRACE("Unsupported expectation '%s'", sExpect.c_str());
+        m_nRejectCode = HTTPRESPONSECODE_417_EXPECTATIONFAILED;
+        return ADDBUFFER_REJECTED;
+    }
+    ResponseCode rc = m_poEHSServer->m_poTopLevelEHS->HandleExpectContinue(req);
+    if (HTTPRESPONSECODE_100_CONTINUE != rc) {
+        EHS_TRACE("Expectation rejected with %d", rc);
+        m_nRejectCode = rc;
+        return ADDBUFFER_REJECTED;
+    }
+    // The client sends the body anyway after a while, so rather
+    // omit the 100 than getting it ahead of earlier responses.
+    if (!RequestsPending()) {
+        SendInterim(HTTPRESPONSECODE_100_CONTINUE, StringCaseMap());
+    }
+    if (!req->BeginBody()) {
+        // ParseData reports the request as invalid.
+        req->m_nCurrentHttpParseState = HttpRequest::HTTPPARSESTATE_INVALIDREQUEST;
+        req->m_nScanState = HttpRequest::HTTPSCAN_DONE;
+    }
+    return ADDBUFFER_OK;
+}
+
+bool EHSConnection::SendInterim(ResponseCode code, const StringCaseMap &headers)
+{
+    string sHead;
+    HttpResponse::AppendStatusLine(code, sHead);
+    for (StringCaseMap::const_iterator i = headers.begin(); i != headers.end(); ++i) {
+        sHead.append(i->first).append(": ", 2).append(i->second).append("\r\n", 2);
+    }
+    sHead.append("\r\n", 2);
+    // Sent while holding the mutex, so that no final response can overtake us.
+    return (-1 != m_poNetworkAbstraction->Send(sHead.data(), sHead.length()));
+}
+
+bool EHSConnection::SendInterimResponse(HttpRequest *request, ResponseCode code,
+        const StringCaseMap &headers)
+{
+    if ((code < 100) || (code > 199) || (HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS == code) ||
+            (request->HttpVersion() != "1.1")) {
+        return false;
+    }
+    MutexHelper mh(&m_oMutex);
+    // Only if all earlier responses are out and no other request is being processed.
+    if (m_bRawMode || Disconnected() || (request->Id() != m_nResponses + 1) ||
+            (1 != m_nActiveRequests)) {
+        return false;
+    }
+    return SendInterim(code, headers);
+}
+
 /// call when no more reads will be performed on this object.  inDisconnected is true when client has disconnected
 void EHSConnection::DoneReading(bool ibDisconnected)
 {
@@ -348,8 +660,19 @@ EHSServer::EHSServer (EHS *ipoTopLevelEHS) :
     m_nIdleTimeout(15),
     m_nThreads(0),
     m_oCurrentRequest(CurrentRequestMap()),
-    m_oThreadAttr(pthread_attr_t())
+    m_oThreadAttr(pthread_attr_t()),
+    m_poExecutor(NULL),
+    m_poOwnExecutor(NULL),
+    m_nTasks(0),
+    m_oTimers(EHSTimerMap()),
+    m_oTimerQueue(EHSTimerQueue()),
+    m_nLastTimerId(0),
+    m_nSelectDeadline(0),
+    m_bConditional(false),
+    m_oRanges(),
+    m_oCompressor()
 {
+    m_aWakeupFds[0] = m_aWakeupFds[1] = INVALID_SOCKET;
     // you HAVE to specify a top-level EHS object
     if (NULL == m_poTopLevelEHS) {
         throw invalid_argument("EHSServer::EHSServer: Pointer to toplevel EHS object is NULL.");
@@ -361,6 +684,11 @@ EHSServer::EHSServer (EHS *ipoTopLevelEHS) :
     pthread_mutex_init(&m_oMutex, NULL);
     pthread_cond_init(&m_oDoneAccepting, NULL);
     pthread_attr_init(&m_oThreadAttr);
+    if (params.find("etags") != params.end()) {
+        m_bConditional = (0 != (unsigned long)params["etags"]);
+    }
+    m_oRanges.Configure(params);
+    m_oCompressor.Configure(params, m_poTopLevelEHS->GetContentCodings());
     {
         // Set minimum stack size
         size_t stacksize;
@@ -404,29 +732,44 @@ EHSServer::EHSServer (EHS *ipoTopLevelEHS) :
         }
         m_poNetworkAbstraction->RegisterBindHelper(m_poTopLevelEHS->GetBindHelper());
         m_poNetworkAbstraction->Init(params["port"]); // initialize socket stuff
+#ifndef _WIN32
+        // create the pipe for waking up select() when timers are scheduled
+        if (0 == pipe(m_aWakeupFds)) {
+            int one = 1;
+            ioctl(m_aWakeupFds[0], FIONBIO, &one);
+            ioctl(m_aWakeupFds[1], FIONBIO, &one);
+        } else {
+            m_aWakeupFds[0] = m_aWakeupFds[1] = INVALID_SOCKET;
+        }
+#endif
         if (params["mode"] == "threadpool") {
+            // requests are processed by an Executor, either one that has been
+            // provided by the application, or our own pool.
+            m_poExecutor = m_poTopLevelEHS->GetExecutor();
+            if (NULL == m_poExecutor) {
+                int nThreadsToStart = params["threadcount"].GetInt();
+                if (nThreadsToStart <= 0) {
+                    nThreadsToStart = 1;
+                }
+                EHS_TRACE ("Starting %d threads in pool", nThreadsToStart);
+                m_poOwnExecutor = new EHSWorkerPool(this, nThreadsToStart,
+                        (unsigned long)params["stacksize"]);
+                m_poExecutor = m_poOwnExecutor;
+            }
             // need to set this here because the thread will check this to make
             // sure it's supposed to keep running
             m_nServerRunningStatus = SERVERRUNNING_THREADPOOL;
-            // create a pthread
-            int nThreadsToStart = params["threadcount"].GetInt();
-            if (nThreadsToStart <= 0) {
-                nThreadsToStart = 1;
-            }
-            EHS_TRACE ("Starting %d threads in pool", nThreadsToStart);
-            for (int i = 0; i < nThreadsToStart; i++) {
-                // create new thread and detach so we don't have to join on it
-                pthread_t thread;
-                if (0 == pthread_create(&thread, &m_oThreadAttr,
-                            EHSServer::PthreadHandleData_ThreadedStub, (void *)this)) {
-                    m_nAcceptThreadId = THREADID(thread);
-                    EHS_TRACE("Created thread with ID=0x%x, NULL, func=0x%x, this=0x%x",
-                            m_nAcceptThreadId, EHSServer::PthreadHandleData_ThreadedStub, this);
-                    pthread_detach(thread);
-                } else {
-                    m_nServerRunningStatus = SERVERRUNNING_NOTRUNNING;
-                    throw runtime_error("EHSServer::EHSServer: Unable to create threads");
-                }
+            // spawn off one thread for accepting connections and reading requests
+            pthread_t thread;
+            if (0 == pthread_create(&thread, &m_oThreadAttr,
+                        EHSServer::PthreadHandleData_ThreadedStub, (void *)this)) {
+                m_nAcceptThreadId = THREADID(thread);
+                EHS_TRACE("Created thread with ID=0x%x, NULL, func=0x%x, this=0x%x",
+                        m_nAcceptThreadId, EHSServer::PthreadHandleData_ThreadedStub, this);
+                pthread_detach(thread);
+            } else {
+                m_nServerRunningStatus = SERVERRUNNING_NOTRUNNING;
+                throw runtime_error("EHSServer::EHSServer: Unable to create listener thread");
             }
         } else if (params["mode"] == "onethreadperrequest") {
             m_nServerRunningStatus = SERVERRUNNING_ONETHREADPERREQUEST;
@@ -449,14 +792,25 @@ EHSServer::EHSServer (EHS *ipoTopLevelEHS) :
             throw runtime_error("EHSServer::EHSServer: invalid mode specified");
         }
     } catch (...) {
+        delete m_poOwnExecutor;
         delete m_poNetworkAbstraction;
+#ifndef _WIN32
+        if (INVALID_SOCKET != m_aWakeupFds[0]) {
+            close(m_aWakeupFds[0]);
+            close(m_aWakeupFds[1]);
+        }
+#endif
         throw;
     }
     switch (m_nServerRunningStatus) {
         case SERVERRUNNING_THREADPOOL:
-            EHS_TRACE("EHS Server running in threadpool mode with %s threads",
-                    params["threadcount"] == "" ? "1" :
-                    params[ "threadcount"].GetCharString());
+            if (m_poOwnExecutor) {
+                EHS_TRACE("EHS Server running in threadpool mode with %s threads",
+                        params["threadcount"] == "" ? "1" :
+                        params[ "threadcount"].GetCharString());
+            } else {
+                EHS_TRACE("EHS Server running in threadpool mode with external executor", "");
+            }
             break;
         case SERVERRUNNING_ONETHREADPERREQUEST:
             EHS_TRACE("EHS Server running with one thread per request", "");
@@ -474,12 +828,20 @@ EHSServer::EHSServer (EHS *ipoTopLevelEHS) :
 
 EHSServer::~EHSServer ( )
 {
+    // stop our own pool first, its threads use the network abstraction on exit
+    delete m_poOwnExecutor;
     delete m_poNetworkAbstraction;
     // Delete all elements in our connection list
     while ( ! m_oEHSConnectionList.empty() ) {
         delete m_oEHSConnectionList.front ( );
         m_oEHSConnectionList.pop_front ( );
     }
+#ifndef _WIN32
+    if (INVALID_SOCKET != m_aWakeupFds[0]) {
+        close(m_aWakeupFds[0]);
+        close(m_aWakeupFds[1]);
+    }
+#endif
     pthread_mutex_destroy(&m_oMutex);
 }
 
@@ -615,6 +977,30 @@ void EHS::StopServer()
     }
 }
 
+int EHS::ScheduleTimer(TimerHandler *handler, unsigned long delay, unsigned long interval)
+{
+    // make sure we're in a sane state
+    if ((NULL == m_poParent) && (NULL == m_poEHSServer)) {
+        throw runtime_error("EHS::ScheduleTimer: Invalid state");
+    }
+
+    if (m_poParent) {
+        return m_poParent->ScheduleTimer(handler, delay, interval);
+    }
+    return m_poEHSServer->AddTimer(handler, delay, interval);
+}
+
+bool EHS::CancelTimer(int id)
+{
+    if (m_poParent) {
+        return m_poParent->CancelTimer(id);
+    }
+    if (m_poEHSServer) {
+        return m_poEHSServer->RemoveTimer(id);
+    }
+    return false;
+}
+
 bool EHS::ShouldTerminate() const
 {
     // make sure we're in a sane state
@@ -677,7 +1063,8 @@ void EHSServer::HandleData (int inTimeoutMilliseconds, ehs_threadid_t tid)
     //   if we're running one-thread-per-request and this is the accept thread
     //   we don't look for requests
     m_oCurrentRequest[tid] = NULL;
-    if (m_nServerRunningStatus != SERVERRUNNING_ONETHREADPERREQUEST ||
+    if ((m_nServerRunningStatus != SERVERRUNNING_ONETHREADPERREQUEST &&
+                m_nServerRunningStatus != SERVERRUNNING_THREADPOOL) ||
             tid != m_nAcceptThreadId ) {
         m_oCurrentRequest[tid] = GetNextRequest();
     }
@@ -687,7 +1074,7 @@ void EHSServer::HandleData (int inTimeoutMilliseconds, ehs_threadid_t tid)
         // handle the request and post it back to the connection object
         mutex.Unlock();
         // route the request
-        ehs_autoptr<GenericResponse> response(m_poTopLevelEHS->RouteRequest(req));
+        ehs_autoptr<GenericResponse> response(ProcessRequest(req));
         response->GetConnection()->AddResponse(ehs_move(response));
         delete req;
         mutex.Lock();
@@ -708,14 +1095,17 @@ void EHSServer::HandleData (int inTimeoutMilliseconds, ehs_threadid_t tid)
             // we're now accepting
             m_bAccepting = true;
             mutex.Unlock();
-            // set up the timeout and normalize
-            timeval tv = { 0, inTimeoutMilliseconds * 1000 };
+            // set up the timeout (shortened if a timer expires earlier) and normalize
+            int nTimeout = NextTimerTimeout(inTimeoutMilliseconds);
+            timeval tv = { 0, nTimeout * 1000 };
             tv.tv_sec = tv.tv_usec / 1000000;
             tv.tv_usec %= 1000000;
             // create the FD set for select
             int nHighestFd = CreateFdSet();
             // call select
             int nSocketCount = select(nHighestFd + 1, &m_oReadFds, NULL, NULL, &tv);
+            // advance the clock, which is used for all time stamps until the next tick
+            CachedClock::Update();
             // handle select error
             if (nSocketCount ==
 #ifdef _WIN32
@@ -735,18 +1125,249 @@ void EHSServer::HandleData (int inTimeoutMilliseconds, ehs_threadid_t tid)
             }
             // if no sockets have data to read, clear accepting flag and return
             if (nSocketCount > 0) {
+                // drain the wakeup pipe
+                if ((INVALID_SOCKET != m_aWakeupFds[0]) && FD_ISSET(m_aWakeupFds[0], &m_oReadFds)) {
+                    char buf[64];
+                    while (0 < read(m_aWakeupFds[0], buf, sizeof(buf))) {
+                    }
+                }
                 // Check the accept socket for a new connection
                 CheckAcceptSocket();
                 // check client sockets for data
                 CheckClientSockets();
             }
+            // continue parsing on connections that have been resumed
+            CheckResumedConnections();
             mutex.Lock();
+            m_nSelectDeadline = 0;
             ClearIdleConnections();
             m_bAccepting = false;
+            mutex.Unlock();
+            RunTimers(tid);
         } // END ACCEPTING
     } // END NO REQUESTS PENDING
 }
 
+ehs_autoptr<HttpResponse> EHSServer::ProcessRequest(HttpRequest *request)
+{
+    if (!request->ParseBody()) {
+        EHS_TRACE("Sending 400 because of a malformed request body", "");
+        return ehs_move(ehs_autoptr<HttpResponse>(HttpResponse::Error(HTTPRESPONSECODE_400_BADREQUEST, request)));
+    }
+    ehs_autoptr<HttpResponse> response(m_poTopLevelEHS->RouteRequest(request));
+    // The ETag is computed before compression, so that it identifies the
+    // content. The compressor marks it weak, if it encodes the body.
+    if (m_bConditional && (NULL != response.get()) &&
+            (HTTPRESPONSECODE_200_OK == response->GetResponseCode())) {
+        response->GenerateETag();
+        if (response->IsNotModified(request)) {
+            response->SetNotModified();
+        }
+    }
+    // Ranges refer to the uncompressed body, the compressor skips 206 and 416.
+    if (m_oRanges.Enabled() && (NULL != response.get())) {
+        m_oRanges.Apply(request, response.get());
+    }
+    if (m_oCompressor.Enabled() && (NULL != response.get())) {
+        m_oCompressor.Apply(request, response.get());
+    }
+    return ehs_move(response);
+}
+
+void EHSServer::DispatchRequest()
+{
+    MutexHelper mutex(&m_oMutex);
+    m_nTasks++;
+    mutex.Unlock();
+    // the task decrements m_nTasks when it is destroyed
+    Execute(new EHSRequestTask(this));
+}
+
+void EHSServer::TaskDone()
+{
+    MutexHelper mutex(&m_oMutex);
+    m_nTasks--;
+}
+
+void EHSServer::Execute(ExecutorTask *task)
+{
+    if (m_poExecutor == m_poOwnExecutor) {
+        m_poExecutor->Execute(task);
+    } else {
+        m_poExecutor->Execute(new EHSForeignTask(this, task));
+    }
+}
+
+void EHSServer::HandleRequestTask()
+{
+    const ehs_threadid_t self = THREADID(pthread_self());
+    MutexHelper mutex(&m_oMutex);
+    HttpRequest *req = GetNextRequest();
+    m_oCurrentRequest[self] = req;
+    mutex.Unlock();
+    if (NULL != req) {
+        ehs_autoptr<GenericResponse> eResponse;
+        bool catched = false;
+        try {
+            ehs_autoptr<GenericResponse> response(ProcessRequest(req));
+            response->GetConnection()->AddResponse(ehs_move(response));
+        } catch (exception &e) {
+            catched = true;
+            eResponse.reset(m_poTopLevelEHS->HandleThreadException(self, req, e));
+        } catch (...) {
+            catched = true;
+            runtime_error e("unspecified");
+            eResponse.reset(m_poTopLevelEHS->HandleThreadException(self, req, e));
+        }
+        if (catched) {
+            if (NULL != eResponse.get()) {
+                eResponse->GetConnection()->AddResponse(ehs_move(eResponse));
+            } else {
+                m_nServerRunningStatus = SERVERRUNNING_SHOULDTERMINATE;
+                m_nAcceptThreadId = 0;
+            }
+        }
+        delete req;
+    }
+    mutex.Lock();
+    m_oCurrentRequest.erase(self);
+}
+
+int EHSServer::AddTimer(TimerHandler *handler, unsigned long delay, unsigned long interval)
+{
+    if (NULL == handler) {
+        throw invalid_argument("EHSServer::AddTimer: handler is NULL");
+    }
+    MutexHelper mutex(&m_oMutex);
+    EHSTimer t;
+    t.handler = handler;
+    t.due = MonotonicMillis() + delay;
+    t.interval = interval;
+    int id = ++m_nLastTimerId;
+    m_oTimers[id] = t;
+    m_oTimerQueue.insert(EHSTimerQueue::value_type(t.due, id));
+    // If a select() is pending which would return too late, interrupt it.
+    bool wakeup = (0 != m_nSelectDeadline) && (t.due < m_nSelectDeadline);
+    mutex.Unlock();
+    if (wakeup) {
+        Wakeup();
+    }
+    return id;
+}
+
+bool EHSServer::RemoveTimer(int id)
+{
+    // The queue entry is discarded lazily by RunTimers.
+    MutexHelper mutex(&m_oMutex);
+    return (0 < m_oTimers.erase(id));
+}
+
+int EHSServer::NextTimerTimeout(int timeout)
+{
+    MutexHelper mutex(&m_oMutex);
+    unsigned long long now = MonotonicMillis();
+    // skip queue entries of cancelled timers
+    while (!m_oTimerQueue.empty() &&
+            (m_oTimers.end() == m_oTimers.find(m_oTimerQueue.begin()->second))) {
+        m_oTimerQueue.erase(m_oTimerQueue.begin());
+    }
+    if (!m_oTimerQueue.empty()) {
+        unsigned long long due = m_oTimerQueue.begin()->first;
+        if (due <= now) {
+            timeout = 0;
+        } else if (due - now < (unsigned long long)timeout) {
+            timeout = (int)(due - now);
+        }
+    }
+    m_nSelectDeadline = now + timeout;
+    return timeout;
+}
+
+void EHSServer::RunTimers(ehs_threadid_t tid)
+{
+    std::vector<EHSTimerTask *> expired;
+    MutexHelper mutex(&m_oMutex);
+    unsigned long long now = MonotonicMillis();
+    while (!m_oTimerQueue.empty() && (m_oTimerQueue.begin()->first <= now)) {
+        unsigned long long due = m_oTimerQueue.begin()->first;
+        int id = m_oTimerQueue.begin()->second;
+        m_oTimerQueue.erase(m_oTimerQueue.begin());
+        EHSTimerMap::iterator i = m_oTimers.find(id);
+        if ((m_oTimers.end() == i) || (i->second.due != due)) {
+            // cancelled
+            continue;
+        }
+        expired.push_back(new EHSTimerTask(this, i->second.handler, id, 0 != i->second.interval));
+        if (0 == i->second.interval) {
+            m_oTimers.erase(i);
+        } else {
+            // Reschedule relative to the previous expiry, in order to avoid
+            // drift, but don't try to catch up with missed expiries.
+            i->second.due += i->second.interval;
+            if (i->second.due <= now) {
+                i->second.due = now + i->second.interval;
+            }
+            m_oTimerQueue.insert(EHSTimerQueue::value_type(i->second.due, id));
+        }
+    }
+    mutex.Unlock();
+    for (std::vector<EHSTimerTask *>::iterator i = expired.begin(); i != expired.end(); ++i) {
+        mutex.Lock();
+        m_nTasks++;
+        mutex.Unlock();
+        if (SERVERRUNNING_THREADPOOL == m_nServerRunningStatus) {
+            Execute(*i);
+        } else {
+            EHS_TRACE("Running timer task in thread %p", tid);
+            ehs_autoptr<EHSTimerTask> task(*i);
+            task->Run();
+        }
+    }
+}
+
+void EHSServer::HandleTimerTask(TimerHandler *handler, int id, bool periodic)
+{
+    const ehs_threadid_t self = THREADID(pthread_self());
+    MutexHelper mutex(&m_oMutex);
+    // One-shot timers have been removed already when being dispatched.
+    bool cancelled = periodic && (m_oTimers.end() == m_oTimers.find(id));
+    mutex.Unlock();
+    if (!cancelled) {
+        bool catched = false;
+        ehs_autoptr<GenericResponse> eResponse;
+        try {
+            handler->OnTimer(id);
+        } catch (exception &e) {
+            catched = true;
+            eResponse.reset(m_poTopLevelEHS->HandleThreadException(self, NULL, e));
+        } catch (...) {
+            catched = true;
+            runtime_error e("unspecified");
+            eResponse.reset(m_poTopLevelEHS->HandleThreadException(self, NULL, e));
+        }
+        if (catched) {
+            if (NULL != eResponse.get()) {
+                m_poTopLevelEHS->AddResponse(ehs_move(eResponse));
+            } else {
+                m_nServerRunningStatus = SERVERRUNNING_SHOULDTERMINATE;
+                m_nAcceptThreadId = 0;
+            }
+        }
+    }
+}
+
+void EHSServer::Wakeup()
+{
+#ifndef _WIN32
+    if (INVALID_SOCKET != m_aWakeupFds[1]) {
+        char c = 0;
+        if (write(m_aWakeupFds[1], &c, 1) < 0) {
+            EHS_TRACE("Could not write to wakeup pipe", "");
+        }
+    }
+#endif
+}
+
 void EHSServer::CheckAcceptSocket ( )
 {
     // see if we got data on this socket
@@ -763,6 +1384,15 @@ void EHSServer::CheckAcceptSocket ( )
             std::cerr << emsg << endl;
             return;
         }
+#ifndef _WIN32
+        // select() can only watch descriptors below FD_SETSIZE.
+        if (poNewClient->GetFd() >= FD_SETSIZE) {
+            EHS_TRACE("Refusing connection on FD %d (FD_SETSIZE exceeded)",
+                    poNewClient->GetFd());
+            delete poNewClient;
+            return;
+        }
+#endif
         // create a new EHSConnection object and initialize it
         EHSConnection * poEHSConnection = new EHSConnection ( poNewClient, this );
         if (m_poTopLevelEHS->m_oParams.find("maxrequestsize") !=
@@ -771,6 +1401,26 @@ void EHSServer::CheckAcceptSocket ( )
             EHS_TRACE("Setting connections MaxRequestSize to %lu\n", n);
             poEHSConnection->SetMaxRequestSize ( n );
         }
+        if (m_poTopLevelEHS->m_oParams.find("multipartspillsize") !=
+                m_poTopLevelEHS->m_oParams.end()) {
+            unsigned long n = m_poTopLevelEHS->m_oParams["multipartspillsize"];
+            poEHSConnection->SetMultipartSpillSize ( n );
+        }
+        if (m_poTopLevelEHS->m_oParams.find("inflaterequests") !=
+                m_poTopLevelEHS->m_oParams.end()) {
+            unsigned long enable = m_poTopLevelEHS->m_oParams["inflaterequests"];
+            unsigned long maxsize = 0;
+            unsigned long maxratio = MAX_INFLATE_RATIO_DEFAULT;
+            if (m_poTopLevelEHS->m_oParams.find("maxinflatedsize") !=
+                    m_poTopLevelEHS->m_oParams.end()) {
+                maxsize = m_poTopLevelEHS->m_oParams["maxinflatedsize"];
+            }
+            if (m_poTopLevelEHS->m_oParams.find("maxinflateratio") !=
+                    m_poTopLevelEHS->m_oParams.end()) {
+                maxratio = m_poTopLevelEHS->m_oParams["maxinflateratio"];
+            }
+            poEHSConnection->SetInflateBodies(0 != enable, maxsize, maxratio);
+        }
         if (m_poTopLevelEHS->m_oParams.find("parsecontenttype") !=
                 m_poTopLevelEHS->m_oParams.end()) {
             
@@ -798,9 +1448,10 @@ void EHSServer::CheckClientSockets ( )
     for (EHSConnectionList::iterator i = m_oEHSConnectionList.begin();
             i != m_oEHSConnectionList.end(); ++i) {
         if (FD_ISSET((*i)->GetNetworkAbstraction()->GetFd(), &m_oReadFds)) {
-            // do the actual read
-            char buf[8192];
-            int nBytesReceived = (*i)->GetNetworkAbstraction()->Read(buf, sizeof(buf));
+            // do the actual read, directly into the connection's input buffer
+            size_t nBufSize = 0;
+            char *buf = (*i)->GetReadBuffer(nBufSize);
+            int nBytesReceived = (*i)->GetNetworkAbstraction()->Read(buf, static_cast<int>(nBufSize));
 
             if ((*i)->IsRaw()) {
                 if (0 > nBytesReceived) {
@@ -828,56 +1479,91 @@ void EHSServer::CheckClientSockets ( )
                 (*i)->DoneReading(true);
             } else {
                 // otherwise we got data
-                // take the data we got and append to the connection's buffer
+                // the data is already in the connection's buffer, parse it
                 EHSConnection::AddBufferResult nAddBufferResult =
-                    (*i)->AddBuffer(buf, nBytesReceived);
-                // if add buffer failed, don't read from this connection anymore
-                switch (nAddBufferResult) {
-                    case EHSConnection::ADDBUFFER_INVALIDREQUEST:
-                        {
-                            // Immediately send a 400 response, then close the connection
-                            ehs_autoptr<GenericResponse> tmp(HttpResponse::Error(HTTPRESPONSECODE_400_BADREQUEST, 0, *i));
-                            (*i)->SendResponse(tmp.get());
-                            (*i)->DoneReading(false);
-                            EHS_TRACE("Done reading because we got a bad request", "");
-                        }
-                        break;
-                    case EHSConnection::ADDBUFFER_TOOBIG:
-                        {
-                            // Immediately send a configurable response (Default: 413), then close the connection
-                            ResponseCode rc = HTTPRESPONSECODE_413_TOOLARGE;
-                            if (m_poTopLevelEHS->m_oParams.find("code413") !=
-                                    m_poTopLevelEHS->m_oParams.end()) {
-                                unsigned long n = m_poTopLevelEHS->m_oParams["code413"];
-                                rc = (ResponseCode)n;
-                            }
-                            ehs_autoptr<GenericResponse> tmp(HttpResponse::Error(rc, 0, *i));
-                            (*i)->SendResponse(tmp.get());
-                            (*i)->DoneReading(false);
+                    (*i)->AddBuffer(nBytesReceived);
+                HandleAddBufferResult(*i, nAddBufferResult);
+            } // end nBytesReceived
+        } // FD_ISSET
+    } // for loop through connections
+}
+
+void EHSServer::CheckResumedConnections()
+{
+    for (EHSConnectionList::iterator i = m_oEHSConnectionList.begin();
+            i != m_oEHSConnectionList.end(); ++i) {
+        if ((*i)->StillReading()) {
+            EHSConnection::AddBufferResult nAddBufferResult = (*i)->ParseResumedInput();
+            if (EHSConnection::ADDBUFFER_INVALID != nAddBufferResult) {
+                HandleAddBufferResult(*i, nAddBufferResult);
+            }
+        }
+    }
+}
+
+void EHSServer::HandleAddBufferResult(EHSConnection *ipoConnection,
+        EHSConnection::AddBufferResult inResult)
+{
+    // if add buffer failed, don't read from this connection anymore
+    switch (inResult) {
+        case EHSConnection::ADDBUFFER_INVALIDREQUEST:
+            {
+                // Immediately send a 400 response, then close the connection
+                ehs_autoptr<GenericResponse> tmp(HttpResponse::Error(HTTPRESPONSECODE_400_BADREQUEST, 0, ipoConnection));
+                ipoConnection->SendResponse(tmp.get());
+                ipoConnection->DoneReading(false);
+                EHS_TRACE("Done reading because we got a bad request", "");
+            }
+            break;
+        case EHSConnection::ADDBUFFER_TOOBIG:
+            {
+                // Immediately send a configurable response (Default: 413), then close the connection
+                ResponseCode rc = HTTPRESPONSECODE_413_TOOLARGE;
+                if (m_poTopLevelEHS->m_oParams.find("code413") !=
+                        m_poTopLevelEHS->m_oParams.end()) {
+                    unsigned long n = m_poTopLevelEHS->m_oParams["code413"];
+                    rc = (ResponseCode)n;
+                }
+                ehs_autoptr<GenericResponse> tmp(HttpResponse::Error(rc, 0, ipoConnection));
+                ipoConnection->SendResponse(tmp.get());
+                ipoConnection->DoneReading(false);
 #ifdef SPECIAL_STDERR
-                            std::cerr << "EHS Warning: Request size exceeded. Returning " << tmp.GetStatusString() << "." << std::endl;
+                std::cerr << "EHS Warning: Request size exceeded. Returning " << tmp.GetStatusString() << "." << std::endl;
 #endif
-                            EHS_TRACE("Done reading because we got a too large request", "");
-                        }
-                        break;
-                    case EHSConnection::ADDBUFFER_NORESOURCE:
-                        {
-                            // Immediately send a 503 response, then close the connection
-                            ehs_autoptr<GenericResponse> tmp(HttpResponse::Error(HTTPRESPONSECODE_503_SERVICEUNAVAILABLE, 0, *i));
-                            (*i)->SendResponse(tmp.get());
-                            (*i)->DoneReading(false);
+                EHS_TRACE("Done reading because we got a too large request", "");
+            }
+            break;
+        case EHSConnection::ADDBUFFER_REJECTED:
+            {
+                // Immediately send the final response to a rejected expectation, then close the connection
+                ehs_autoptr<GenericResponse> tmp(HttpResponse::Error(ipoConnection->m_nRejectCode, 0, ipoConnection));
+                ipoConnection->SendResponse(tmp.get());
+                ipoConnection->DoneReading(false);
+                EHS_TRACE("Done reading because the expectation was rejected", "");
+            }
+            break;
+        case EHSConnection::ADDBUFFER_NORESOURCE:
+            {
+                // Immediately send a 503 response, then close the connection
+                ehs_autoptr<GenericResponse> tmp(HttpResponse::Error(HTTPRESPONSECODE_503_SERVICEUNAVAILABLE, 0, ipoConnection));
+                ipoConnection->SendResponse(tmp.get());
+                ipoConnection->DoneReading(false);
 #ifdef SPECIAL_STDERR
-                            std::cerr << "EHS Warning: No ressources available. Returning " << tmp.GetStatusString() << "." << std::endl;
+                std::cerr << "EHS Warning: No ressources available. Returning " << tmp.GetStatusString() << "." << std::endl;
 #endif
-                            EHS_TRACE("Done reading because we are out of ressources", "");
-                        }
-                        break;
-                    default:
-                        break;
-                }
-            } // end nBytesReceived
-        } // FD_ISSET
-    } // for loop through connections
+                EHS_TRACE("Done reading because we are out of ressources", "");
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/// Determines, whether a response has a "Connection: close" header.
+static bool WantsClose(HttpResponse *response)
+{
+    StringCaseMap::const_iterator i = response->GetHeaders().find(HEADER_CONNECTION);
+    return (response->GetHeaders().end() != i) && (0 == i->second.compare("close"));
 }
 
 void EHSConnection::AddResponse(ehs_autoptr<GenericResponse> ehs_rvref response)
@@ -885,27 +1571,60 @@ void EHSConnection::AddResponse(ehs_autoptr<GenericResponse> ehs_rvref response)
     MutexHelper mutex(&m_oMutex);
     // push the object on to the list
     m_oResponseQueue.push_back(ehs_move(response));
+    // If another thread is sending, it picks up our response as well.
+    if (m_bSending) {
+        return;
+    }
+    m_bSending = true;
     while (!m_oResponseQueue.empty()) {
-        ehs_autoptr<GenericResponse> tmp = ehs_move(m_oResponseQueue.front());
-        m_oResponseQueue.pop_front();
+        // Gather pipelined responses, so that they go out with a single write.
+        // A non-HTTP response, a switch of protocols, a close or a file or produced body
+        // ends the batch.
+        ehs_autoptr<GenericResponse> batch[MAX_RESPONSE_BATCH];
+        GenericResponse *responses[MAX_RESPONSE_BATCH];
+        size_t count = 0;
+        while ((!m_oResponseQueue.empty()) && (count < MAX_RESPONSE_BATCH)) {
+            HttpResponse *response = dynamic_cast<HttpResponse *>(m_oResponseQueue.front().get());
+            if ((NULL == response) && (0 < count)) {
+                break;
+            }
+            batch[count] = ehs_move(m_oResponseQueue.front());
+            m_oResponseQueue.pop_front();
+            responses[count] = batch[count].get();
+            ++count;
+            if ((NULL == response) ||
+                    (HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS == response->GetResponseCode()) ||
+                    WantsClose(response) || response->HasBodyFile() ||
+                    (NULL != response->GetBodyProducer())) {
+                break;
+            }
+        }
         mutex.Unlock();
-        SendResponse(tmp.get());
+        SendResponses(responses, count, m_sSendBuffer);
         mutex.Lock();
         // set last activity to the current time for idle purposes
         UpdateLastActivity();
         EHS_TRACE("Sending %d response(s) to %x", m_nResponses, this);
     }
+    m_bSending = false;
 }
 
 void EHSConnection::SendResponse(GenericResponse *gresp)
+{
+    // Not serialized with AddResponse, hence a buffer of our own.
+    string head;
+    SendResponses(&gresp, 1, head);
+}
+
+void EHSConnection::SendResponses(GenericResponse **responses, size_t count, string &head)
 {
     MutexHelper mutex(&m_oMutex);
     bool forceClose = false;
     int r = 0;
 
-    HttpResponse *response = dynamic_cast<HttpResponse *>(gresp);
-    bool processed = false;
-    if (NULL == response) {
+    HttpResponse *last = dynamic_cast<HttpResponse *>(responses[count - 1]);
+    if (NULL == last) {
+        GenericResponse *gresp = responses[0];
         // only send it if the client isn't disconnected
         if (Disconnected()) {
             return;
@@ -921,89 +1640,143 @@ void EHSConnection::SendResponse(GenericResponse *gresp)
             // Special case: "sending" a zero-sized body triggers a close.
             DoneReading(false);
         }
-    } else {
-        processed = true;
-        // only send it if the client isn't disconnected
-        if (Disconnected()) {
-            --m_nActiveRequests;
-            ++m_nResponses;
-            return;
-        }
-        EHS_TRACE("Sending HTTP response", "");
-        HttpResponse *response = reinterpret_cast<HttpResponse *>(gresp);
-        forceClose = ((0 == response->Header("connection").compare("close")) &&
-                (HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS != response->GetResponseCode()));
-        ostringstream oss;
-        // add in the response code
-        oss << "HTTP/1.1 " << response->GetResponseCode()
-            << " " << HttpResponse::GetPhrase(response->GetResponseCode()) << "\r\n";
-
-        // now go through all the entries in the responseheaders string map
-        StringCaseMap::iterator ith = response->GetHeaders().begin();
-        while (ith != response->GetHeaders().end()) {
-            oss << ith->first << ": " << ith->second << "\r\n";
-            ++ith;
-        }
-
-        // now push out all the cookies
-        StringList::iterator itl = response->GetCookies().begin ( );
-        while (itl != response->GetCookies().end()) {
-            oss << "Set-Cookie: " << *itl << "\r\n";
-            ++itl;
+        mutex.Lock();
+        if (-1 == r) {
+            DoneReading(false);
         }
+        return;
+    }
 
-        // extra line break signalling end of headers
-        oss << "\r\n";
-        mutex.Unlock();
-        r = m_poNetworkAbstraction->Send(
-                reinterpret_cast<const void *>(oss.str().c_str()), oss.str().length());
-
-        if (-1 != r) {
-            // Switch protocols if necessary
-            if (HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS == response->GetResponseCode()) {
-                EHS_TRACE("Switching connection to RAW mode", "");
-                m_bRawMode = true;
-                RawSocketHandler *rsh = m_poEHSServer->m_poTopLevelEHS->GetRawSocketHandler();
-                if (rsh) {
-                    rsh->OnConnect(this);
-                }
-                mutex.Lock();
-                --m_nActiveRequests;
-                ++m_nResponses;
-                return;
-            }
-
-            // now send the body
-            int blen = atoi(response->Header("content-length").c_str());
+    // only send it if the client isn't disconnected
+    if (Disconnected()) {
+        m_nActiveRequests -= count;
+        m_nResponses += count;
+        return;
+    }
+    EHS_TRACE("Sending %d HTTP response(s)", count);
+    bool switching = (HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS == last->GetResponseCode());
+    forceClose = ((!switching) && (WantsClose(last) || last->IsCloseDelimited()));
+
+    // Serialize all headers first, the buffer might get reallocated while doing so.
+    size_t offsets[MAX_RESPONSE_BATCH + 1];
+    head.clear();
+    for (size_t i = 0; i < count; ++i) {
+        offsets[i] = head.length();
+        reinterpret_cast<HttpResponse *>(responses[i])->AppendHead(head);
+    }
+    offsets[count] = head.length();
+
+    // Each header is followed by its body, unless switching protocols
+    // or answering a HEAD request.
+    NetworkBuffer parts[2 * MAX_RESPONSE_BATCH];
+    size_t nparts = 0;
+    for (size_t i = 0; i < count; ++i) {
+        HttpResponse *response = reinterpret_cast<HttpResponse *>(responses[i]);
+        parts[nparts].data = head.data() + offsets[i];
+        parts[nparts++].len = offsets[i + 1] - offsets[i];
+        if ((HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS != response->GetResponseCode()) &&
+                (!response->HasBodyFile()) && (!response->IsHeadOnly())) {
+            size_t blen = response->ContentLength();
             if (blen > 0) {
-                EHS_TRACE("Sending %d bytes in thread %08x", blen, pthread_self());
-                int r = m_poNetworkAbstraction->Send(response->GetBody().data(), blen);
-                EHS_TRACE("Done sending %d bytes in thread %08x r=%d", blen, pthread_self(), r);
+                parts[nparts].data = response->GetBody().data();
+                parts[nparts++].len = blen;
             }
         }
     }
+    mutex.Unlock();
+    r = m_poNetworkAbstraction->SendBuffers(parts, nparts);
+    // A file body is always last and sent directly from the file.
+    if ((-1 != r) && last->HasBodyFile() && (0 < last->ContentLength()) && (!last->IsHeadOnly())) {
+        r = m_poNetworkAbstraction->SendFile(last->GetBodyFd(),
+                last->GetBodyFileOffset(), last->ContentLength());
+    }
+    // So is a produced body, which is sent while it is generated.
+    if ((-1 != r) && (NULL != last->GetBodyProducer()) && (!last->IsHeadOnly())) {
+        r = SendProduced(last);
+    }
+    EHS_TRACE("Done sending %d response(s) in thread %08x r=%d", count, pthread_self(), r);
+
+    // Switch protocols if necessary
+    if ((-1 != r) && switching) {
+        EHS_TRACE("Switching connection to RAW mode", "");
+        m_bRawMode = true;
+        RawSocketHandler *rsh = m_poEHSServer->m_poTopLevelEHS->GetRawSocketHandler();
+        if (rsh) {
+            rsh->OnConnect(this);
+        }
+        mutex.Lock();
+        m_nActiveRequests -= count;
+        m_nResponses += count;
+        return;
+    }
+
     mutex.Lock();
     if (forceClose || (-1 == r)) {
         DoneReading(false);
     }
 
     // moved here to avoid race conditions deleting the connection during sending the response
-    if(processed) {
-        --m_nActiveRequests;
-        ++m_nResponses;
+    m_nActiveRequests -= count;
+    m_nResponses += count;
+}
+
+int EHSConnection::SendProduced(HttpResponse *response)
+{
+    bool chunked = response->IsChunked();
+    string piece;
+    bool more = true;
+    while (more) {
+        piece.clear();
+        try {
+            more = response->GetBodyProducer()->Produce(response, piece);
+        } catch (...) {
+            // The headers are out already, so the only way to signal
+            // an incomplete body is to close the connection.
+            EHS_TRACE("Producer threw an exception, aborting response", "");
+            return -1;
+        }
+        NetworkBuffer parts[3];
+        size_t nparts = 0;
+        char size[24];
+        if (!piece.empty()) {
+            if (chunked) {
+                parts[nparts].data = size;
+                parts[nparts++].len = snprintf(size, sizeof(size), "%lx\r\n",
+                        static_cast<unsigned long>(piece.length()));
+            }
+            parts[nparts].data = piece.data();
+            parts[nparts++].len = piece.length();
+            if (chunked) {
+                parts[nparts].data = more ? "\r\n" : "\r\n0\r\n\r\n";
+                parts[nparts++].len = more ? 2 : 7;
+            }
+        } else if (chunked && (!more)) {
+            // last-chunk without trailers
+            parts[nparts].data = "0\r\n\r\n";
+            parts[nparts++].len = 5;
+        }
+        // Blocks while the client is not reading, which throttles the producer.
+        if ((0 < nparts) && (-1 == m_poNetworkAbstraction->SendBuffers(parts, nparts))) {
+            return -1;
+        }
     }
+    return 0;
 }
 
 void EHSServer::EndServerThread()
 {
-    pthread_mutex_lock(&m_oMutex);
+    MutexHelper mutex(&m_oMutex);
     m_nServerRunningStatus = SERVERRUNNING_NOTRUNNING;
     m_nAcceptThreadId = 0;
-    pthread_mutex_unlock(&m_oMutex);
-    while (m_nThreads > 0) {
-        EHS_TRACE ("Waiting for %d threads to terminate", m_nThreads);
+    // Tasks hold a pointer to this server, so wait until every task
+    // has been destroyed, even if that takes long. An Executor which
+    // is stopped, deletes its queued tasks without running them.
+    while (m_nThreads > 0 || m_nTasks > 0) {
+        EHS_TRACE ("Waiting for %d threads and %d tasks to terminate", m_nThreads, m_nTasks);
         pthread_cond_broadcast(&m_oDoneAccepting);
+        mutex.Unlock();
         sleep(1);
+        mutex.Lock();
     }
     EHS_TRACE ("all threads terminated", "");
 }
@@ -1016,7 +1789,10 @@ EHS::EHS (EHS *ipoParent, string isRegisteredAs) :
     m_poSourceEHS(NULL),
     m_poBindHelper(NULL),
     m_poRawSocketHandler(NULL),
+    m_poRequestBodyHandler(NULL),
+    m_poExecutor(NULL),
     m_bNoRouting(false),
+    m_oContentCodings(ContentCodingList()),
     m_oParams(EHSServerParameters())
 {
     EHS_TRACE("TID=%p", pthread_self());
@@ -1078,8 +1854,10 @@ string GetNextPathPart(string &irsUri)
     boost::regex re("^/{0,1}([^/]+)/(.*)$");
     boost::smatch match;
     if (boost::regex_match(irsUri, match, re)) {
+        // match refers to irsUri, so copy the part before modifying it
+        string part(match[1]);
         irsUri = match[2];
-        return match[1];
+        return part;
     }
     return string("");
 }
@@ -1103,9 +1881,11 @@ EHS::RouteRequest(HttpRequest *request ///< request info for service
         // create an HttpRespose object for the client
         ehs_autoptr<HttpResponse> response(new HttpResponse(request->m_nRequestId,
                     request->m_poSourceEHSConnection));
+        response->m_bHeadOnly = (REQUESTMETHOD_HEAD == request->Method());
         // get the actual response and return code
         if (0 == request->HttpVersion().compare("1.0")) {
-            if (0 == request->Headers("Connection").compare("keep-alive")) {
+            response->m_bChunkedAllowed = false;
+            if (request->HasHeaderToken(HEADERTOKEN_CONNECTION_KEEPALIVE)) {
                 response->SetHeader("Connection", "keep-alive");
             } else {
                 response->SetHeader("Connection", "close");
@@ -1139,12 +1919,21 @@ ResponseCode EHS::HandleRequest(HttpRequest *request,
     }
     // otherwise, just send back the current time
     ostringstream oss;
-    oss << time(NULL);
+    oss << CachedClock::Now();
     response->SetBody(oss.str().c_str(), oss.str().length());
     response->SetHeader("Content-Type", "text/plain");
     return HTTPRESPONSECODE_200_OK;
 }
 
+ResponseCode EHS::HandleExpectContinue(HttpRequest *request)
+{
+    // if we have a source EHS specified, use it
+    if (m_poSourceEHS != NULL) {
+        return m_poSourceEHS->HandleExpectContinue(request);
+    }
+    return HTTPRESPONSECODE_100_CONTINUE;
+}
+
 void EHS::SetSourceEHS(EHS & iroSourceEHS)
 {
     m_poSourceEHS = &iroSourceEHS;
@@ -33,6 +33,8 @@
 #include <deque>
 #include <list>
 
+#include "headermap.h"
+
 class EHSServer;
 class EHSConnection;
 class EHS;
@@ -163,8 +165,8 @@ class GenericResponse {
 /// generic std::string => std::string map used by many things
 typedef std::map < std::string, std::string > StringMap;
 
-/// std::string => std::string map with case-insensitive search
-typedef std::map < std::string, std::string, __caseless > StringCaseMap;
+/// std::string => std::string map with case-insensitive search (used for HTTP headers)
+typedef HeaderMap StringCaseMap;
 
 /// generic list of std::strings
 typedef std::list < std::string > StringList;
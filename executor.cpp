@@ -0,0 +1,148 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "executor.h"
+#include "mutexhelper.h"
+#include "debug.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+ThreadPoolExecutor::ThreadPoolExecutor(int threads, size_t stacksize) :
+    m_oTasks(std::deque<ExecutorTask *>()),
+    m_oThreads(std::vector<pthread_t>()),
+    m_oMutex(pthread_mutex_t()),
+    m_oCond(pthread_cond_t()),
+    m_bStopping(false)
+{
+    pthread_mutex_init(&m_oMutex, NULL);
+    pthread_cond_init(&m_oCond, NULL);
+    if (0 < threads) {
+        Start(threads, stacksize);
+    }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor()
+{
+    Stop();
+    pthread_cond_destroy(&m_oCond);
+    pthread_mutex_destroy(&m_oMutex);
+}
+
+void ThreadPoolExecutor::Start(int threads, size_t stacksize)
+{
+    if (threads <= 0) {
+        threads = 1;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (0 < stacksize) {
+        size_t defsize;
+        pthread_attr_getstacksize(&attr, &defsize);
+        if (defsize < stacksize) {
+            EHS_TRACE("Setting thread stack size to %lu", stacksize);
+            pthread_attr_setstacksize(&attr, stacksize);
+        }
+    }
+    MutexHelper mh(&m_oMutex);
+    m_bStopping = false;
+    for (int i = 0; i < threads; ++i) {
+        pthread_t thread;
+        if (0 != pthread_create(&thread, &attr, ThreadPoolExecutor::ThreadStub, (void *)this)) {
+            pthread_attr_destroy(&attr);
+            mh.Unlock();
+            Stop();
+            throw runtime_error("ThreadPoolExecutor::Start: Unable to create threads");
+        }
+        m_oThreads.push_back(thread);
+    }
+    pthread_attr_destroy(&attr);
+    EHS_TRACE("Started %d threads", threads);
+}
+
+void ThreadPoolExecutor::Stop()
+{
+    MutexHelper mh(&m_oMutex);
+    m_bStopping = true;
+    pthread_cond_broadcast(&m_oCond);
+    std::vector<pthread_t> threads;
+    threads.swap(m_oThreads);
+    mh.Unlock();
+    for (std::vector<pthread_t>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        pthread_join(*i, NULL);
+    }
+    mh.Lock();
+    while (!m_oTasks.empty()) {
+        delete m_oTasks.front();
+        m_oTasks.pop_front();
+    }
+}
+
+void ThreadPoolExecutor::Execute(ExecutorTask *task)
+{
+    if (NULL == task) {
+        throw invalid_argument("ThreadPoolExecutor::Execute: task is NULL");
+    }
+    MutexHelper mh(&m_oMutex);
+    m_oTasks.push_back(task);
+    pthread_cond_signal(&m_oCond);
+}
+
+void *ThreadPoolExecutor::ThreadStub(void *ipData)
+{
+    ThreadPoolExecutor *self = reinterpret_cast<ThreadPoolExecutor *>(ipData);
+    if (self->ThreadInitHandler()) {
+        self->Worker();
+        self->ThreadExitHandler();
+    }
+    return NULL;
+}
+
+void ThreadPoolExecutor::Worker()
+{
+    MutexHelper mh(&m_oMutex);
+    while (!m_bStopping) {
+        if (m_oTasks.empty()) {
+            pthread_cond_wait(&m_oCond, &m_oMutex);
+            continue;
+        }
+        ExecutorTask *task = m_oTasks.front();
+        m_oTasks.pop_front();
+        mh.Unlock();
+        try {
+            task->Run();
+        } catch (...) {
+            // Tasks are supposed to handle their own exceptions.
+            EHS_TRACE("Task threw an exception", "");
+        }
+        delete task;
+        mh.Lock();
+    }
+}
@@ -35,7 +35,8 @@
 FormValue::FormValue() :
     m_oFormHeaders(StringMap()),
     m_oContentDisposition(ContentDisposition()),
-    m_sBody("")
+    m_sBody(""),
+    m_sTempFile("")
 {
 }
 
@@ -43,14 +44,16 @@ FormValue::FormValue(std::string & irsBody,
         ContentDisposition & ioContentDisposition) :
     m_oFormHeaders(StringMap()),
     m_oContentDisposition(ioContentDisposition),
-    m_sBody(irsBody)
+    m_sBody(irsBody),
+    m_sTempFile("")
 {
 }
 
 FormValue::FormValue(const FormValue & other) :
     m_oFormHeaders(other.m_oFormHeaders),
     m_oContentDisposition(other.m_oContentDisposition),
-    m_sBody(other.m_sBody)
+    m_sBody(other.m_sBody),
+    m_sTempFile(other.m_sTempFile)
 {
 }
 
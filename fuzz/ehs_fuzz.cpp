@@ -0,0 +1,549 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+/*
+ * Fuzz and complexity harness for the request parser.
+ *
+ * Feeds arbitrary data into EHSConnection::AddBuffer, split at arbitrary
+ * positions (determined by the first byte of an input), just like the server loop does with the data it reads from
+ * a socket, and interprets the resulting requests (body, form values,
+ * cookies) like the request handling threads do.
+ *
+ * Standalone usage:
+ *   ehs_fuzz [-max_total_time=<seconds>] [-seed=<n>] [file ...]
+ * Without files, it first checks that the parse time of a set of
+ * adversarial inputs grows linearly with their size (exit code 1, if
+ * it doesn't), then mutates these inputs randomly until the time budget
+ * is used up. With files, it just runs these (e.g. for reproducing a
+ * crash, whose input is saved as ehs_fuzz-crash.bin).
+ *
+ * Compiled with -DEHS_LIBFUZZER, it provides LLVMFuzzerTestOneInput
+ * only, for linking with libFuzzer (-fsanitize=fuzzer).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "ehs.h"
+#include "networkabstraction.h"
+#include "ehsconnection.h"
+#include "ehsserver.h"
+#include "socket.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <signal.h>
+#include <fcntl.h>
+#ifndef _WIN32
+# include <unistd.h>
+#endif
+
+using namespace std;
+
+/// A connection endpoint that never talks to the network.
+class NullNetwork : public NetworkAbstraction {
+    public:
+        NullNetwork() { }
+        virtual void RegisterBindHelper(PrivilegedBindHelper *) { }
+        virtual void SetBindAddress(const char *) { }
+        virtual string GetRemoteAddress() const { return "127.0.0.1"; }
+        virtual int GetRemotePort() const { return 0; }
+        virtual string GetLocalAddress() const { return "127.0.0.1"; }
+        virtual int GetLocalPort() const { return 0; }
+        virtual string GetPeer() const { return "127.0.0.1:0"; }
+        virtual void Init(int) { }
+        virtual ehs_socket_t GetFd() const { return INVALID_SOCKET; }
+        virtual int Read(void *, int) { return 0; }
+        virtual int Send(const void *, size_t buflen, int) { return static_cast<int>(buflen); }
+        virtual void Close() { }
+        virtual NetworkAbstraction *Accept() { return NULL; }
+        virtual bool IsSecure() const { return false; }
+        virtual void ThreadCleanup() { }
+};
+
+/// Small, fast PRNG (xorshift64), so that runs are reproducible.
+class Random {
+    public:
+        Random(unsigned long long seed) : m_nState(seed ? seed : 0x9e3779b97f4a7c15ULL) { }
+        unsigned long long Next()
+        {
+            m_nState ^= m_nState << 13;
+            m_nState ^= m_nState >> 7;
+            m_nState ^= m_nState << 17;
+            return m_nState;
+        }
+        /// returns a number in the range [0, n)
+        size_t Below(size_t n) { return static_cast<size_t>(Next() % n); }
+    private:
+        unsigned long long m_nState;
+};
+
+/**
+ * Drives the parser of an EHSConnection.
+ * A friend of EHSConnection and HttpRequest, for using the same
+ * internal entry points as EHSServer.
+ */
+class EHSFuzzDriver {
+    public:
+        /// maximum size of a request, large enough for the complexity checks
+        static const size_t MAX_REQUEST = 64 * 1024 * 1024;
+
+        EHSFuzzDriver() : m_oEHS(), m_poServer(NULL), m_nLastRequests(0)
+        {
+            m_oEHS.m_oParams["mode"] = "singlethreaded";
+            m_oEHS.m_oParams["bindaddress"] = "127.0.0.1";
+            m_oEHS.m_oParams["port"] = 0;
+            m_poServer = new EHSServer(&m_oEHS);
+        }
+
+        ~EHSFuzzDriver()
+        {
+            delete m_poServer;
+        }
+
+        /**
+         * Parses data on a fresh connection.
+         * @param data The data received by the connection.
+         * @param len The length of the data.
+         * @param maxsplit The largest piece handed to AddBuffer at once,
+         *   0 for passing everything at once.
+         * @param seed Determines the sizes of the pieces.
+         * @return The number of requests parsed.
+         */
+        size_t Run(const char *data, size_t len, size_t maxsplit, unsigned long long seed)
+        {
+            EHSConnection *conn = new EHSConnection(new NullNetwork(), m_poServer);
+            conn->SetMaxRequestSize(MAX_REQUEST);
+            Random rnd(seed);
+            size_t ret = 0;
+            size_t pos = 0;
+            while (pos < len) {
+                size_t n = len - pos;
+                if ((0 != maxsplit) && (n > maxsplit)) {
+                    n = 1 + rnd.Below(maxsplit);
+                }
+                EHSConnection::AddBufferResult r =
+                    conn->AddBuffer(const_cast<char *>(data + pos), static_cast<int>(n));
+                pos += n;
+                ret += Drain(conn);
+                if (EHSConnection::ADDBUFFER_OK != r) {
+                    break;
+                }
+            }
+            delete conn;
+            m_nLastRequests = ret;
+            return ret;
+        }
+
+        /// returns the number of requests parsed by the last Run
+        size_t LastRequests() const { return m_nLastRequests; }
+
+    private:
+        EHSFuzzDriver(const EHSFuzzDriver &);
+        EHSFuzzDriver & operator=(const EHSFuzzDriver &);
+
+        /// Interprets the complete requests, like EHSServer::ProcessRequest.
+        size_t Drain(EHSConnection *conn)
+        {
+            size_t ret = 0;
+            HttpRequest *req;
+            while (NULL != (req = conn->GetNextRequest())) {
+                if (req->ParseBody()) {
+                    req->FormValues();
+                    req->Cookies();
+                    req->Params();
+                }
+                delete req;
+                ++ret;
+            }
+            return ret;
+        }
+
+        EHS m_oEHS;
+
+        EHSServer *m_poServer;
+
+        size_t m_nLastRequests;
+};
+
+/// the input currently being parsed, saved if it crashes the parser
+static const unsigned char *g_pCurrentInput = NULL;
+static size_t g_nCurrentInput = 0;
+
+static EHSFuzzDriver & Driver()
+{
+    static EHSFuzzDriver driver;
+    return driver;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+    g_pCurrentInput = data;
+    g_nCurrentInput = size;
+    if (0 < size) {
+        // the first byte determines how the rest is split
+        size_t maxsplit = (data[0] < 128) ? (1 + data[0]) : 0;
+        Driver().Run(reinterpret_cast<const char *>(data) + 1, size - 1, maxsplit, data[0]);
+    }
+    return 0;
+}
+
+#ifndef EHS_LIBFUZZER
+
+/// Generates an adversarial input of approximately n bytes.
+typedef string (*Generator)(size_t n);
+
+static string Repeat(const string & head, const string & unit, const string & tail, size_t n)
+{
+    string ret(head);
+    while (ret.length() + tail.length() < n) {
+        ret.append(unit);
+    }
+    return ret.append(tail);
+}
+
+/// Like Repeat, but the units are numbered, e.g. for distinct header names.
+static string RepeatNumbered(const string & head, const char *unit, const string & tail, size_t n)
+{
+    string ret(head);
+    char buf[64];
+    for (unsigned i = 0; ret.length() + tail.length() < n; ++i) {
+        snprintf(buf, sizeof(buf), unit, i);
+        ret.append(buf);
+    }
+    return ret.append(tail);
+}
+
+static string ManyHeaders(size_t n)
+{
+    return Repeat("GET / HTTP/1.1\r\nHost: x\r\n", "X-Header: value\r\n", "\r\n", n);
+}
+
+static string HeaderContinuation(size_t n)
+{
+    return Repeat("GET / HTTP/1.1\r\nHost: x\r\nX-Folded: a\r\n", " b\r\n", "\r\n", n);
+}
+
+static string RepeatedHeader(size_t n)
+{
+    return Repeat("GET / HTTP/1.1\r\nHost: x\r\n", "Accept: text/plain\r\n", "\r\n", n);
+}
+
+static string DistinctHeaders(size_t n)
+{
+    return RepeatNumbered("GET / HTTP/1.1\r\nHost: x\r\n", "h%06u: v\r\n", "\r\n", n);
+}
+
+static string DistinctCookies(size_t n)
+{
+    return RepeatNumbered("GET / HTTP/1.1\r\nHost: x\r\nCookie: a=b", "; c%06u=d", "\r\n\r\n", n);
+}
+
+static string ManyCookies(size_t n)
+{
+    return Repeat("GET / HTTP/1.1\r\nHost: x\r\nCookie: a=b", "; c=d", "\r\n\r\n", n);
+}
+
+static string LongQuery(size_t n)
+{
+    return Repeat("GET /?a=%41", "&a=%42+x", " HTTP/1.1\r\nHost: x\r\n\r\n", n);
+}
+
+static string WithBody(const string & headers, const string & body)
+{
+    ostringstream oss;
+    oss << headers << "Content-Length: " << body.length() << "\r\n\r\n" << body;
+    return oss.str();
+}
+
+static string UrlEncodedBody(size_t n)
+{
+    return WithBody("POST / HTTP/1.1\r\nHost: x\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\n",
+            Repeat("", "k%41=v+1&", "", n));
+}
+
+static string DistinctFormKeys(size_t n)
+{
+    return WithBody("POST / HTTP/1.1\r\nHost: x\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\n",
+            RepeatNumbered("", "k%06u=v&", "", n));
+}
+
+static string OneByteChunks(size_t n)
+{
+    return Repeat("POST / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n",
+            "1\r\nx\r\n", "0\r\n\r\n", n);
+}
+
+static string ChunkExtensions(size_t n)
+{
+    return Repeat("POST / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n",
+            "1;a=b;c=\"d\"\r\nx\r\n", "0\r\n\r\n", n);
+}
+
+static const char *s_sMultipartHeaders =
+    "POST / HTTP/1.1\r\nHost: x\r\n"
+    "Content-Type: multipart/form-data; boundary=XyZzYxXyZzYx\r\n";
+
+static string ManyParts(size_t n)
+{
+    return WithBody(s_sMultipartHeaders,
+            Repeat("", "--XyZzYxXyZzYx\r\nContent-Disposition: form-data; name=\"f\"\r\n\r\nvalue\r\n",
+                "--XyZzYxXyZzYx--\r\n", n));
+}
+
+static string NearMissDelimiters(size_t n)
+{
+    return WithBody(s_sMultipartHeaders,
+            Repeat("--XyZzYxXyZzYx\r\nContent-Disposition: form-data; name=\"f\"\r\n\r\n",
+                "\r\n--XyZzYxXyZzY", "\r\n--XyZzYxXyZzYx--\r\n", n));
+}
+
+static string Pipelined(size_t n)
+{
+    return Repeat("", "GET /a?b=c HTTP/1.1\r\nHost: x\r\nCookie: d=e\r\n\r\n", "", n);
+}
+
+static const struct {
+    const char *name;
+    Generator generate;
+} s_aGenerators[] = {
+    { "many headers", ManyHeaders },
+    { "distinct headers", DistinctHeaders },
+    { "header continuation", HeaderContinuation },
+    { "repeated header", RepeatedHeader },
+    { "many cookies", ManyCookies },
+    { "distinct cookies", DistinctCookies },
+    { "long query", LongQuery },
+    { "urlencoded body", UrlEncodedBody },
+    { "distinct form keys", DistinctFormKeys },
+    { "one-byte chunks", OneByteChunks },
+    { "chunk extensions", ChunkExtensions },
+    { "many parts", ManyParts },
+    { "near-miss delimiters", NearMissDelimiters },
+    { "pipelined", Pipelined },
+};
+
+static const size_t NUM_GENERATORS = sizeof(s_aGenerators) / sizeof(s_aGenerators[0]);
+
+/// input sizes for the complexity check
+static const size_t SMALL_SIZE = 128 * 1024;
+static const size_t LARGE_SIZE = 8 * SMALL_SIZE;
+
+/// largest acceptable growth of the parse time from SMALL_SIZE to LARGE_SIZE (linear: 8)
+static const double MAX_GROWTH = 24.0;
+
+/// parse time of the large input (seconds), below which timing noise dominates the growth
+static const double MIN_MEASURABLE = 0.002;
+
+/// Parses an input, the first byte determines how it is split.
+static size_t Parse(const string & input)
+{
+    LLVMFuzzerTestOneInput(reinterpret_cast<const unsigned char *>(input.data()), input.length());
+    return Driver().LastRequests();
+}
+
+/// Measures the CPU time for parsing an input (best of three).
+static double ParseTime(const string & input)
+{
+    double best = -1;
+    for (int i = 0; i < 3; ++i) {
+        clock_t start = clock();
+        Parse(input);
+        double t = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+        if ((best < 0) || (t < best)) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+/// Checks that parse times grow linearly. Returns false otherwise.
+static bool CheckComplexity()
+{
+    bool ret = true;
+    // all at once, and pieces of up to 16 bytes
+    static const unsigned char splits[] = { 255, 15 };
+    for (size_t g = 0; g < NUM_GENERATORS; ++g) {
+        for (size_t s = 0; s < sizeof(splits); ++s) {
+            string small(1, splits[s]);
+            small.append(s_aGenerators[g].generate(SMALL_SIZE));
+            string large(1, splits[s]);
+            large.append(s_aGenerators[g].generate(LARGE_SIZE));
+            double ts = ParseTime(small);
+            double tl = ParseTime(large);
+            // below the resolution of clock(), the growth is meaningless
+            double growth = (ts > 0) ? (tl / ts) : 0;
+            bool ok = (tl < MIN_MEASURABLE) || (growth <= MAX_GROWTH);
+            printf("%-22s %-6s: %8.1f MB/s, growth x%5.1f %s\n",
+                    s_aGenerators[g].name, (255 == splits[s]) ? "whole" : "split",
+                    (tl > 0) ? (large.length() / tl / 1e6) : 0.0, growth,
+                    ok ? "ok" : "SUPERLINEAR");
+            ret = ret && ok;
+        }
+    }
+    return ret;
+}
+
+static void Mutate(string & s, Random & rnd)
+{
+    static const char *tokens[] = {
+        "\r\n", ":", ";", "=", "&", "%", "+", "\"", " ", "--", "0\r\n\r\n",
+        "Transfer-Encoding: chunked\r\n", "Content-Length: 5\r\n",
+        "Expect: 100-continue\r\n", "boundary=", "ffffffffffffffff"
+    };
+    size_t count = 1 + rnd.Below(8);
+    for (size_t i = 0; i < count; ++i) {
+        size_t pos = s.empty() ? 0 : rnd.Below(s.length());
+        switch (rnd.Below(5)) {
+            case 0:
+                if (!s.empty()) {
+                    s[pos] = static_cast<char>(rnd.Next());
+                }
+                break;
+            case 1:
+                s.erase(pos, 1 + rnd.Below(16));
+                break;
+            case 2:
+                s.insert(pos, tokens[rnd.Below(sizeof(tokens) / sizeof(tokens[0]))]);
+                break;
+            case 3:
+                // duplicate a piece
+                if (!s.empty()) {
+                    size_t len = 1 + rnd.Below(std::min<size_t>(s.length() - pos, 64));
+                    s.insert(rnd.Below(s.length()), s.substr(pos, len));
+                }
+                break;
+            default:
+                s.insert(pos, 1, static_cast<char>(rnd.Next()));
+                break;
+        }
+    }
+}
+
+/// Mutates the generated inputs until the time budget is used up.
+static void Fuzz(unsigned long long seed, double seconds)
+{
+    vector<string> corpus;
+    for (size_t g = 0; g < NUM_GENERATORS; ++g) {
+        corpus.push_back(s_aGenerators[g].generate(256 + 256 * g));
+    }
+    Random rnd(seed);
+    unsigned long long execs = 0;
+    size_t requests = 0;
+    double slowest = 0;
+    time_t end = time(NULL) + static_cast<time_t>(seconds);
+    while (time(NULL) < end) {
+        for (int i = 0; i < 1000; ++i) {
+            string input(corpus[rnd.Below(corpus.size())]);
+            Mutate(input, rnd);
+            // how to split the input
+            input.insert(input.begin(), static_cast<char>(rnd.Next()));
+            clock_t start = clock();
+            size_t n = Parse(input);
+            double t = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+            if (t > slowest) {
+                slowest = t;
+            }
+            requests += n;
+            ++execs;
+            // keep inputs which still contain requests, for deeper mutations
+            if ((0 < n) && (0 == rnd.Below(64)) && (input.length() < 65536)) {
+                corpus[rnd.Below(corpus.size())].assign(input, 1, string::npos);
+            }
+        }
+    }
+    printf("%llu inputs, %lu requests parsed, slowest input took %.3f ms\n",
+            execs, static_cast<unsigned long>(requests), slowest * 1000);
+}
+
+#ifndef _WIN32
+extern "C" void SaveCrashInput(int sig)
+{
+    int fd = open("ehs_fuzz-crash.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (0 <= fd) {
+        if (write(fd, g_pCurrentInput, g_nCurrentInput) < 0) {
+            // nothing left to do
+        }
+        close(fd);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    double seconds = 10;
+    unsigned long long seed = time(NULL);
+    vector<string> files;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (0 == arg.find("-max_total_time=")) {
+            seconds = atof(arg.c_str() + 16);
+        } else if (0 == arg.find("-seed=")) {
+            seed = strtoull(arg.c_str() + 6, NULL, 10);
+        } else if ('-' == arg[0]) {
+            cerr << "Usage: " << argv[0] << " [-max_total_time=<seconds>] [-seed=<n>] [file ...]" << endl;
+            return 2;
+        } else {
+            files.push_back(arg);
+        }
+    }
+#ifndef _WIN32
+    signal(SIGSEGV, SaveCrashInput);
+    signal(SIGABRT, SaveCrashInput);
+    signal(SIGBUS, SaveCrashInput);
+#endif
+    if (!files.empty()) {
+        for (vector<string>::const_iterator f = files.begin(); f != files.end(); ++f) {
+            ifstream in(f->c_str(), ios::binary);
+            string input((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            cout << *f << ": " << Parse(input) << " requests" << endl;
+        }
+        return 0;
+    }
+    printf("Seed: %llu\n", seed);
+    time_t start = time(NULL);
+    if (!CheckComplexity()) {
+        return 1;
+    }
+    double left = seconds - difftime(time(NULL), start);
+    if (left > 0) {
+        Fuzz(seed, left);
+    }
+    return 0;
+}
+
+#endif // EHS_LIBFUZZER
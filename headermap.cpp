@@ -0,0 +1,330 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "headermap.h"
+
+#include <cstring>
+#include <ctime>
+
+/// Canonical names of the well known headers, in the order of KnownHeader
+static constexpr const char *s_aHeaderNames[HEADER_COUNT] = {
+    "Accept",
+    "Accept-Charset",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Accept-Ranges",
+    "Authorization",
+    "Cache-Control",
+    "Connection",
+    "Content-Disposition",
+    "Content-Encoding",
+    "Content-Length",
+    "Content-Range",
+    "Content-Type",
+    "Cookie",
+    "Date",
+    "ETag",
+    "Expect",
+    "Host",
+    "If-Match",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "Last-Modified",
+    "Location",
+    "Range",
+    "Referer",
+    "Server",
+    "Set-Cookie",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent",
+    "Vary",
+    "Sec-WebSocket-Key"
+};
+
+/// Number of slots in the hash table
+static constexpr unsigned HEADERHASH_SLOTS = 64;
+
+static constexpr unsigned char HashLower(char c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? static_cast<unsigned char>(c + ('a' - 'A')) : static_cast<unsigned char>(c);
+}
+
+static constexpr size_t HashLength(const char *s)
+{
+    return *s ? 1 + HashLength(s + 1) : 0;
+}
+
+/**
+ * Perfect hash over the names of the well known headers.
+ * Uses the length plus the first, middle and last character.
+ * The multipliers have been chosen such that no two well known
+ * headers collide, which is verified at compile time below.
+ */
+static constexpr unsigned HeaderHash(const char *s, size_t len)
+{
+    return (0 == len) ? 0 :
+        ((len * 19 + HashLower(s[0]) * 13 + HashLower(s[len - 1]) * 7 +
+          HashLower(s[len / 2])) & (HEADERHASH_SLOTS - 1));
+}
+
+static constexpr unsigned NameHash(int i)
+{
+    return HeaderHash(s_aHeaderNames[i], HashLength(s_aHeaderNames[i]));
+}
+
+static constexpr bool HashDiffersFrom(int i, int j)
+{
+    return (j >= HEADER_COUNT) ? true : ((NameHash(i) != NameHash(j)) && HashDiffersFrom(i, j + 1));
+}
+
+static constexpr bool HashIsPerfect(int i)
+{
+    return (i >= HEADER_COUNT) ? true : (HashDiffersFrom(i, i + 1) && HashIsPerfect(i + 1));
+}
+
+static_assert(HashIsPerfect(0), "HeaderHash has collisions between well known headers");
+
+/// Maps hash slots to well known headers
+class HeaderSlotTable {
+    public:
+        HeaderSlotTable() : m_aSlots()
+        {
+            for (unsigned i = 0; i < HEADERHASH_SLOTS; ++i) {
+                m_aSlots[i] = HEADER_UNKNOWN;
+            }
+            for (int i = 0; i < HEADER_COUNT; ++i) {
+                m_aSlots[NameHash(i)] = static_cast<KnownHeader>(i);
+            }
+        }
+
+        KnownHeader m_aSlots[HEADERHASH_SLOTS];
+};
+
+static bool EqualsNoCase(const char *a, const char *b, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (HashLower(a[i]) != HashLower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Number of entries, up to which other headers are found by a linear search
+static const size_t HEADERINDEX_THRESHOLD = 16;
+
+/**
+ * Case insensitive FNV-1a hash of a header name. The seed differs
+ * between processes, so clients can't choose colliding names.
+ */
+static size_t NoCaseHash(const std::string & name)
+{
+    static const size_t seed = static_cast<size_t>(time(NULL)) ^
+        reinterpret_cast<size_t>(&HEADERINDEX_THRESHOLD);
+    size_t h = seed ^ 2166136261U;
+    for (size_t i = 0; i < name.length(); ++i) {
+        h = (h ^ HashLower(name[i])) * 16777619U;
+    }
+    return h ^ (h >> 15);
+}
+
+KnownHeader HeaderMap::Lookup(const char *name, size_t len)
+{
+    static const HeaderSlotTable table;
+    KnownHeader h = table.m_aSlots[HeaderHash(name, len)];
+    if ((HEADER_UNKNOWN != h) && (strlen(s_aHeaderNames[h]) == len) &&
+            EqualsNoCase(name, s_aHeaderNames[h], len)) {
+        return h;
+    }
+    return HEADER_UNKNOWN;
+}
+
+const char *HeaderMap::Name(KnownHeader header)
+{
+    return (header < HEADER_COUNT) ? s_aHeaderNames[header] : "";
+}
+
+HeaderMap::HeaderMap() :
+    m_oFields(),
+    m_oIndex(),
+    m_aKnown()
+{
+}
+
+void HeaderMap::clear()
+{
+    m_oFields.clear();
+    m_oIndex.clear();
+    memset(m_aKnown, 0, sizeof(m_aKnown));
+}
+
+HeaderMap::size_type HeaderMap::FindOther(const std::string & name) const
+{
+    if (m_oFields.size() <= HEADERINDEX_THRESHOLD) {
+        for (size_type i = 0; i < m_oFields.size(); ++i) {
+            const std::string & n = m_oFields[i].first;
+            if ((n.length() == name.length()) && EqualsNoCase(n.data(), name.data(), n.length())) {
+                return i;
+            }
+        }
+        return m_oFields.size();
+    }
+    if (m_oIndex.empty()) {
+        BuildIndex();
+    }
+    size_t mask = m_oIndex.size() - 1;
+    for (size_t slot = NoCaseHash(name) & mask; 0 != m_oIndex[slot]; slot = (slot + 1) & mask) {
+        const std::string & n = m_oFields[m_oIndex[slot] - 1].first;
+        if ((n.length() == name.length()) && EqualsNoCase(n.data(), name.data(), n.length())) {
+            return m_oIndex[slot] - 1;
+        }
+    }
+    return m_oFields.size();
+}
+
+void HeaderMap::IndexField(size_type pos) const
+{
+    size_t mask = m_oIndex.size() - 1;
+    size_t slot = NoCaseHash(m_oFields[pos].first) & mask;
+    while (0 != m_oIndex[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    m_oIndex[slot] = static_cast<unsigned int>(pos + 1);
+}
+
+void HeaderMap::BuildIndex() const
+{
+    // keep the load factor at or below 1/2
+    size_t slots = 64;
+    while (slots < 2 * m_oFields.size()) {
+        slots <<= 1;
+    }
+    m_oIndex.assign(slots, 0);
+    for (size_type i = 0; i < m_oFields.size(); ++i) {
+        IndexField(i);
+    }
+}
+
+HeaderMap::iterator HeaderMap::find(KnownHeader header)
+{
+    if ((header >= HEADER_COUNT) || (0 == m_aKnown[header])) {
+        return m_oFields.end();
+    }
+    return m_oFields.begin() + (m_aKnown[header] - 1);
+}
+
+HeaderMap::const_iterator HeaderMap::find(KnownHeader header) const
+{
+    if ((header >= HEADER_COUNT) || (0 == m_aKnown[header])) {
+        return m_oFields.end();
+    }
+    return m_oFields.begin() + (m_aKnown[header] - 1);
+}
+
+HeaderMap::iterator HeaderMap::find(const std::string & name)
+{
+    KnownHeader h = Lookup(name.data(), name.length());
+    if (HEADER_UNKNOWN != h) {
+        return find(h);
+    }
+    return m_oFields.begin() + FindOther(name);
+}
+
+HeaderMap::const_iterator HeaderMap::find(const std::string & name) const
+{
+    KnownHeader h = Lookup(name.data(), name.length());
+    if (HEADER_UNKNOWN != h) {
+        return find(h);
+    }
+    return m_oFields.begin() + FindOther(name);
+}
+
+HeaderMap::iterator HeaderMap::Append(const std::string & name,
+        const std::string & value, KnownHeader known)
+{
+    m_oFields.push_back(value_type(name, value));
+    if (!m_oIndex.empty()) {
+        if (2 * m_oFields.size() > m_oIndex.size()) {
+            BuildIndex();
+        } else {
+            IndexField(m_oFields.size() - 1);
+        }
+    }
+    if (HEADER_UNKNOWN != known) {
+        m_aKnown[known] = static_cast<unsigned int>(m_oFields.size());
+    }
+    return m_oFields.end() - 1;
+}
+
+std::string & HeaderMap::operator[](const std::string & name)
+{
+    KnownHeader h = Lookup(name.data(), name.length());
+    iterator i = (HEADER_UNKNOWN == h) ? (m_oFields.begin() + FindOther(name)) : find(h);
+    if (m_oFields.end() == i) {
+        i = Append(name, std::string(), h);
+    }
+    return i->second;
+}
+
+std::pair<HeaderMap::iterator, bool> HeaderMap::insert(const value_type & value)
+{
+    KnownHeader h = Lookup(value.first.data(), value.first.length());
+    iterator i = (HEADER_UNKNOWN == h) ? (m_oFields.begin() + FindOther(value.first)) : find(h);
+    if (m_oFields.end() != i) {
+        return std::make_pair(i, false);
+    }
+    return std::make_pair(Append(value.first, value.second, h), true);
+}
+
+void HeaderMap::erase(iterator pos)
+{
+    unsigned int idx = static_cast<unsigned int>(pos - m_oFields.begin()) + 1;
+    m_oFields.erase(pos);
+    // positions have changed, the index is rebuilt when needed
+    m_oIndex.clear();
+    for (int i = 0; i < HEADER_COUNT; ++i) {
+        if (m_aKnown[i] == idx) {
+            m_aKnown[i] = 0;
+        } else if (m_aKnown[i] > idx) {
+            --m_aKnown[i];
+        }
+    }
+}
+
+HeaderMap::size_type HeaderMap::erase(const std::string & name)
+{
+    iterator i = find(name);
+    if (m_oFields.end() == i) {
+        return 0;
+    }
+    erase(i);
+    return 1;
+}
@@ -29,6 +29,10 @@
 
 #include "ehs.h"
 #include "ehsconnection.h"
+#include "bytescan.h"
+#include "inputbuffer.h"
+#include "multipartparser.h"
+#include "bodydecoder.h"
 #include "debug.h"
 
 #include <string>
@@ -38,18 +42,37 @@
 #include <cstdio>
 #include <stdexcept>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
 #include <boost/algorithm/string.hpp>
-#include <boost/algorithm/string/regex.hpp>
-#include <boost/lexical_cast.hpp>
+#include <boost/regex.hpp>
 #include <boost/assign.hpp>
 
 using namespace std;
 
 bool MultivalHeaderContains(const std::string &header, const std::string &value)
 {
-    std::set<std::string> tokens;
-    boost::split_regex(tokens, boost::to_lower_copy(header), boost::regex(",\\s*"));
-    return (tokens.find(boost::to_lower_copy(value)) != tokens.end());
+    std::string::size_type start = 0;
+    while (start < header.length()) {
+        std::string::size_type end = header.find(',', start);
+        if (std::string::npos == end) {
+            end = header.length();
+        }
+        std::string::size_type tend = end;
+        while ((start < tend) && isspace(static_cast<unsigned char>(header[start]))) {
+            ++start;
+        }
+        while ((tend > start) && isspace(static_cast<unsigned char>(header[tend - 1]))) {
+            --tend;
+        }
+        if (boost::iequals(boost::make_iterator_range(header.begin() + start,
+                        header.begin() + tend), value)) {
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
 }
 
 bool IsMultivalHeader(const std::string &header)
@@ -78,7 +101,7 @@ bool IsMultivalHeader(const std::string &header)
     return ret;
 }
 
-void HttpRequest::GetFormDataFromString(const string & irsString)
+void HttpRequest::GetFormDataFromString(const string & irsString, bool overwrite)
 {
     boost::regex re("[?]?([^?=]*)=([^&]*)&?");
 
@@ -92,142 +115,36 @@ void HttpRequest::GetFormDataFromString(const string & irsString)
         string value(res[2].first,res[2].second); 
         start = res[0].second; 
         EHS_TRACE("Info: Got form data: '%s' => '%s'", name.c_str(), value.c_str());
-        ContentDisposition oContentDisposition;
-        m_oFormValueMap[name] = FormValue(value, oContentDisposition);
+        if (overwrite || (m_oFormValueMap.end() == m_oFormValueMap.find(name))) {
+            ContentDisposition oContentDisposition;
+            m_oFormValueMap[name] = FormValue(value, oContentDisposition);
+        }
         // update flags: 
         flags |= boost::match_prev_avail; 
         flags |= boost::match_not_bob;
     }
 }
 
-// this parses a single piece of a multipart form body
-// here are two examples -- first is an uploaded file, second is a
-//   standard text box html form
-/*
-   -----------------------------7d2248207500d4
-   Content-Disposition: form-data; name="DFWFilename2"; filename="C:\Documents and Settings\administrator\Desktop\contacts.dat"
-   Content-Type: application/octet-stream
-
-   Default Screen Name
-   -----------------------------7d2248207500d4
-
-
-   -----------------------------7d2248207500d4
-   Content-Disposition: form-data; name="foo"
-
-   asdfasdf
-   -----------------------------7d2248207500d4
-   */
-
-
-HttpRequest::ParseSubbodyResult HttpRequest::ParseSubbody(string isSubbody)
-{
-    // find the spot after the headers in the body
-    string::size_type nBlankLinePosition = isSubbody.find("\r\n\r\n");
-    // if there's no double blank line, then this isn't a valid subbody
-    if (nBlankLinePosition == string::npos) {
-        EHS_TRACE("Invalid subbody, couldn't find double blank line", "");
-        return PARSESUBBODY_INVALIDSUBBODY;
-    }
-    // create a string from the beginning to the blank line
-    string sHeaders(isSubbody, 0, nBlankLinePosition);
-    // First line MUST be the content-disposition header line, so that
-    // we know what the name of the field is.. otherwise, we're in trouble
-    boost::smatch match;
-    boost::regex re("Content-Disposition:[ ]?([^;]+);[ ]?(.*)");
-    if (boost::regex_match(sHeaders, match, re)) {
-        string sContentDisposition(match[1]);
-        string sPairs(match[2]);
-        StringCaseMap oStringCaseMap;
-        boost::regex nvre("[ ]?([^= ]+)=\"([^\"]+)\"[;]?");
-        boost::sregex_iterator i(sPairs.begin(), sPairs.end(), nvre);
-        boost::sregex_iterator end;
-        while (i != end) {
-            string sName((*i)[1]);
-            string sValue((*i)[2]);
-            EHS_TRACE("Subbody header found: '%s' => '%s'", sName.c_str(), sValue.c_str());
-            oStringCaseMap[sName] = sValue;
-            ++i;
-        }
-
-        // Take oStringCaseMap and actually fill the right object with its data
-        FormValue & roFormValue = m_oFormValueMap[oStringCaseMap["name"]];
-        // Copy the headers in now that we know the name
-        roFormValue.m_oContentDisposition.m_oContentDispositionHeaders = oStringCaseMap;
-        // Grab out the body
-        roFormValue.m_sBody = isSubbody.substr(nBlankLinePosition + 4);
-    } else {
-        // couldn't find content-disposition line -- FATAL ERROR
-        EHS_TRACE("ERROR: Couldn't find content-disposition line sHeaders='%s'", sHeaders.c_str());
-        return PARSESUBBODY_INVALIDSUBBODY;
-    }
-    return PARSESUBBODY_SUCCESS;
-}
-
 HttpRequest::ParseMultipartFormDataResult HttpRequest::ParseMultipartFormData ( )
 {
-    if (m_oRequestHeaders["Content-Type"].empty()) {
-        return PARSEMULTIPARTFORMDATA_FAILED;
+    // The body has been parsed while it was received.
+    if (PARSEMULTIPARTFORMDATA_INVALID != m_nMultipartResult) {
+        return m_nMultipartResult;
     }
-
-#ifdef EHS_DEBUG
-    cerr << "looking for boundary in '" << m_oRequestHeaders["Content-Type"] << "'" << endl;
-#endif
-    // find the boundary string
-    boost::regex re("multipart/[^;]+;[ ]*boundary=([^\"]+)$");
-    boost::smatch match;
-    if (boost::regex_match(m_oRequestHeaders["Content-Type"], match, re)) {
-        // the actual boundary has two dashes prepended to it
-        string sBoundary("--");
-        sBoundary.append(match[1]);
-        string::size_type blen = sBoundary.length();
-
-#ifdef EHS_DEBUG
-        cerr
-            << "[EHS_DEBUG] Info: Found boundary of '" << sBoundary << "'" << endl
-            << "[EHS_DEBUG] Info: Looking for boundary to match (" << dec << m_sBody.length()
-            << ") '" << m_sBody.substr(0, blen) << "'" << endl;
-#endif
-
-        // check to make sure we started at the boundary
-        if (m_sBody.substr(0, blen) != sBoundary) {
+    string sBoundary;
+    if (!MultipartParser::GetBoundary(m_oRequestHeaders["Content-Type"], sBoundary)) {
 #ifdef EHS_DEBUG
-            cerr << "[EHS_DEBUG] Error: Misparsed multi-part form data for unknown reason - first bytes weren't the boundary string" << endl;
-#endif
-            return PARSEMULTIPARTFORMDATA_FAILED;
-        }
-
-        // go past the initial boundary and it's terminating CRLF
-        string sRemainingBody = m_sBody.substr(blen + 2);
-
-        // while we're at a boundary after we grab a part, keep going
-        string::size_type nNextPartPosition;
-        // From here on, we need CRLF prepended to the boundary string
-        sBoundary.insert(0, "\r\n");
-        while ((nNextPartPosition = sRemainingBody.find(sBoundary)) != string::npos) {
-#ifdef EHS_DEBUG
-            cerr << "[EHS_DEBUG] Info: Found subbody from pos 0 to " << dec << nNextPartPosition << endl;
-#endif
-            if (sRemainingBody.length() < (blen + nNextPartPosition)) {
-#ifdef EHS_DEBUG
-                cerr << dec << "[EHS_DEBUG] Error: Remaining length (" << sRemainingBody.length()
-                    << ") < calculated length (" << blen + nNextPartPosition
-                    << ")" << endl;
+        cerr << "[EHS_DEBUG] Error: Couldn't find boundary specification in content-type header" << endl;
 #endif
-                return PARSEMULTIPARTFORMDATA_FAILED;
-            }
-            ParseSubbody(sRemainingBody.substr(0, nNextPartPosition));
-            // skip past the boundary at the end and look for the next one
-            nNextPartPosition += blen;
-            sRemainingBody = sRemainingBody.substr(nNextPartPosition);
-        }
-    } else {
+        return PARSEMULTIPARTFORMDATA_FAILED;
+    }
+    MultipartParser oParser(sBoundary, m_oFormValueMap, m_nMultipartSpillSize);
+    if (!(oParser.Feed(m_sBody.data(), m_sBody.length()) && oParser.Finish())) {
 #ifdef EHS_DEBUG
-        cerr << "[EHS_DEBUG] Error: Couldn't find boundary specification in content-type header" << endl;
+        cerr << "[EHS_DEBUG] Error: Malformed multi-part form data" << endl;
 #endif
         return PARSEMULTIPARTFORMDATA_FAILED;
     }
-
     return PARSEMULTIPARTFORMDATA_SUCCESS;
 }
 
@@ -257,348 +174,1036 @@ int HttpRequest::ParseCookieData(string & irsData)
     return ccount;
 }
 
-// takes data and tries to figure out what it is.  it will loop through
-//   irsData as many times as it can as long as it gets a full line each time.
-//   Depending on how much data it's gotten already, it will handle a line
-//   differently..
-HttpRequest::HttpParseStates HttpRequest::ParseData ( string & irsData ///< buffer to look in for more data
-        )
+/// Character classes used by the request scanner
+enum {
+    CHARCLASS_UPPER = 0x01, ///< A-Z, allowed in request methods
+    CHARCLASS_DIGIT = 0x02, ///< 0-9
+    CHARCLASS_HEX = 0x04,   ///< 0-9, a-f, A-F
+    CHARCLASS_WS = 0x08,    ///< linear white space (SP, HT)
+    CHARCLASS_NAME = 0x10,  ///< allowed in header names
+    CHARCLASS_TOKEN = 0x20  ///< allowed in tokens (RFC 7230, Section 3.2.6)
+};
+
+/// Lookup table mapping each byte to its character classes
+class CharClassTable {
+    public:
+        CharClassTable() : m_aClasses()
+        {
+            for (int c = 0; c < 256; ++c) {
+                unsigned char cls = 0;
+                if ((c >= 'A') && (c <= 'Z')) {
+                    cls |= CHARCLASS_UPPER;
+                }
+                if ((c >= '0') && (c <= '9')) {
+                    cls |= CHARCLASS_DIGIT | CHARCLASS_HEX;
+                }
+                if (((c >= 'a') && (c <= 'f')) || ((c >= 'A') && (c <= 'F'))) {
+                    cls |= CHARCLASS_HEX;
+                }
+                if ((' ' == c) || ('\t' == c)) {
+                    cls |= CHARCLASS_WS;
+                }
+                if ((c > ' ') && (0x7f != c) && (':' != c)) {
+                    cls |= CHARCLASS_NAME;
+                }
+                if ((c > ' ') && (c < 0x7f) && (NULL == strchr("\"(),/:;<=>?@[\\]{}", c))) {
+                    cls |= CHARCLASS_TOKEN;
+                }
+                m_aClasses[c] = cls;
+            }
+        }
+
+        unsigned char m_aClasses[256];
+};
+
+/// Maximum length of a chunk size line or a trailer field
+static const size_t MAX_CHUNK_LINE = 4096;
+
+/// Maximum number of trailer fields
+static const size_t MAX_TRAILERS = 64;
+
+static const unsigned char *CharClasses()
 {
-    string sLine;
-    string sName;
-    string sValue;
-    boost::regex reHeader("^([^:\\s]+):\\s+(.*)\\r\\n$");
-    boost::regex reHeaderCont("^\\s+(.*)\\r\\n$");
-    boost::smatch match;
-    bool bDone = false;
+    static CharClassTable table;
+    return table.m_aClasses;
+}
 
-    EHS_TRACE("called", "");
-    while ( ! bDone &&
-            m_nCurrentHttpParseState != HTTPPARSESTATE_INVALIDREQUEST &&
-            m_nCurrentHttpParseState != HTTPPARSESTATE_COMPLETEREQUEST &&
-            m_nCurrentHttpParseState != HTTPPARSESTATE_INVALID ) {
+static inline size_t HexValue(unsigned char c)
+{
+    if (c <= '9') {
+        return c - '0';
+    }
+    return (c | 0x20) - 'a' + 10;
+}
 
-        EHS_TRACE("parsestate=%d", m_nCurrentHttpParseState);
-        switch ( m_nCurrentHttpParseState ) {
+/**
+ * Validates the chunk extensions of a chunk size line.
+ * chunk-ext = *( BWS ";" BWS chunk-ext-name [ BWS "=" BWS chunk-ext-val ] )
+ * @param p The start of the extensions, right after the chunk size.
+ * @param end The end of the extensions (the CR of the line).
+ * @return true, if the extensions are well formed.
+ */
+static bool ValidChunkExtensions(const char *p, const char *end)
+{
+    const unsigned char *cc = CharClasses();
+    while (true) {
+        while ((p < end) && (cc[static_cast<unsigned char>(*p)] & CHARCLASS_WS)) {
+            ++p;
+        }
+        if (p == end) {
+            return true;
+        }
+        if (';' != *p++) {
+            return false;
+        }
+        while ((p < end) && (cc[static_cast<unsigned char>(*p)] & CHARCLASS_WS)) {
+            ++p;
+        }
+        // chunk-ext-name
+        const char *name = p;
+        while ((p < end) && (cc[static_cast<unsigned char>(*p)] & CHARCLASS_TOKEN)) {
+            ++p;
+        }
+        if (p == name) {
+            return false;
+        }
+        while ((p < end) && (cc[static_cast<unsigned char>(*p)] & CHARCLASS_WS)) {
+            ++p;
+        }
+        if ((p == end) || ('=' != *p)) {
+            continue;
+        }
+        ++p;
+        while ((p < end) && (cc[static_cast<unsigned char>(*p)] & CHARCLASS_WS)) {
+            ++p;
+        }
+        // chunk-ext-val = token / quoted-string
+        if ((p < end) && ('"' == *p)) {
+            for (++p; (p < end) && ('"' != *p); ++p) {
+                if (('\\' == *p) && (++p == end)) {
+                    return false;
+                }
+            }
+            if (p == end) {
+                return false;
+            }
+            ++p;
+        } else {
+            const char *val = p;
+            while ((p < end) && (cc[static_cast<unsigned char>(*p)] & CHARCLASS_TOKEN)) {
+                ++p;
+            }
+            if (p == val) {
+                return false;
+            }
+        }
+    }
+}
 
-            case HTTPPARSESTATE_REQUEST:
+/// Describes a token to look for in a well known header
+struct HeaderTokenDef {
+    KnownHeader header;
+    const char *token;
+    HeaderToken flag;
+};
+
+static const HeaderTokenDef s_aHeaderTokens[] = {
+    { HEADER_CONNECTION, "close", HEADERTOKEN_CONNECTION_CLOSE },
+    { HEADER_CONNECTION, "keep-alive", HEADERTOKEN_CONNECTION_KEEPALIVE },
+    { HEADER_CONNECTION, "upgrade", HEADERTOKEN_CONNECTION_UPGRADE },
+    { HEADER_UPGRADE, "websocket", HEADERTOKEN_UPGRADE_WEBSOCKET },
+    { HEADER_TRANSFER_ENCODING, "chunked", HEADERTOKEN_TRANSFERENCODING_CHUNKED }
+};
+
+bool HttpRequest::ProcessHeaders(const char *data)
+{
+    string sLastName;
+    for (vector<HeaderField>::const_iterator i = m_oHeaderFields.begin();
+            i != m_oHeaderFields.end(); ++i) {
+        string sValue(data + i->value, i->valuelen);
+        if (0 == i->namelen) {
+            // Header continuation using leading space
+            EHS_TRACE("header continuation '%s'", sValue.c_str());
+            m_oRequestHeaders[sLastName].append(" ").append(sValue);
+            continue;
+        }
+        string sName(data + i->name, i->namelen);
+        EHS_TRACE("header '%s' => '%s'", sName.c_str(), sValue.c_str());
+        StringCaseMap::iterator h = m_oRequestHeaders.find(sName);
+        if (m_oRequestHeaders.end() == h) {
+            m_oRequestHeaders[sName] = sValue;
+        } else {
+            // Multiple header of same name (RFC2616, Section 4.2)
+            // Check, if specific header is allowed (defined as comma-sparated
+            // multi-value header.
+            if (!IsMultivalHeader(sName)) {
+                EHS_TRACE("Multi-Value for %s not allowed", sName.c_str());
+                return false;
+            }
+            h->second.append(", ").append(sValue);
+        }
+        sLastName.swap(sName);
+    }
+    m_oHeaderFields.clear();
 
-                // get the request line
-                sLine = GetNextLine(irsData);
+    for (size_t i = 0; i < (sizeof(s_aHeaderTokens) / sizeof(s_aHeaderTokens[0])); ++i) {
+        StringCaseMap::const_iterator h = m_oRequestHeaders.find(s_aHeaderTokens[i].header);
+        if ((m_oRequestHeaders.end() != h) && MultivalHeaderContains(h->second, s_aHeaderTokens[i].token)) {
+            m_nHeaderTokens |= s_aHeaderTokens[i].flag;
+        }
+    }
 
-                // if we got a line, parse out the data..
-                if (sLine.empty() || sLine == "\r\n") {
-                    bDone = true;
-                } else {
-                    // if we got a line, look for a request line
+    // Check for WebSocket header and skip parsing body if found.
+    if (HasHeaderToken(HEADERTOKEN_CONNECTION_UPGRADE) && HasHeaderToken(HEADERTOKEN_UPGRADE_WEBSOCKET)) {
+        m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
+        m_nScanState = HTTPSCAN_DONE;
+    } else {
+        m_bChunked = HasHeaderToken(HEADERTOKEN_TRANSFERENCODING_CHUNKED);
+        StringCaseMap::const_iterator cl = m_oRequestHeaders.find(HEADER_CONTENT_LENGTH);
+        if (m_bChunked) {
+            m_nChunkLen = 0;
+            m_nScanCount = 0;
+            m_nCurrentHttpParseState = HTTPPARSESTATE_BODY;
+            m_nScanState = HTTPSCAN_CHUNKSIZE;
+        } else if (m_oRequestHeaders.end() != cl) {
+            // get the content length
+            const string & sLength = cl->second;
+            if (sLength.empty()) {
+                return false;
+            }
+            m_nContentLength = 0;
+            for (string::const_iterator c = sLength.begin(); c != sLength.end(); ++c) {
+                if ((!isdigit(static_cast<unsigned char>(*c))) ||
+                        (m_nContentLength > ((static_cast<size_t>(-1) - 9) / 10))) {
+                    return false;
+                }
+                m_nContentLength = m_nContentLength * 10 + (*c - '0');
+            }
+            if (0 == m_nContentLength) {
+                m_bBodyParsed = false;
+                m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
+                m_nScanState = HTTPSCAN_DONE;
+            } else {
+                m_nCurrentHttpParseState = HTTPPARSESTATE_BODY;
+                m_nScanState = HTTPSCAN_BODY;
+            }
+        } else {
+            m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
+            m_nScanState = HTTPSCAN_DONE;
+        }
+    }
 
+    // if this is an HTTP/1.1 request, then it MUST have a Host: header
+    if (m_sHttpVersionNumber == "1.1" &&
+            m_oRequestHeaders.find(HEADER_HOST) == m_oRequestHeaders.end()) {
+        EHS_TRACE("Missing Host header in HTTP/1.1 request", "");
+        return false;
+    }
+    return true;
+}
+
+bool HttpRequest::AddTrailer(const char *line, const char *end)
+{
+    const unsigned char *cc = CharClasses();
+    const char *colon = line;
+    while ((colon < end) && (cc[static_cast<unsigned char>(*colon)] & CHARCLASS_TOKEN)) {
+        ++colon;
+    }
+    // no white space before the colon, no obsolete line folding
+    if ((colon == line) || (colon == end) || (':' != *colon) ||
+            (MAX_TRAILERS <= m_oTrailers.size())) {
+        return false;
+    }
+    const char *value = colon + 1;
+    while ((value < end) && (cc[static_cast<unsigned char>(*value)] & CHARCLASS_WS)) {
+        ++value;
+    }
+    while ((value < end) && (cc[static_cast<unsigned char>(end[-1])] & CHARCLASS_WS)) {
+        --end;
+    }
+    string sName(line, colon);
+    StringCaseMap::iterator i = m_oTrailers.find(sName);
+    if (m_oTrailers.end() == i) {
+        m_oTrailers.insert(make_pair(sName, string(value, end)));
+    } else {
+        i->second.append(", ").append(value, end);
+    }
+    return true;
+}
+
+// Scans the data received so far, one byte at a time. The scanner's
+//   position is kept in m_nScanState and m_nParseOffset, so when more data
+//   arrives, parsing continues exactly where it stopped. Request line and
+//   header lines are located by offset only and are not copied until the
+//   whole header block has been received.
+HttpRequest::HttpParseStates HttpRequest::ParseData ( InputBuffer & ioBuffer ///< buffer to look in for more data
+        )
+{
+    if ((HTTPPARSESTATE_COMPLETEREQUEST == m_nCurrentHttpParseState) ||
+            (HTTPPARSESTATE_INVALIDREQUEST == m_nCurrentHttpParseState)) {
+        return m_nCurrentHttpParseState;
+    }
+
+    const unsigned char *cc = CharClasses();
+    const char *data = ioBuffer.Data();
+    size_t len = ioBuffer.Length();
+    size_t pos = m_nParseOffset;
+    bool bInvalid = false;
+    bool bDone = false;
+
+    EHS_TRACE("called, scanstate=%d offset=%lu", m_nScanState, pos);
+    while (!bDone && !bInvalid && (pos < len) && (HTTPSCAN_DONE != m_nScanState)) {
+        unsigned char c = data[pos];
+        switch (m_nScanState) {
+
+            case HTTPSCAN_REQUESTSTART:
+                // RFC 7230, Section 3.5: ignore empty lines preceding the request line
+                if ('\r' == c) {
+                    m_nScanState = HTTPSCAN_EMPTYLINELF;
+                } else if (cc[c] & CHARCLASS_UPPER) {
                     // everything must be uppercase according to RFC 2616
-                    boost::regex re("^([A-Z]{3,8}) ([^ ]+) HTTP/(\\d+\\.\\d+)\\r\\n$");
-                    boost::smatch match;
-                    if (boost::regex_match(sLine, match, re, boost::match_single_line)) {
-                        string mreq(match[1]);
-                        string muri(match[2]);
-                        string mver(match[3]);
-                        // get the info from the request line
-                        m_nRequestMethod = GetRequestMethodFromString(mreq);
-                        if (REQUESTMETHOD_UNKNOWN == m_nRequestMethod) {
-                            // Unsupported/Unknown request
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                        } else {
-                            m_sUri = muri;
-                            m_sOriginalUri = muri;
-                            m_sHttpVersionNumber = mver;
-                            // Check to see if the uri appeared to have form data in it
-                            GetFormDataFromString(m_sUri);
-                            // Continue parsing the headers
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_HEADERS;
-                            m_bChunked = false;
-                        }
-                    } else {
-                        // the regex failed
-                        m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                    } // end match on request line
-                } // end whether we got a line
+                    m_nTokenStart = pos;
+                    m_nScanState = HTTPSCAN_METHOD;
+                } else {
+                    bInvalid = true;
+                }
+                ++pos;
+                break;
 
+            case HTTPSCAN_EMPTYLINELF:
+                bInvalid = ('\n' != c);
+                m_nScanState = HTTPSCAN_REQUESTSTART;
+                ++pos;
                 break;
 
-            case HTTPPARSESTATE_HEADERS:
+            case HTTPSCAN_METHOD:
+                while ((pos < len) && (cc[static_cast<unsigned char>(data[pos])] & CHARCLASS_UPPER)) {
+                    ++pos;
+                }
+                if (pos < len) {
+                    size_t n = pos - m_nTokenStart;
+                    if ((' ' != data[pos]) || (n < 3) || (n > 8)) {
+                        bInvalid = true;
+                        break;
+                    }
+                    m_nRequestMethod = GetRequestMethodFromString(string(data + m_nTokenStart, n));
+                    if (REQUESTMETHOD_UNKNOWN == m_nRequestMethod) {
+                        // Unsupported/Unknown request
+                        bInvalid = true;
+                        break;
+                    }
+                    m_nTokenStart = ++pos;
+                    m_nScanState = HTTPSCAN_URI;
+                }
+                break;
 
-                // get the next line
-                sLine = GetNextLine(irsData);
+            case HTTPSCAN_URI:
+                pos = ScanUri(data + pos, data + len) - data;
+                if (pos < len) {
+                    if ((' ' != data[pos]) || (pos == m_nTokenStart)) {
+                        bInvalid = true;
+                        break;
+                    }
+                    m_sUri.assign(data + m_nTokenStart, pos - m_nTokenStart);
+                    ++pos;
+                    m_nScanCount = 0;
+                    m_nScanState = HTTPSCAN_VERSIONPREFIX;
+                }
+                break;
 
-                // if we didn't get a full line of data
-                if (sLine.empty()) {
-                    bDone = true;
-                } else if (sLine == "\r\n" ) {
-                    // check to see if we're done with headers
+            case HTTPSCAN_VERSIONPREFIX:
+                if (c != "HTTP/"[m_nScanCount]) {
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                if (5 == ++m_nScanCount) {
+                    m_nTokenStart = pos;
+                    m_nScanState = HTTPSCAN_VERSIONMAJOR;
+                }
+                break;
 
-                    // Check for WebSocket header and skip parsing body if found.
-                    if (MultivalHeaderContains(Headers("connection"), "upgrade") &&
-                            MultivalHeaderContains(Headers("upgrade"), "websocket")) {
-                        m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
-                    } else {
-                        m_bChunked = MultivalHeaderContains(Headers("transfer-encoding"), "chunked");
-                        // Not a WebSocket Header, proceed normally:
-                        // if content length is found
-                        if ((m_oRequestHeaders.find("Content-Length") !=
-                                    m_oRequestHeaders.end()) || m_bChunked) {
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_BODY;
-                        } else {
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
-                        }
+            case HTTPSCAN_VERSIONMAJOR:
+                while ((pos < len) && (cc[static_cast<unsigned char>(data[pos])] & CHARCLASS_DIGIT)) {
+                    ++pos;
+                }
+                if (pos < len) {
+                    if (('.' != data[pos]) || (pos == m_nTokenStart)) {
+                        bInvalid = true;
+                        break;
                     }
+                    ++pos;
+                    m_nScanState = HTTPSCAN_VERSIONMINOR;
+                }
+                break;
 
-                    // if this is an HTTP/1.1 request, then it MUST have a Host: header
-                    if (m_sHttpVersionNumber == "1.1" &&
-                            m_oRequestHeaders.find("Host") == m_oRequestHeaders.end()) {
-                        EHS_TRACE("Missing Host header in HTTP/1.1 request", "");
-                        m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                    }
-                    if (m_oRequestHeaders.find("Cookie") != m_oRequestHeaders.end()) {
-                        ParseCookieData(m_oRequestHeaders["Cookie"]);
+            case HTTPSCAN_VERSIONMINOR:
+                while ((pos < len) && (cc[static_cast<unsigned char>(data[pos])] & CHARCLASS_DIGIT)) {
+                    ++pos;
+                }
+                if (pos < len) {
+                    if (('\r' != data[pos]) || ('.' == data[pos - 1])) {
+                        bInvalid = true;
+                        break;
                     }
+                    m_sHttpVersionNumber.assign(data + m_nTokenStart, pos - m_nTokenStart);
+                    ++pos;
+                    m_nScanState = HTTPSCAN_REQUESTLINELF;
+                }
+                break;
 
-                } else if (boost::regex_match(sLine, match, reHeader)) {
-                    sName.assign(match[1]);
-                    sValue.assign(match[2]);
-                    EHS_TRACE("header fullmatch '%s' => '%s'", sName.c_str(), sValue.c_str());
-                    // else if there is still data
+            case HTTPSCAN_REQUESTLINELF:
+                if ('\n' != c) {
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                m_sOriginalUri = m_sUri;
+                // Continue parsing the headers
+                m_oHeaderFields.reserve(16);
+                m_nCurrentHttpParseState = HTTPPARSESTATE_HEADERS;
+                m_nScanState = HTTPSCAN_HEADERSTART;
+                break;
 
-                    boost::trim(sValue);
-                    if (m_oRequestHeaders.end() == m_oRequestHeaders.find(sName)) {
-                        m_oRequestHeaders[sName] = sValue;
-                    } else {
-                        // Multiple header of same name (RFC2616, Section 4.2)
-                        // Check, if specific header is allowed (defined as comma-sparated
-                        // multi-value header.
-                        if (!IsMultivalHeader(sName)) {
-                            EHS_TRACE("Multi-Value for %s not allowed", sName.c_str());
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                            bDone = true;
-                        } else {
-                            string tmp(m_oRequestHeaders[sName].append(", ").append(sValue));
-                            m_oRequestHeaders[sName] = tmp;
-                        }
-                    }
-                    m_sLastHeaderName = sName;
-                } else if (boost::regex_match(sLine, match, reHeaderCont)) {
-                    sValue.assign(match[1]);
-                    EHS_TRACE("headerCont fullmatch", "");
+            case HTTPSCAN_HEADERSTART:
+                if ('\r' == c) {
+                    m_nScanState = HTTPSCAN_HEADERSENDLF;
+                } else if (cc[c] & CHARCLASS_WS) {
                     // Header continuation using leading space
-                    if (m_sLastHeaderName.empty()) {
+                    if (m_oHeaderFields.empty()) {
                         EHS_TRACE("Header-Continuation without preceeding Header", "");
-                        m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                        bDone = true;
-                    } else {
-                        boost::trim(sValue);
-                        string tmp(m_oRequestHeaders[m_sLastHeaderName].append(" ").append(sValue));
-                        m_oRequestHeaders[m_sLastHeaderName] = tmp;
+                        bInvalid = true;
+                        break;
                     }
+                    HeaderField f = { 0, 0, 0, 0 };
+                    m_oHeaderFields.push_back(f);
+                    m_nScanState = HTTPSCAN_HEADERWS;
+                } else if (cc[c] & CHARCLASS_NAME) {
+                    HeaderField f = { pos, 0, 0, 0 };
+                    m_oHeaderFields.push_back(f);
+                    m_nScanState = HTTPSCAN_HEADERNAME;
                 } else {
-                    // else we had some sort of error -- bail out
-                    EHS_TRACE("Invalid header line: '%s'", sLine.c_str());
-                    m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                    bDone = true;
+                    EHS_TRACE("Invalid header line", "");
+                    bInvalid = true;
+                    break;
                 }
+                ++pos;
                 break;
 
-            case HTTPPARSESTATE_BODYTRAILER:
-                sLine = GetNextLine(irsData);
-                if (sLine.empty()) {
-                    bDone = true;
-                } else {
-                    if (sLine == "\r\n" ) {
-                        // Empty trailer, push CRLF back so that next state
-                        // finds it immediately.
-                        irsData.insert(0, "\r\n");
+            case HTTPSCAN_HEADERNAME:
+                pos = ScanHeaderName(data + pos, data + len) - data;
+                if (pos < len) {
+                    if (':' != data[pos]) {
+                        EHS_TRACE("Invalid header name", "");
+                        bInvalid = true;
+                        break;
                     }
-                    m_nCurrentHttpParseState = HTTPPARSESTATE_BODYTRAILER2;
-                    continue;
+                    m_oHeaderFields.back().namelen = pos - m_oHeaderFields.back().name;
+                    ++pos;
+                    m_nScanState = HTTPSCAN_HEADERWS;
                 }
                 break;
 
-            case HTTPPARSESTATE_BODYTRAILER2:
-                sLine = GetNextLine(irsData);
-                if (sLine.empty()) {
-                    bDone = true;
-                } else if (sLine == "\r\n") {
-                    // if we're dealing with multi-part form attachments
-                    if (m_oRequestHeaders["Content-Type"].substr(0, 9) == "multipart") {
-                        // handle the body as if it's multipart form data
-                        if (ParseMultipartFormData() == PARSEMULTIPARTFORMDATA_SUCCESS) {
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
-                        } else {
-#ifdef EHS_DEBUG
-                            cerr << "[EHS_DEBUG] Error: Mishandled multi-part form data for unknown reason" << endl;
-#endif
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                        }
-                    } else {
-                        // else the body is just one piece
-                        // check for any form data
-                        if(m_sParseContentType.empty() ||
-                            m_oRequestHeaders["Content-Type"].compare(m_sParseContentType) == 0) {
-                            GetFormDataFromString(m_sBody);
-                        }
-#ifdef EHS_DEBUG
-                        cerr << "Done with body, done with entire chunked request" << endl;
-#endif
-                        m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
+            case HTTPSCAN_HEADERWS:
+                while ((pos < len) && (cc[static_cast<unsigned char>(data[pos])] & CHARCLASS_WS)) {
+                    ++pos;
+                }
+                if (pos < len) {
+                    m_oHeaderFields.back().value = pos;
+                    m_nScanState = HTTPSCAN_HEADERVALUE;
+                }
+                break;
+
+            case HTTPSCAN_HEADERVALUE:
+                pos = ScanHeaderValue(data + pos, data + len) - data;
+                if (pos < len) {
+                    if ('\r' != data[pos]) {
+                        EHS_TRACE("Invalid character in header value", "");
+                        bInvalid = true;
+                        break;
                     }
-                } else {
-#ifdef EHS_DEBUG
-                    cerr << "[EHS_DEBUG] Error: junk after chunk trailer" << endl;
-#endif
-                    m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
+                    // strip trailing white space
+                    HeaderField & f = m_oHeaderFields.back();
+                    f.valuelen = pos - f.value;
+                    while ((0 < f.valuelen) &&
+                            (cc[static_cast<unsigned char>(data[f.value + f.valuelen - 1])] & CHARCLASS_WS)) {
+                        --f.valuelen;
+                    }
+                    ++pos;
+                    m_nScanState = HTTPSCAN_HEADERLF;
                 }
-                bDone = true;
                 break;
 
-            case HTTPPARSESTATE_BODYCHUNK:
-                if (0 == m_nChunkLen) {
-                    // At end of chunk, expect exactly one CRLF
-                    sLine = GetNextLine(irsData);
-                    if (sLine.empty()) {
+            case HTTPSCAN_HEADERLF:
+                if ('\n' != c) {
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                m_nScanState = HTTPSCAN_HEADERSTART;
+                break;
+
+            case HTTPSCAN_HEADERSENDLF:
+                if ('\n' != c) {
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                if (!ProcessHeaders(data)) {
+                    bInvalid = true;
+                    break;
+                }
+                // The header block has been copied, drop it from the buffer.
+                ioBuffer.Consume(pos);
+                data = ioBuffer.Data();
+                len = ioBuffer.Length();
+                pos = 0;
+                if (HTTPPARSESTATE_BODY == m_nCurrentHttpParseState) {
+                    if ((m_sHttpVersionNumber == "1.1") &&
+                            (m_oRequestHeaders.end() != m_oRequestHeaders.find(HEADER_EXPECT))) {
+                        // Don't touch the body until EHSConnection has
+                        // decided on the expectation.
+                        m_bExpectPending = true;
                         bDone = true;
-                    } else {
-                        if (sLine == "\r\n") {
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_BODY;
-                        } else {
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                        }
+                    } else if (!BeginBody()) {
+                        bInvalid = true;
                     }
-                } else {
-                    size_t l = irsData.length();
-                    m_sBody.append(irsData.substr(0, m_nChunkLen));
-                    if (l > m_nChunkLen) {
-                        irsData = irsData.substr(m_nChunkLen);
-                        m_nChunkLen = 0;
-                        continue;
-                    } else {
-                        m_nChunkLen -= l;
+                }
+                break;
+
+            case HTTPSCAN_BODY:
+                if (m_bBodyStreamed || (NULL != m_poDecoder) || (NULL != m_poMultipart)) {
+                    // handle whatever has arrived so far
+                    size_t n = std::min(len - pos, m_nContentLength);
+                    if (!AddBodyData(data + pos, n)) {
+                        bInvalid = true;
+                        break;
+                    }
+                    pos += n;
+                    m_nContentLength -= n;
+                    if (0 == m_nContentLength) {
+                        if (!CompleteBody()) {
+                            bInvalid = true;
+                            break;
+                        }
+                        bDone = true;
+                    } else if (m_bPauseReading) {
                         bDone = true;
                     }
+                    break;
                 }
+                // if we haven't gotten all the data we're looking for,
+                //   just hold off and try again when we get more
+                if ((len - pos) < m_nContentLength) {
+                    EHS_TRACE("Not enough data yet -- %lu < %lu", len - pos, m_nContentLength);
+                    bDone = true;
+                    break;
+                }
+                // grab out the actual body from the request and leave the rest
+                m_sBody.assign(data + pos, m_nContentLength);
+                pos += m_nContentLength;
+                // The body is interpreted later by ParseBody, which
+                // runs on the thread that handles the request.
+                m_bBodyParsed = false;
+                m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
+                m_nScanState = HTTPSCAN_DONE;
+                bDone = true;
                 break;
 
-            case HTTPPARSESTATE_BODY:
-                if (m_bChunked) {
-                    // get the next line
-                    sLine = GetNextLine(irsData);
-                    if (!sLine.empty()) {
-#ifdef EHS_DEBUG
-                        cerr << "[EHS_DEBUG] Look for chunk header in :'" << sLine << "'" << endl;
-#endif
-                        boost::regex reChunkHeader("^([[:xdigit:]]+)[^\\r]*\\r\\n$");
-                        boost::smatch match;
-                        if (boost::regex_match(sLine, match, reChunkHeader)) {
-                            char *eptr = NULL;
-                            string tmp(match[1]);
-                            unsigned long len = strtoul(tmp.c_str(), &eptr, 16);
-                            if (eptr && (*eptr)) {
-                                m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                                continue;
-                            }
-
-                            if (0 == len) {
-                                // Got end of chunked transfer
-#ifdef EHS_DEBUG
-                                cerr << "[EHS_DEBUG] match, last-chunk" << endl;
-#endif
-                                m_nCurrentHttpParseState = HTTPPARSESTATE_BODYTRAILER;
-                                continue;
-                            } else {
-#ifdef EHS_DEBUG
-                                cerr << "[EHS_DEBUG] match, chunklen: " << len << endl;
-#endif
-                                m_nChunkLen = len;
-                                m_nCurrentHttpParseState = HTTPPARSESTATE_BODYCHUNK;
-                                continue;
-                            }
-                        } else {
-#ifdef EHS_DEBUG
-                            cerr << "[EHS_DEBUG] NO MATCH" << endl;
-#endif
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                        }
+            case HTTPSCAN_CHUNKSIZE:
+                while ((pos < len) && (cc[static_cast<unsigned char>(data[pos])] & CHARCLASS_HEX)) {
+                    if (m_nChunkLen > (static_cast<size_t>(-1) >> 4)) {
+                        EHS_TRACE("Chunk size overflow", "");
+                        bInvalid = true;
+                        break;
                     }
-                } else {
-                    // if a content length wasn't specified, we can't be here (we
-                    //   don't know chunked encoding)
-                    if (m_oRequestHeaders.find("Content-Length") ==
-                            m_oRequestHeaders.end()) {
-                        m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                        continue;
+                    m_nChunkLen = (m_nChunkLen << 4) | HexValue(data[pos]);
+                    ++m_nScanCount;
+                    ++pos;
+                }
+                if (!bInvalid && (pos < len)) {
+                    if (0 == m_nScanCount) {
+                        EHS_TRACE("Missing chunk size", "");
+                        bInvalid = true;
+                    } else if ('\r' == data[pos]) {
+                        ++pos;
+                        m_nScanState = HTTPSCAN_CHUNKSIZELF;
+                    } else {
+                        m_nTokenStart = pos;
+                        m_nScanState = HTTPSCAN_CHUNKEXT;
                     }
+                }
+                break;
 
-                    // get the content length
-                    unsigned int nContentLength = 0;
-                    try {
-                        nContentLength = boost::lexical_cast<unsigned int>(m_oRequestHeaders["Content-Length"]);
-                    } catch (const boost::bad_lexical_cast &e) {
-                        m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                        continue;
+            case HTTPSCAN_CHUNKEXT:
+                // Chunk extensions are validated, but their meaning is ignored
+                pos = ScanLineEnd(data + pos, data + len) - data;
+                if (pos < len) {
+                    if (('\r' != data[pos]) ||
+                            (!ValidChunkExtensions(data + m_nTokenStart, data + pos))) {
+                        EHS_TRACE("Invalid chunk extension", "");
+                        bInvalid = true;
+                        break;
                     }
+                    ++pos;
+                    m_nScanState = HTTPSCAN_CHUNKSIZELF;
+                } else if ((pos - m_nTokenStart) > MAX_CHUNK_LINE) {
+                    EHS_TRACE("Chunk extension too long", "");
+                    bInvalid = true;
+                }
+                break;
 
-                    // else if we haven't gotten all the data we're looking for,
-                    //   just hold off and try again when we get more
-                    if (irsData.length() < nContentLength) {
-#ifdef EHS_DEBUG
-                        cerr
-                            << "[EHS_DEBUG] Info: Not enough data yet -- "
-                            << irsData.length() << " < " << nContentLength << endl;
-#endif
-                        bDone = true;
-                    } else {
-                        // otherwise, we've gotten enough data from the client, handle it now
-
-                        // grab out the actual body from the request and leave the rest
-                        m_sBody.assign(irsData.substr(0, nContentLength));
-                        irsData.erase(0, nContentLength);
-
-                        // if we're dealing with multi-part form attachments
-                        if (m_oRequestHeaders["Content-Type"].substr(0, 9) == "multipart") {
-                            // handle the body as if it's multipart form data
-                            if (ParseMultipartFormData() == PARSEMULTIPARTFORMDATA_SUCCESS) {
-                                m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
-                            } else {
-#ifdef EHS_DEBUG
-                                cerr << "[EHS_DEBUG] Error: Mishandled multi-part form data for unknown reason" << endl;
-#endif
-                                m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
-                            }
-                        } else {
-                            // else the body is just one piece
-
-                            // check for any form data
-                            if(m_sParseContentType.empty() ||
-                                m_oRequestHeaders["Content-Type"].compare(m_sParseContentType) == 0) {
-                                GetFormDataFromString(m_sBody);
-                            }
-#ifdef EHS_DEBUG
-                            cerr << "Done with body, done with entire request" << endl;
-#endif
-                            m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
-                        }
+            case HTTPSCAN_CHUNKSIZELF:
+                if ('\n' != c) {
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                EHS_TRACE("chunklen: %lu", m_nChunkLen);
+                m_nScanState = (0 == m_nChunkLen) ? HTTPSCAN_TRAILERSTART : HTTPSCAN_CHUNKDATA;
+                break;
+
+            case HTTPSCAN_CHUNKDATA:
+                {
+                    size_t n = std::min(len - pos, m_nChunkLen);
+                    if (!AddBodyData(data + pos, n)) {
+                        bInvalid = true;
+                        break;
+                    }
+                    bDone = m_bPauseReading;
+                    pos += n;
+                    m_nChunkLen -= n;
+                    if (0 == m_nChunkLen) {
+                        m_nScanState = HTTPSCAN_CHUNKDATACR;
+                    }
+                }
+                break;
 
+            case HTTPSCAN_CHUNKDATACR:
+                // At end of chunk, expect exactly one CRLF
+                if ('\r' != c) {
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                m_nScanState = HTTPSCAN_CHUNKDATALF;
+                break;
+
+            case HTTPSCAN_CHUNKDATALF:
+                if ('\n' != c) {
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                m_nScanCount = 0;
+                m_nScanState = HTTPSCAN_CHUNKSIZE;
+                break;
+
+            case HTTPSCAN_TRAILERSTART:
+                if ('\r' == c) {
+                    ++pos;
+                    m_nScanState = HTTPSCAN_TRAILERSENDLF;
+                } else {
+                    m_nTokenStart = pos;
+                    m_nScanState = HTTPSCAN_TRAILER;
+                }
+                break;
+
+            case HTTPSCAN_TRAILER:
+                pos = ScanLineEnd(data + pos, data + len) - data;
+                if (pos < len) {
+                    if (('\r' != data[pos]) || (!AddTrailer(data + m_nTokenStart, data + pos))) {
+                        EHS_TRACE("Invalid trailer field", "");
+                        bInvalid = true;
+                        break;
                     }
+                    ++pos;
+                    m_nScanState = HTTPSCAN_TRAILERLF;
+                } else if ((pos - m_nTokenStart) > MAX_CHUNK_LINE) {
+                    EHS_TRACE("Trailer field too long", "");
+                    bInvalid = true;
                 }
-                bDone = true;
                 break;
 
+            case HTTPSCAN_TRAILERLF:
+                if ('\n' != c) {
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                m_nScanState = HTTPSCAN_TRAILERSTART;
+                break;
 
-            case HTTPPARSESTATE_INVALID:
+            case HTTPSCAN_TRAILERSENDLF:
+                if ('\n' != c) {
+                    EHS_TRACE("junk after chunk trailer", "");
+                    bInvalid = true;
+                    break;
+                }
+                ++pos;
+                if (!CompleteBody()) {
+                    bInvalid = true;
+                    break;
+                }
+                bDone = true;
+                break;
+
+            case HTTPSCAN_DONE:
             default:
 #ifdef EHS_DEBUG
-                cerr << "[EHS_DEBUG] Critical error: Invalid internal state: " << m_nCurrentHttpParseState << endl;
+                cerr << "[EHS_DEBUG] Critical error: Invalid internal state: " << m_nScanState << endl;
 #endif
+                bInvalid = true;
                 break;
         }
     }
+
+    if (bInvalid) {
+        m_nCurrentHttpParseState = HTTPPARSESTATE_INVALIDREQUEST;
+        m_nScanState = HTTPSCAN_DONE;
+        if (m_bBodyStreamed && (NULL != m_poBodyHandler)) {
+            m_poBodyHandler->OnBodyAborted(this);
+            m_poBodyHandler = NULL;
+        }
+    } else if ((HTTPSCAN_CHUNKEXT == m_nScanState) || (HTTPSCAN_TRAILER == m_nScanState)) {
+        // Keep the incomplete line, it is interpreted as a whole.
+        ioBuffer.Consume(m_nTokenStart);
+        pos -= m_nTokenStart;
+        m_nTokenStart = 0;
+    } else if ((HTTPPARSESTATE_BODY == m_nCurrentHttpParseState) ||
+            (HTTPPARSESTATE_COMPLETEREQUEST == m_nCurrentHttpParseState)) {
+        // Header offsets are no longer needed, so drop the consumed
+        // data, leaving anything that belongs to the next request.
+        ioBuffer.Consume(pos);
+        pos = 0;
+    }
+    m_nParseOffset = pos;
     return m_nCurrentHttpParseState;
 }
 
+bool HttpRequest::BeginBody()
+{
+    StringCaseMap::iterator ce = m_oRequestHeaders.find(HEADER_CONTENT_ENCODING);
+    if (m_bInflateBody && (m_oRequestHeaders.end() != ce) && (!boost::iequals(ce->second, "identity"))) {
+        m_poDecoder = BodyDecoder::Create(ce->second);
+        if (NULL == m_poDecoder) {
+            EHS_TRACE("Unsupported Content-Encoding '%s'", ce->second.c_str());
+            m_bUnsupportedEncoding = true;
+            return false;
+        }
+        // From now on, the request looks as if it was sent uncompressed.
+        m_oRequestHeaders.erase(ce);
+        StringCaseMap::iterator cl = m_oRequestHeaders.find(HEADER_CONTENT_LENGTH);
+        if (m_oRequestHeaders.end() != cl) {
+            m_oRequestHeaders.erase(cl);
+        }
+    }
+    // Offer the body to the RequestBodyHandler, if any.
+    if (NULL != m_poBodyHandler) {
+        m_bBodyStreamed = m_poBodyHandler->OnHeaders(this);
+        if (!m_bBodyStreamed) {
+            m_poBodyHandler = NULL;
+        }
+    }
+    // Reject a body that can't fit, before receiving it.
+    if ((!m_bBodyStreamed) && (!m_bChunked) && (m_nContentLength > m_nMaxBodySize)) {
+        EHS_TRACE("Content-Length exceeds %lu bytes", m_nMaxBodySize);
+        m_bBodyTooLarge = true;
+        return false;
+    }
+    // Multipart bodies are parsed while they arrive, so that large
+    // attachments are written to temporary files right away.
+    string sBoundary;
+    if ((!m_bBodyStreamed) && (Headers("Content-Type").substr(0, 9) == "multipart") &&
+            MultipartParser::GetBoundary(m_oRequestHeaders["Content-Type"], sBoundary)) {
+        m_poMultipart = new MultipartParser(sBoundary, m_oFormValueMap, m_nMultipartSpillSize);
+    }
+    if (NULL != m_poDecoder) {
+        // A buffered body must fit into m_nMaxBodySize after decoding as well.
+        size_t nMax = m_nMaxInflatedSize;
+        if ((!m_bBodyStreamed) && ((0 == nMax) || (m_nMaxBodySize < nMax))) {
+            nMax = m_nMaxBodySize;
+        }
+        m_poDecoder->SetLimits(nMax, m_nMaxInflateRatio);
+    }
+    return true;
+}
+
+bool HttpRequest::AddBodyData(const char *data, size_t len)
+{
+    if (NULL != m_poDecoder) {
+        bool bDirect = m_bBodyStreamed || (NULL != m_poMultipart);
+        switch (m_poDecoder->Decode(data, len, bDirect ? m_sDecoded : m_sBody)) {
+            case BodyDecoder::DECODE_OK:
+                break;
+            case BodyDecoder::DECODE_TOOLARGE:
+                EHS_TRACE("Decompressed body too large", "");
+                m_bBodyTooLarge = true;
+                return false;
+            default:
+                EHS_TRACE("Invalid compressed body", "");
+                return false;
+        }
+        if (m_bBodyStreamed) {
+            StreamBodyData(m_sDecoded.data(), m_sDecoded.length());
+            m_sDecoded.clear();
+        } else if (NULL != m_poMultipart) {
+            // the decoder enforces m_nMaxBodySize
+            FeedMultipart(m_sDecoded.data(), m_sDecoded.length());
+            m_sDecoded.clear();
+        }
+    } else if (m_bBodyStreamed) {
+        StreamBodyData(data, len);
+    } else if ((m_nMaxBodySize - ((NULL != m_poMultipart) ? m_nMultipartLength : m_sBody.length())) < len) {
+        EHS_TRACE("Decoded body exceeds %lu bytes", m_nMaxBodySize);
+        m_bBodyTooLarge = true;
+        return false;
+    } else if (NULL != m_poMultipart) {
+        m_nMultipartLength += len;
+        FeedMultipart(data, len);
+    } else {
+        m_sBody.append(data, len);
+    }
+    return true;
+}
+
+void HttpRequest::FeedMultipart(const char *data, size_t len)
+{
+    // After an error, the rest of the body is skipped. The request
+    // is answered with 400 by ParseBody, like a collected body would be.
+    if ((PARSEMULTIPARTFORMDATA_INVALID == m_nMultipartResult) && (!m_poMultipart->Feed(data, len))) {
+        EHS_TRACE("Malformed multi-part form data", "");
+        m_nMultipartResult = PARSEMULTIPARTFORMDATA_FAILED;
+    }
+}
+
+bool HttpRequest::CompleteBody()
+{
+    if (NULL != m_poDecoder) {
+        bool bFinished = m_poDecoder->Finished();
+        delete m_poDecoder;
+        m_poDecoder = NULL;
+        if (!bFinished) {
+            EHS_TRACE("Truncated compressed body", "");
+            return false;
+        }
+    }
+    if (NULL != m_poMultipart) {
+        if (PARSEMULTIPARTFORMDATA_INVALID == m_nMultipartResult) {
+            m_nMultipartResult = m_poMultipart->Finish() ?
+                PARSEMULTIPARTFORMDATA_SUCCESS : PARSEMULTIPARTFORMDATA_FAILED;
+        }
+        delete m_poMultipart;
+        m_poMultipart = NULL;
+    }
+    if (m_bBodyStreamed) {
+        CompleteStreamedBody();
+    } else {
+        // The body is interpreted later by ParseBody, which
+        // runs on the thread that handles the request.
+        m_bBodyParsed = false;
+        m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
+        m_nScanState = HTTPSCAN_DONE;
+    }
+    return true;
+}
+
+void HttpRequest::StreamBodyData(const char *data, size_t len)
+{
+    if ((0 < len) && (!m_poBodyHandler->OnBodyData(this, data, len))) {
+        m_bPauseReading = true;
+    }
+}
+
+void HttpRequest::CompleteStreamedBody()
+{
+    m_nCurrentHttpParseState = HTTPPARSESTATE_COMPLETEREQUEST;
+    m_nScanState = HTTPSCAN_DONE;
+    // nothing left to pause for, the request is dispatched right away
+    m_bPauseReading = false;
+    m_poBodyHandler->OnBodyComplete(this);
+    m_poBodyHandler = NULL;
+}
+
+bool HttpRequest::ParseBody()
+{
+    if (m_bBodyParsed) {
+        return true;
+    }
+    m_bBodyParsed = true;
+    // if we're dealing with multi-part form attachments
+    if (Headers("Content-Type").substr(0, 9) == "multipart") {
+        // handle the body as if it's multipart form data
+        if (ParseMultipartFormData() != PARSEMULTIPARTFORMDATA_SUCCESS) {
+#ifdef EHS_DEBUG
+            cerr << "[EHS_DEBUG] Error: Mishandled multi-part form data for unknown reason" << endl;
+#endif
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HttpRequest::IsFormContentType()
+{
+    if (0 == m_sParseContentType.compare("*")) {
+        return true;
+    }
+    string sContentType(Headers("Content-Type"));
+    string::size_type semicolon = sContentType.find(';');
+    if (string::npos != semicolon) {
+        sContentType.erase(semicolon);
+    }
+    boost::trim(sContentType);
+    return boost::iequals(sContentType, m_sParseContentType.empty() ?
+            "application/x-www-form-urlencoded" : m_sParseContentType);
+}
+
+void HttpRequest::ParseFormValues()
+{
+    if (m_bFormValuesParsed) {
+        return;
+    }
+    m_bFormValuesParsed = true;
+    // Check to see if the uri appeared to have form data in it.
+    // Form data from the body takes precedence.
+    GetFormDataFromString(m_sOriginalUri, false);
+    // Multipart bodies have been handled by ParseBody already.
+    if ((!m_sBody.empty()) && (Headers("Content-Type").substr(0, 9) != "multipart") &&
+            IsFormContentType()) {
+        GetFormDataFromString(m_sBody);
+    }
+}
+
+void HttpRequest::ParseCookies()
+{
+    if (m_bCookiesParsed) {
+        return;
+    }
+    m_bCookiesParsed = true;
+    StringCaseMap::iterator cookie = m_oRequestHeaders.find(HEADER_COOKIE);
+    if (m_oRequestHeaders.end() != cookie) {
+        ParseCookieData(cookie->second);
+    }
+}
+
+bool HttpRequest::UrlDecode(const string & irsString, string & rsDecoded)
+{
+    const char *data = irsString.data();
+    const char *end = data + irsString.length();
+    const char *p = ScanUrlEscape(data, end);
+    if (p == end) {
+        return false;
+    }
+    const unsigned char *cc = CharClasses();
+    rsDecoded.clear();
+    rsDecoded.reserve(irsString.length());
+    const char *start = data;
+    while (p < end) {
+        rsDecoded.append(start, p);
+        if ('+' == *p) {
+            rsDecoded.push_back(' ');
+            start = ++p;
+        } else if (((end - p) >= 3) &&
+                (cc[static_cast<unsigned char>(p[1])] & CHARCLASS_HEX) &&
+                (cc[static_cast<unsigned char>(p[2])] & CHARCLASS_HEX)) {
+            rsDecoded.push_back(static_cast<char>((HexValue(p[1]) << 4) | HexValue(p[2])));
+            p += 3;
+            start = p;
+        } else {
+            // malformed escape, keep it literally
+            start = p++;
+        }
+        p = ScanUrlEscape(p, end);
+    }
+    rsDecoded.append(start, end);
+    return true;
+}
+
+const ParamMap &HttpRequest::Params()
+{
+    if (!m_bParamsDecoded) {
+        ParseFormValues();
+        m_bParamsDecoded = true;
+        string sName;
+        for (FormValueMap::const_iterator i = m_oFormValueMap.begin();
+                i != m_oFormValueMap.end(); ++i) {
+            const string *value = &i->second.m_sBody;
+            if (!i->second.m_oContentDisposition.m_oContentDispositionHeaders.empty()) {
+                // multipart values are not URL-encoded
+                m_oParamMap[i->first] = value;
+                continue;
+            }
+            string sValue;
+            if (UrlDecode(*value, sValue)) {
+                m_oDecodedParams.push_back(string());
+                m_oDecodedParams.back().swap(sValue);
+                value = &m_oDecodedParams.back();
+            }
+            m_oParamMap[UrlDecode(i->first, sName) ? sName : i->first] = value;
+        }
+    }
+    return m_oParamMap;
+}
+
+const string *HttpRequest::Param(const string & name)
+{
+    const ParamMap &params = Params();
+    ParamMap::const_iterator i = params.find(name);
+    return (params.end() == i) ? NULL : i->second;
+}
+
+bool HttpRequest::ParamInt(const string & name, long long & value)
+{
+    const string *s = Param(name);
+    if ((NULL == s) || s->empty()) {
+        return false;
+    }
+    const char *data = s->c_str();
+    const char *end = data + s->length();
+    const char *p = data;
+    bool negative = false;
+    if (('-' == *p) || ('+' == *p)) {
+        negative = ('-' == *p++);
+    }
+    if (p == end) {
+        return false;
+    }
+    const unsigned char *cc = CharClasses();
+    unsigned long long limit = negative ?
+        static_cast<unsigned long long>(LLONG_MAX) + 1 : static_cast<unsigned long long>(LLONG_MAX);
+    unsigned long long n = 0;
+    for (; p < end; ++p) {
+        if (!(cc[static_cast<unsigned char>(*p)] & CHARCLASS_DIGIT)) {
+            return false;
+        }
+        unsigned int digit = *p - '0';
+        if (n > ((limit - digit) / 10)) {
+            return false;
+        }
+        n = n * 10 + digit;
+    }
+    value = negative ? static_cast<long long>(0ULL - n) : static_cast<long long>(n);
+    return true;
+}
+
+bool HttpRequest::ParamDouble(const string & name, double & value)
+{
+    const string *s = Param(name);
+    if ((NULL == s) || s->empty() ||
+            (CharClasses()[static_cast<unsigned char>((*s)[0])] & CHARCLASS_WS)) {
+        return false;
+    }
+    char *end = NULL;
+    errno = 0;
+    double d = strtod(s->c_str(), &end);
+    if ((end != (s->c_str() + s->length())) || (ERANGE == errno)) {
+        return false;
+    }
+    value = d;
+    return true;
+}
+
 HttpRequest::HttpRequest (int inRequestId,
         EHSConnection * ipoSourceEHSConnection,
         const string & irsParseContentType) :
@@ -608,16 +1213,45 @@ HttpRequest::HttpRequest (int inRequestId,
     m_sOriginalUri(""),
     m_sHttpVersionNumber(""),
     m_sBody(""),
-    m_sLastHeaderName(""),
     m_bSecure(false),
     m_oRequestHeaders(StringCaseMap()),
     m_oFormValueMap(FormValueMap()),
     m_oCookieMap(CookieMap()),
     m_nRequestId(inRequestId),
     m_poSourceEHSConnection(ipoSourceEHSConnection),
+    m_nScanState(HTTPSCAN_REQUESTSTART),
+    m_nParseOffset(0),
+    m_nTokenStart(0),
+    m_nScanCount(0),
+    m_oHeaderFields(),
+    m_nHeaderTokens(0),
     m_bChunked(false),
     m_nChunkLen(0),
-    m_sParseContentType(irsParseContentType)
+    m_nContentLength(0),
+    m_sParseContentType(irsParseContentType),
+    m_bBodyParsed(true),
+    m_bFormValuesParsed(false),
+    m_bCookiesParsed(false),
+    m_oParamMap(),
+    m_oDecodedParams(),
+    m_bParamsDecoded(false),
+    m_poBodyHandler(NULL),
+    m_bBodyStreamed(false),
+    m_nMultipartSpillSize(0),
+    m_bPauseReading(false),
+    m_oTrailers(),
+    m_nMaxBodySize(static_cast<size_t>(-1)),
+    m_bBodyTooLarge(false),
+    m_bExpectPending(false),
+    m_bInflateBody(false),
+    m_nMaxInflatedSize(0),
+    m_nMaxInflateRatio(0),
+    m_poDecoder(NULL),
+    m_sDecoded(),
+    m_bUnsupportedEncoding(false),
+    m_poMultipart(NULL),
+    m_nMultipartLength(0),
+    m_nMultipartResult(PARSEMULTIPARTFORMDATA_INVALID)
 {
     if (NULL == m_poSourceEHSConnection) {
 #ifdef EHS_DEBUG
@@ -629,6 +1263,19 @@ HttpRequest::HttpRequest (int inRequestId,
 
 HttpRequest::~HttpRequest ( )
 {
+    // the connection went away in the middle of a streamed body
+    if (m_bBodyStreamed && (NULL != m_poBodyHandler)) {
+        m_poBodyHandler->OnBodyAborted(this);
+    }
+    delete m_poDecoder;
+    // close the temporary file of an incomplete part, before removing it
+    delete m_poMultipart;
+    // remove spilled multipart attachments
+    for (FormValueMap::const_iterator i = m_oFormValueMap.begin(); i != m_oFormValueMap.end(); ++i) {
+        if (!i->second.m_sTempFile.empty()) {
+            remove(i->second.m_sTempFile.c_str());
+        }
+    }
 }
 
 // HELPER FUNCTIONS
@@ -35,10 +35,23 @@
 #include "formvalue.h"
 #include "httprequest.h"
 #include "datum.h"
+#include "ehs.h"
 #include "ehsconnection.h"
+#include "cachedclock.h"
 #include <ctime>
-#include <clocale>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef _WIN32
+# include <io.h>
+#endif
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
@@ -48,11 +61,7 @@ using namespace std;
 
 string HttpResponse::HttpTime ( time_t stamp )
 {
-    char buf[30];
-    char *ol = setlocale(LC_TIME, "C"); // We want english (C)
-    strftime ( buf, 30, "%a, %d %b %Y %H:%M:%S GMT", gmtime( &stamp ));
-    setlocale(LC_TIME, ol); // restore locale
-    return string(buf);
+    return CachedClock::Format(stamp);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -66,22 +75,34 @@ HttpResponse::HttpResponse ( int inResponseId,
     , m_nResponseCode(HTTPRESPONSECODE_INVALID)
     , m_oResponseHeaders(StringCaseMap())
     , m_oCookieList (StringList())
+    , m_nDefaultHeaders(DEFAULT_ALL)
+    , m_nBodyFd(-1)
+    , m_nBodyFileOffset(0)
+    , m_nBodyFileLength(0)
+    , m_poProducer(NULL)
+    , m_bChunkedAllowed(true)
+    , m_bHeadOnly(false)
 {
-    // General Header Fields (HTTP 1.1 Section 4.5)
-    time_t t = time ( NULL );
-    SetDate(t);
-    SetLastModified(t);
-    m_oResponseHeaders [ "Cache-Control" ] = "no-cache";
-    m_oResponseHeaders [ "Content-Type" ] = "text/html";
-    m_oResponseHeaders [ "Content-Length" ] = "0";
+    // General Header Fields (HTTP 1.1 Section 4.5) are added by AppendHead.
 }
 
-///< HTTP response code to get text version of
-const char *HttpResponse::GetPhrase(ResponseCode code)
+HttpResponse::~HttpResponse ( )
+{
+    if (-1 != m_nBodyFd) {
+        close(m_nBodyFd);
+    }
+    delete m_poProducer;
+}
+
+/// Returns the table of all known response codes and their phrases.
+static const map<int, const char *> & Phrases()
 {
-    static map<int, const char *> phrases = boost::assign::map_list_of
+    static const map<int, const char *> phrases = boost::assign::map_list_of
         (HTTPRESPONSECODE_200_OK,                  "OK")
+        (HTTPRESPONSECODE_206_PARTIAL_CONTENT,     "Partial Content")
+        (HTTPRESPONSECODE_100_CONTINUE,            "Continue")
         (HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS, "Switching Protocols")
+        (HTTPRESPONSECODE_103_EARLYHINTS,          "Early Hints")
         (HTTPRESPONSECODE_301_MOVEDPERMANENTLY,    "Moved Permanently")
         (HTTPRESPONSECODE_302_FOUND,               "FOUND")
         (HTTPRESPONSECODE_304_NOT_MODIFIED,        "Not modified")
@@ -89,12 +110,47 @@ const char *HttpResponse::GetPhrase(ResponseCode code)
         (HTTPRESPONSECODE_401_UNAUTHORIZED,        "Unauthorized")
         (HTTPRESPONSECODE_403_FORBIDDEN,           "Forbidden")
         (HTTPRESPONSECODE_404_NOTFOUND,            "Not Found")
+        (HTTPRESPONSECODE_405_METHOD_NOT_ALLOWED,  "Method Not Allowed")
         (HTTPRESPONSECODE_413_TOOLARGE,            "Request entity too large")
+        (HTTPRESPONSECODE_415_UNSUPPORTEDMEDIATYPE, "Unsupported Media Type")
+        (HTTPRESPONSECODE_416_RANGE_NOT_SATISFIABLE, "Range Not Satisfiable")
+        (HTTPRESPONSECODE_417_EXPECTATIONFAILED,   "Expectation Failed")
         (HTTPRESPONSECODE_426_UPGRADE_REQUIRED,    "Upgrade required")
         (HTTPRESPONSECODE_500_INTERNALSERVERERROR, "Internal Server Error")
         (HTTPRESPONSECODE_503_SERVICEUNAVAILABLE,  "Service Unavailable");
-    map<int, const char *>::const_iterator i = phrases.find(code);
-    return (phrases.end() == i) ? "INVALID" : i->second;
+    return phrases;
+}
+
+/// Builds the complete status lines for all known response codes.
+static map<int, string> StatusLines()
+{
+    map<int, string> ret;
+    char buf[16];
+    for (map<int, const char *>::const_iterator i = Phrases().begin(); i != Phrases().end(); ++i) {
+        snprintf(buf, sizeof(buf), "%d ", i->first);
+        ret[i->first] = string("HTTP/1.1 ").append(buf).append(i->second).append("\r\n");
+    }
+    return ret;
+}
+
+///< HTTP response code to get text version of
+const char *HttpResponse::GetPhrase(ResponseCode code)
+{
+    map<int, const char *>::const_iterator i = Phrases().find(code);
+    return (Phrases().end() == i) ? "INVALID" : i->second;
+}
+
+void HttpResponse::AppendStatusLine(ResponseCode code, string &out)
+{
+    static const map<int, string> lines = StatusLines();
+    map<int, string>::const_iterator i = lines.find(code);
+    if (lines.end() != i) {
+        out.append(i->second);
+    } else {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d ", code);
+        out.append("HTTP/1.1 ", 9).append(buf).append(GetPhrase(code)).append("\r\n", 2);
+    }
 }
 
 std::string HttpResponse::GetStatusString()
@@ -118,7 +174,9 @@ HttpResponse *HttpResponse::Error(ResponseCode code, int inResponseId, EHSConnec
 
 HttpResponse *HttpResponse::Error (ResponseCode code, HttpRequest *request)
 {
-    return Error(code, request->Id(), request->Connection());
+    HttpResponse *ret = Error(code, request->Id(), request->Connection());
+    ret->m_bHeadOnly = (REQUESTMETHOD_HEAD == request->Method());
+    return ret;
 }
 
 void HttpResponse::SetDate ( time_t stamp )
@@ -138,9 +196,297 @@ void HttpResponse::SetBody ( const char * ipsBody, ///< body to return to user
         )
 {
     GenericResponse::SetBody(ipsBody, inBodyLength);
-    ostringstream oss;
-    oss << m_sBody.length();
-    m_oResponseHeaders [ "Content-Length" ] = oss.str();
+    if (-1 != m_nBodyFd) {
+        close(m_nBodyFd);
+        m_nBodyFd = -1;
+    }
+    delete m_poProducer;
+    m_poProducer = NULL;
+    // Content-Length is derived from the body when sending.
+    StringCaseMap::iterator i = m_oResponseHeaders.find(HEADER_CONTENT_LENGTH);
+    if (m_oResponseHeaders.end() != i) {
+        m_oResponseHeaders.erase(i);
+    }
+    m_nDefaultHeaders |= DEFAULT_CONTENT_LENGTH;
+}
+
+bool HttpResponse::SetBodyFile(const string & path)
+{
+#ifdef _WIN32
+    int fd = open(path.c_str(), O_RDONLY | O_BINARY);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+#endif
+    if (-1 == fd) {
+        return false;
+    }
+    struct stat st;
+    if ((0 != fstat(fd, &st)) || (!S_ISREG(st.st_mode))) {
+        close(fd);
+        return false;
+    }
+    SetBodyFile(fd, 0, st.st_size);
+    SetLastModified(st.st_mtime);
+    return true;
+}
+
+void HttpResponse::SetBodyFile(int fd, off_t offset, size_t length)
+{
+    SetBody("", 0);
+    m_nBodyFd = fd;
+    m_nBodyFileOffset = offset;
+    m_nBodyFileLength = length;
+}
+
+void HttpResponse::SetBodyProducer(ResponseProducer *producer)
+{
+    SetBody("", 0);
+    m_poProducer = producer;
+}
+
+bool HttpResponse::IsChunked() const
+{
+    return (NULL != m_poProducer) && m_bChunkedAllowed &&
+        (m_oResponseHeaders.end() == m_oResponseHeaders.find(HEADER_CONTENT_LENGTH));
+}
+
+bool HttpResponse::IsCloseDelimited() const
+{
+    return (NULL != m_poProducer) && (!m_bChunkedAllowed) &&
+        (m_oResponseHeaders.end() == m_oResponseHeaders.find(HEADER_CONTENT_LENGTH));
+}
+
+unsigned int HttpResponse::DefaultFlag(KnownHeader header)
+{
+    switch (header) {
+        case HEADER_DATE:
+            return DEFAULT_DATE;
+        case HEADER_LAST_MODIFIED:
+            return DEFAULT_LAST_MODIFIED;
+        case HEADER_CACHE_CONTROL:
+            return DEFAULT_CACHE_CONTROL;
+        case HEADER_CONTENT_TYPE:
+            return DEFAULT_CONTENT_TYPE;
+        case HEADER_CONTENT_LENGTH:
+            return DEFAULT_CONTENT_LENGTH;
+        default:
+            return 0;
+    }
+}
+
+void HttpResponse::RemoveHeader(const string & name)
+{
+    m_oResponseHeaders.erase(name);
+    m_nDefaultHeaders &= ~DefaultFlag(HeaderMap::Lookup(name.data(), name.length()));
+}
+
+/**
+ * Checks, whether an If-None-Match list contains an entity tag.
+ * Uses the weak comparison (RFC 7232, Section 2.3.2).
+ */
+static bool ETagListContains(const string & list, const string & etag)
+{
+    // opaque part of etag, without W/
+    size_t start = (0 == etag.compare(0, 2, "W/")) ? 2 : 0;
+    size_t i = 0;
+    while (i < list.length()) {
+        char c = list[i];
+        if ((' ' == c) || ('\t' == c) || (',' == c)) {
+            i++;
+        } else if ('*' == c) {
+            return true;
+        } else {
+            if (0 == list.compare(i, 2, "W/")) {
+                i += 2;
+            }
+            size_t end = list.find('"', i + 1);
+            if (('"' != list[i]) || (string::npos == end)) {
+                return false;
+            }
+            if (0 == list.compare(i, end + 1 - i, etag, start, string::npos)) {
+                return true;
+            }
+            i = end + 1;
+        }
+    }
+    return false;
+}
+
+bool HttpResponse::SetValidators(HttpRequest *request, const string & etag, time_t lastModified)
+{
+    if (!etag.empty()) {
+        m_oResponseHeaders["ETag"] = etag;
+    }
+    if (0 != lastModified) {
+        SetLastModified(lastModified);
+    }
+    if (IsNotModified(request)) {
+        SetNotModified();
+        return true;
+    }
+    return false;
+}
+
+bool HttpResponse::IsNotModified(HttpRequest *request)
+{
+    if ((REQUESTMETHOD_GET != request->Method()) && (REQUESTMETHOD_HEAD != request->Method())) {
+        return false;
+    }
+    StringCaseMap & rh = request->Headers();
+    StringCaseMap::const_iterator inm = rh.find(HEADER_IF_NONE_MATCH);
+    if (rh.end() != inm) {
+        // If-None-Match takes precedence over If-Modified-Since.
+        StringCaseMap::const_iterator etag = m_oResponseHeaders.find(HEADER_ETAG);
+        return (m_oResponseHeaders.end() != etag) && ETagListContains(inm->second, etag->second);
+    }
+    StringCaseMap::const_iterator ims = rh.find(HEADER_IF_MODIFIED_SINCE);
+    // The default Last-Modified (the current time) is no validator.
+    StringCaseMap::const_iterator lm = m_oResponseHeaders.find(HEADER_LAST_MODIFIED);
+    if ((rh.end() == ims) || (m_oResponseHeaders.end() == lm)) {
+        return false;
+    }
+    time_t since = CachedClock::Parse(ims->second);
+    time_t modified = CachedClock::Parse(lm->second);
+    return (-1 != since) && (-1 != modified) && (modified <= since);
+}
+
+void HttpResponse::SetNotModified()
+{
+    SetBody("", 0);
+    m_nResponseCode = HTTPRESPONSECODE_304_NOT_MODIFIED;
+    StringCaseMap::iterator i = m_oResponseHeaders.find(HEADER_CONTENT_TYPE);
+    if (m_oResponseHeaders.end() != i) {
+        m_oResponseHeaders.erase(i);
+    }
+    // A 304 has no body, so there is nothing to describe.
+    m_nDefaultHeaders &= ~(DEFAULT_CONTENT_TYPE | DEFAULT_CONTENT_LENGTH | DEFAULT_LAST_MODIFIED);
+}
+
+void HttpResponse::GenerateETag()
+{
+    if ((NULL != m_poProducer) ||
+            (m_oResponseHeaders.end() != m_oResponseHeaders.find(HEADER_ETAG))) {
+        return;
+    }
+    char buf[64];
+    if (HasBodyFile()) {
+        struct stat st;
+        if (0 != fstat(m_nBodyFd, &st)) {
+            return;
+        }
+        snprintf(buf, sizeof(buf), "\"%lx-%lx-%lx\"", static_cast<unsigned long>(st.st_mtime),
+                static_cast<unsigned long>(m_nBodyFileOffset),
+                static_cast<unsigned long>(m_nBodyFileLength));
+    } else {
+        // CRC-32 and Adler-32 from zlib are fast and, together with
+        // the length, give enough bits to tell versions of a body apart.
+        uLong crc = crc32(0L, Z_NULL, 0);
+        uLong adler = adler32(0L, Z_NULL, 0);
+        const Bytef *p = reinterpret_cast<const Bytef *>(m_sBody.data());
+        size_t left = m_sBody.length();
+        while (0 < left) {
+            uInt n = static_cast<uInt>(min(left, static_cast<size_t>(1 << 30)));
+            crc = crc32(crc, p, n);
+            adler = adler32(adler, p, n);
+            p += n;
+            left -= n;
+        }
+        snprintf(buf, sizeof(buf), "\"%lx-%08lx%08lx\"", static_cast<unsigned long>(m_sBody.length()),
+                static_cast<unsigned long>(crc), static_cast<unsigned long>(adler));
+    }
+    m_oResponseHeaders["ETag"] = buf;
+}
+
+string HttpResponse::Header(const string & name)
+{
+    StringCaseMap::const_iterator i = m_oResponseHeaders.find(name);
+    if (m_oResponseHeaders.end() != i) {
+        return i->second;
+    }
+    KnownHeader header = HeaderMap::Lookup(name.data(), name.length());
+    if (0 == (m_nDefaultHeaders & DefaultFlag(header))) {
+        return string();
+    }
+    switch (header) {
+        case HEADER_DATE:
+        case HEADER_LAST_MODIFIED:
+            return CachedClock::Date();
+        case HEADER_CACHE_CONTROL:
+            return "no-cache";
+        case HEADER_CONTENT_TYPE:
+            return "text/html";
+        default:
+            if (NULL != m_poProducer) {
+                return string();
+            }
+            {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%lu", static_cast<unsigned long>(BodyLength()));
+                return buf;
+            }
+    }
+}
+
+size_t HttpResponse::ContentLength()
+{
+    StringCaseMap::const_iterator i = m_oResponseHeaders.find(HEADER_CONTENT_LENGTH);
+    if (m_oResponseHeaders.end() != i) {
+        return min(static_cast<size_t>(strtoul(i->second.c_str(), NULL, 10)), BodyLength());
+    }
+    return (0 != (m_nDefaultHeaders & DEFAULT_CONTENT_LENGTH)) ? BodyLength() : 0;
+}
+
+void HttpResponse::AppendHead(string &out)
+{
+    AppendStatusLine(m_nResponseCode, out);
+
+    // default headers, unless set explicitly
+    if (UseDefault(DEFAULT_DATE, HEADER_DATE)) {
+        out.append("Date: ", 6);
+        CachedClock::AppendDate(out);
+        out.append("\r\n", 2);
+    }
+    if (UseDefault(DEFAULT_LAST_MODIFIED, HEADER_LAST_MODIFIED)) {
+        out.append("Last-Modified: ", 15);
+        CachedClock::AppendDate(out);
+        out.append("\r\n", 2);
+    }
+    if (UseDefault(DEFAULT_CACHE_CONTROL, HEADER_CACHE_CONTROL)) {
+        out.append("Cache-Control: no-cache\r\n", 25);
+    }
+    if (UseDefault(DEFAULT_CONTENT_TYPE, HEADER_CONTENT_TYPE)) {
+        out.append("Content-Type: text/html\r\n", 25);
+    }
+    if ((NULL == m_poProducer) && UseDefault(DEFAULT_CONTENT_LENGTH, HEADER_CONTENT_LENGTH)) {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "%lu", static_cast<unsigned long>(BodyLength()));
+        out.append("Content-Length: ", 16).append(buf, len).append("\r\n", 2);
+    }
+
+    // framing of a produced body
+    bool closeDelimited = IsCloseDelimited();
+    if (closeDelimited) {
+        out.append("Connection: close\r\n", 19);
+    } else if (IsChunked()) {
+        out.append("Transfer-Encoding: chunked\r\n", 28);
+    }
+
+    // now go through all the entries in the responseheaders string map
+    for (StringCaseMap::const_iterator i = m_oResponseHeaders.begin();
+            i != m_oResponseHeaders.end(); ++i) {
+        if (closeDelimited && (HEADER_CONNECTION == HeaderMap::Lookup(i->first.data(), i->first.length()))) {
+            continue;
+        }
+        out.append(i->first).append(": ", 2).append(i->second).append("\r\n", 2);
+    }
+
+    // now push out all the cookies
+    for (StringList::const_iterator i = m_oCookieList.begin(); i != m_oCookieList.end(); ++i) {
+        out.append("Set-Cookie: ", 12).append(*i).append("\r\n", 2);
+    }
+
+    // extra line break signalling end of headers
+    out.append("\r\n", 2);
 }
 
 // this will send stuff if it's not valid.. 
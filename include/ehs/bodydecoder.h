@@ -0,0 +1,107 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef _BODYDECODER_H_
+#define _BODYDECODER_H_
+
+#include <string>
+#include <cstddef>
+#include <zlib.h>
+
+/**
+ * Incremental decoder for request bodies with a Content-Encoding
+ * of gzip or deflate. The body is decoded piece by piece as it
+ * arrives, so the encoded data never has to be held in full.
+ * Guards against decompression bombs by limiting the decoded size
+ * as well as the ratio between decoded and encoded size.
+ */
+class BodyDecoder {
+    public:
+        /// Result of Decode
+        enum DecodeResult {
+            DECODE_OK,
+            DECODE_INVALID,
+            DECODE_TOOLARGE
+        };
+
+        /**
+         * Creates a decoder for a Content-Encoding header.
+         * @param encoding The value of the Content-Encoding header.
+         * @return The new decoder, or NULL if the encoding is not supported.
+         */
+        static BodyDecoder *Create(const std::string & encoding);
+
+        /// Destructor
+        ~BodyDecoder();
+
+        /**
+         * Sets the limits, which are checked by Decode.
+         * @param maxsize The maximum size of the decoded data, 0 = unlimited.
+         * @param maxratio The maximum ratio between decoded and encoded size, 0 = unlimited.
+         */
+        void SetLimits(size_t maxsize, size_t maxratio)
+        {
+            m_nMaxSize = maxsize;
+            m_nMaxRatio = maxratio;
+        }
+
+        /**
+         * Decodes a piece of the encoded body.
+         * @param data The encoded data.
+         * @param len The length of the encoded data.
+         * @param out Receives the decoded data (appended).
+         * @return DECODE_INVALID, if the data is corrupt,
+         *   DECODE_TOOLARGE, if a limit has been exceeded.
+         */
+        DecodeResult Decode(const char *data, size_t len, std::string & out);
+
+        /// returns whether the end of the compressed stream has been reached
+        bool Finished() const { return m_bFinished; }
+
+        /// the decoded size below which the ratio limit is not checked
+        static const size_t MIN_RATIO_CHECK = 65536;
+
+    private:
+
+        BodyDecoder();
+
+        BodyDecoder(const BodyDecoder &);
+
+        BodyDecoder & operator=(const BodyDecoder &);
+
+        z_stream m_oStream;
+
+        size_t m_nMaxSize; ///< maximum decoded size, 0 = unlimited
+
+        size_t m_nMaxRatio; ///< maximum ratio of decoded to encoded size, 0 = unlimited
+
+        size_t m_nIn; ///< total number of encoded bytes
+
+        size_t m_nOut; ///< total number of decoded bytes
+
+        bool m_bFinished; ///< Flag: the end of the compressed stream has been reached
+};
+
+#endif
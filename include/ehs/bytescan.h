@@ -0,0 +1,76 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef _BYTESCAN_H_
+#define _BYTESCAN_H_
+
+#include <cstddef>
+
+/*
+ * Scanning kernels used by the request parser and the URL decoder.
+ *
+ * Each function returns a pointer to the first byte in [p, end) that
+ * terminates the respective token, or end if there is none. On x86, the
+ * kernels look at 32 (AVX2) or 16 (SSE2) bytes per step. The variant is
+ * selected once at runtime, with a scalar fallback on other platforms.
+ */
+
+/**
+ * Finds the end of a header value.
+ * @return The first control character other than HT, or DEL.
+ */
+const char *ScanHeaderValue(const char *p, const char *end);
+
+/**
+ * Finds the end of a request URI.
+ * @return The first control character, SP or DEL.
+ */
+const char *ScanUri(const char *p, const char *end);
+
+/**
+ * Finds the end of a header name.
+ * @return The first control character, SP, DEL or colon.
+ */
+const char *ScanHeaderName(const char *p, const char *end);
+
+/**
+ * Finds the end of a line.
+ * @return The first CR or LF.
+ */
+const char *ScanLineEnd(const char *p, const char *end);
+
+/**
+ * Finds the next escape in URL-encoded form data.
+ * @return The first '%' or '+'.
+ */
+const char *ScanUrlEscape(const char *p, const char *end);
+
+/**
+ * Retrieves the name of the kernel variant in use.
+ * @return One of "avx2", "sse2" or "scalar".
+ */
+const char *ByteScanImplementation();
+
+#endif
@@ -0,0 +1,99 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef _CACHEDCLOCK_H_
+#define _CACHEDCLOCK_H_
+
+#include <pthread.h>
+#include <ctime>
+#include <string>
+
+/**
+ * A coarse clock, shared by all threads.
+ * The server loop calls Update on every tick, so that the request
+ * and response paths get the current time and a preformatted
+ * RFC 1123 date without calling the system clock or formatting
+ * dates themselves. The resolution is one second.
+ */
+class CachedClock {
+    public:
+        /**
+         * Reads the system clock. The date string is reformatted
+         * only if a new second has started.
+         */
+        static void Update();
+
+        /**
+         * Retrieves the time of the last update.
+         * @return The current time with a resolution of one update tick.
+         */
+        static time_t Now();
+
+        /**
+         * Retrieves the preformatted date of the last update.
+         * @return The current time as RFC 1123 date, suitable for HTTP headers.
+         */
+        static std::string Date();
+
+        /**
+         * Appends the preformatted date of the last update.
+         * @param out The string to append to.
+         */
+        static void AppendDate(std::string &out);
+
+        /**
+         * Formats an arbitrary timestamp as RFC 1123 date.
+         * This is thread-safe and does not depend on the current locale.
+         * @param stamp The UNIX timestamp to be formatted.
+         * @return The formatted date.
+         */
+        static std::string Format(time_t stamp);
+
+        /**
+         * Parses an RFC 1123 date, as produced by Format.
+         * The obsolete RFC 850 and asctime formats are not supported.
+         * @param date The date to be parsed.
+         * @return The UNIX timestamp or -1, if the date is malformed.
+         */
+        static time_t Parse(const std::string & date);
+
+    private:
+        /// Size of a date buffer, large enough for any value of struct tm's fields
+        enum { DATE_BUFSIZE = 64 };
+
+        /// Formats stamp into buf, which holds len chars.
+        static void Format(time_t stamp, char *buf, size_t len);
+
+        /// Sets s_nNow and s_sDate -- s_oMutex must be locked.
+        static void Set(time_t now);
+
+        static pthread_mutex_t s_oMutex; ///< protects s_nNow and s_sDate
+
+        static time_t s_nNow; ///< the time of the last update
+
+        static char s_sDate[DATE_BUFSIZE]; ///< s_nNow, formatted as RFC 1123 date
+};
+
+#endif // _CACHEDCLOCK_H_
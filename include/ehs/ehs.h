@@ -40,6 +40,7 @@
 #include "datum.h"
 #include "httpresponse.h"
 #include "httprequest.h"
+#include "executor.h"
 
 #include <memory>
 #include <string>
@@ -86,6 +87,150 @@ class RawSocketHandler {
         virtual ~RawSocketHandler ( ) { }
 };
 
+/**
+ * Interface for receiving request bodies while they arrive.
+ * In order to use it, register an instance using SetRequestBodyHandler()
+ * on the top level EHS instance. For every request with a body, OnHeaders
+ * decides whether that body is streamed. A streamed body is handed to
+ * OnBodyData piece by piece as it is received, instead of being collected
+ * in HttpRequest::Body(), so it is not limited by "maxrequestsize" and
+ * needs no memory beyond the connection's input buffer. After OnBodyComplete,
+ * the request is routed to HandleRequest as usual and HttpRequest::BodyStreamed()
+ * returns true. All methods are invoked by the thread that reads from the
+ * network while the connection is locked, so they must not block and must not
+ * call EHSConnection::ResumeReading() themselves.
+ */
+class RequestBodyHandler {
+    public:
+        /**
+         * Handle the headers of a request with a body.
+         * @param request The request whose headers have been parsed.
+         * @return true, if the body should be streamed to this handler,
+         *   false if it should be collected in the request as usual.
+         */
+        virtual bool OnHeaders(HttpRequest *request) = 0;
+
+        /**
+         * Handle a piece of a streamed body.
+         * Chunked transfer encoding has already been removed.
+         * @param request The request to which the data belongs.
+         * @param data The received data. Only valid during this call.
+         * @param len The length of the data.
+         * @return true to continue reading, false to stop reading from the
+         *   connection until EHSConnection::ResumeReading() is called.
+         *   Ignored for the piece that completes the body.
+         */
+        virtual bool OnBodyData(HttpRequest *request, const char *data, size_t len) = 0;
+
+        /**
+         * Handle the end of a streamed body.
+         * @param request The request whose body is complete. It is passed to
+         *   HandleRequest afterwards.
+         */
+        virtual void OnBodyComplete(HttpRequest *request) = 0;
+
+        /**
+         * Handle an incomplete streamed body.
+         * Called, if the request turned out to be malformed or the connection
+         * has been closed before the body was complete.
+         * @param request The request, which is about to be discarded.
+         */
+        virtual void OnBodyAborted(HttpRequest *request) = 0;
+
+        virtual ~RequestBodyHandler ( ) { }
+};
+
+/**
+ * Interface for producing a response body while it is sent.
+ * In order to use it, pass an instance to HttpResponse::SetBodyProducer().
+ * The headers are sent first, then Produce is called repeatedly by the
+ * thread which sends the response. Each piece is sent before the next one
+ * is requested, so a slow client throttles the producer and only one piece
+ * is held in memory at a time. HTTP/1.1 clients receive the body with
+ * Transfer-Encoding: chunked, HTTP/1.0 clients until the connection is closed.
+ */
+class ResponseProducer {
+    public:
+        /**
+         * Produce the next piece of the body.
+         * @param response The response being sent.
+         * @param out Receives the data. It is empty on entry.
+         * @return true, if more data will follow, false if the body is complete.
+         */
+        virtual bool Produce(HttpResponse *response, std::string &out) = 0;
+
+        virtual ~ResponseProducer ( ) { }
+};
+
+/**
+ * Interface for an encoder, which compresses a response body.
+ * Instances are created by a ContentCoding for a single response.
+ */
+class ResponseEncoder {
+    public:
+        /**
+         * Compresses a piece of the body.
+         * Everything that has been passed in must be flushed to out, so that
+         * the pieces of a produced body are not delayed.
+         * @param data The data to be compressed.
+         * @param len The length of the data.
+         * @param finish true, if this is the last piece of the body.
+         * @param out Receives the compressed data (appended).
+         * @return false, if an error occured.
+         */
+        virtual bool Encode(const char *data, size_t len, bool finish, std::string &out) = 0;
+
+        virtual ~ResponseEncoder ( ) { }
+};
+
+/**
+ * Interface for a content coding, which can be negotiated for responses.
+ * gzip and deflate are built in. Further codings (e.g. br or zstd) can be
+ * added with EHS::AddContentCoding().
+ */
+class ContentCoding {
+    public:
+        /**
+         * Retrieves the name of this coding.
+         * @return The name as used in Accept-Encoding and Content-Encoding.
+         */
+        virtual const char *Name() const = 0;
+
+        /**
+         * Creates an encoder for a single response.
+         * @param level The compression level from 1 (fastest) to 9 (best),
+         *   to be mapped to the range of the coding.
+         * @return The new encoder (deleted by the caller) or NULL on error.
+         */
+        virtual ResponseEncoder *CreateEncoder(int level) = 0;
+
+        virtual ~ContentCoding ( ) { }
+};
+
+/// List of additional content codings, in order of preference
+typedef std::list<ContentCoding *> ContentCodingList;
+
+/**
+ * Interface for application timers.
+ * Instances of this class can be scheduled using EHS::ScheduleTimer().
+ * Timers are driven by the server's main loop and do not need any
+ * threads of their own. In threadpool mode, the callbacks are dispatched
+ * onto the server's Executor, otherwise they are invoked by the thread
+ * which runs the server loop (the caller of EHS::HandleData in
+ * singlethreaded mode).
+ */
+class TimerHandler {
+    public:
+        /**
+         * Handle timer expiry.
+         * Called by EHS, whenever a scheduled timer has expired.
+         * @param id The timer Id, as returned by EHS::ScheduleTimer().
+         */
+        virtual void OnTimer(int id) = 0;
+
+        virtual ~TimerHandler ( ) { }
+};
+
 /**
  * Helper class for binding of sockets to privileged ports.
  * This class abstracts an interface to an external bind helper
@@ -139,6 +284,9 @@ class PassphraseHandler {
 /// this is to protect from people being malicious or really stupid
 #define MAX_REQUEST_SIZE_DEFAULT (256 * 1024)
 
+/// default limit for the ratio between decompressed and compressed size of a request body
+#define MAX_INFLATE_RATIO_DEFAULT 100
+
 /**
  * EHS provides HTTP server functionality to a child class.
  * The child class must inherit from it and then override the
@@ -180,9 +328,18 @@ class EHS : public PassphraseHandler {
         /// Our RawSocketHandler
         RawSocketHandler *m_poRawSocketHandler;
 
+        /// Our RequestBodyHandler
+        RequestBodyHandler *m_poRequestBodyHandler;
+
+        /// Our Executor, NULL if the server should create its own
+        Executor *m_poExecutor;
+
         /// Flag: We don't do request routing
         bool m_bNoRouting;
 
+        /// Additional content codings for response compression
+        ContentCodingList m_oContentCodings;
+
     public:
 
         /**
@@ -240,6 +397,20 @@ class EHS : public PassphraseHandler {
          */
         virtual ResponseCode HandleRequest(HttpRequest *request, HttpResponse *response);
 
+        /**
+         * Hook for requests carrying an "Expect: 100-continue" header.
+         * Called on the top-level instance by the thread performing network IO,
+         * after the headers of such a request have been received and before
+         * its body is read, so it must not block.
+         * Reimplement this method in a derived class in order to reject
+         * requests (e.g. unauthorized or too large uploads) before the client
+         * sends the body. The default implementation accepts every request.
+         * @param request Pointer to the HTTP request; only its headers are available.
+         * @returns HTTPRESPONSECODE_100_CONTINUE for receiving the body, otherwise
+         *   the final HTTP response code to be sent before closing the connection.
+         */
+        virtual ResponseCode HandleExpectContinue(HttpRequest *request);
+
         /**
          * Establishes this EHS instance as request handler of another EHS instance.
          * Any HTTP request received by the other EHS instance will be handled by this
@@ -351,6 +522,99 @@ class EHS : public PassphraseHandler {
             return m_poRawSocketHandler;
         }
 
+        /**
+         * Sets a RequestBodyHandler for streaming request bodies.
+         * Must be called on the top level EHS instance before StartServer.
+         * @param handler A pointer to a RequestBodyHandler instance.
+         */
+        void SetRequestBodyHandler(RequestBodyHandler *handler)
+        {
+            m_poRequestBodyHandler = handler;
+        }
+
+        /**
+         * Retrieves our RequestBodyHandler.
+         * @return The current RequestBodyHandler, or NULL if no RequestBodyHandler was set.
+         */
+        RequestBodyHandler * GetRequestBodyHandler() const
+        {
+            return m_poRequestBodyHandler;
+        }
+
+        /**
+         * Adds a content coding for response compression.
+         * Must be called on the top level EHS instance before StartServer.
+         * Added codings are preferred over the built-in gzip and deflate,
+         * if a client accepts them with the same quality.
+         * The caller retains ownership of the coding.
+         * @param coding A pointer to a ContentCoding instance.
+         */
+        void AddContentCoding(ContentCoding *coding)
+        {
+            m_oContentCodings.push_back(coding);
+        }
+
+        /**
+         * Retrieves the added content codings.
+         * @return The list of codings, added by AddContentCoding().
+         */
+        const ContentCodingList & GetContentCodings() const
+        {
+            return m_oContentCodings;
+        }
+
+        /**
+         * Schedules an application timer.
+         * The server must have been started.
+         * @param handler The TimerHandler to be invoked on expiry. It must stay
+         *   valid, until the timer has been cancelled or a one-shot timer has fired.
+         * @param delay The time in milliseconds until the first expiry.
+         * @param interval The period in milliseconds for periodic timers or 0,
+         *   if the timer should fire only once.
+         * @return The Id of the new timer.
+         * @throws std::runtime_error, if the server is not running.
+         */
+        int ScheduleTimer(TimerHandler *handler, unsigned long delay, unsigned long interval = 0);
+
+        /**
+         * Cancels an application timer.
+         * A callback that already has been dispatched onto an Executor,
+         * may still run after this method has returned.
+         * @param id The Id of the timer, as returned by ScheduleTimer().
+         * @return true, if the timer was found and cancelled.
+         */
+        bool CancelTimer(int id);
+
+        /**
+         * Sets an Executor for processing requests in threadpool mode.
+         * Must be called before StartServer. Without an Executor, the
+         * server creates its own ThreadPoolExecutor with "threadcount"
+         * threads. An Executor may be shared between several EHS instances.
+         * Since the threads of such an Executor are not under our control,
+         * ThreadInitHandler() and ThreadExitHandler() are invoked around
+         * each single task instead of once per thread, followed by the
+         * per-thread cleanup of the network layer (e.g. OpenSSL's error
+         * state). The caller retains ownership and must keep the Executor
+         * running, until all servers using it have been stopped.
+         * StopServer waits until all tasks of the server have been
+         * destroyed, so an Executor must delete the tasks, which it
+         * drops without running them (like ThreadPoolExecutor::Stop).
+         * @param executor A pointer to an Executor instance.
+         */
+        void SetExecutor(Executor *executor)
+        {
+            m_poExecutor = executor;
+        }
+
+        /**
+         * Retrieves our Executor.
+         * @return The current Executor, or NULL if no Executor was set.
+         */
+        Executor * GetExecutor() const
+        {
+            return m_poExecutor;
+        }
+
         /**
          * Enqueues a generic response.
          * @param response The response to enqueue
@@ -27,9 +27,16 @@
 #define _EHSCONNECTION_H_
 
 #include "ehstypes.h"
+#include "inputbuffer.h"
+#include "httpresponse.h"
+#include "cachedclock.h"
 
 class EHSServer;
 class NetworkAbstraction;
+class MutexHelper;
+
+/// maximum number of pipelined responses sent with a single gathering write
+#define MAX_RESPONSE_BATCH 16
 
 /**
  * EHSConnection abstracts the concept of a connection to an EHS application.  
@@ -70,7 +77,7 @@ class EHSConnection {
         NetworkAbstraction * m_poNetworkAbstraction;	
 
         /// raw data received from client that doesn't comprise a full request
-        std::string m_sBuffer;
+        InputBuffer m_oInputBuffer;
 
         /// holds out-of-order httpresponses that aren't ready to go out yet
         ResponseQueue m_oResponseQueue;
@@ -92,9 +99,29 @@ class EHSConnection {
 
         size_t m_nMaxRequestSize;
 
-        /// parse form data for content type given here - always if string is empty
+        /// size above which multipart attachments are written to temporary files, 0 = never
+        size_t m_nMultipartSpillSize;
+
+        bool m_bInflateBodies; ///< Flag: decode request bodies with a Content-Encoding of gzip or deflate
+
+        size_t m_nMaxInflatedSize; ///< maximum decoded size of a streamed body, 0 = unlimited
+
+        size_t m_nMaxInflateRatio; ///< maximum ratio between decoded and encoded size, 0 = unlimited
+
+        /// parse form data for content type given here - application/x-www-form-urlencoded if string is empty
         std::string m_sParseContentType;
 
+        bool m_bReadPaused; ///< Flag: a RequestBodyHandler has paused reading
+
+        bool m_bReadResumed; ///< Flag: reading has been resumed, buffered data awaits parsing
+
+        ResponseCode m_nRejectCode; ///< final response code, if ParseInput returns ADDBUFFER_REJECTED
+
+        bool m_bSending; ///< Flag: a thread is sending the responses in m_oResponseQueue
+
+        /// status lines and headers of the responses being sent, reused for every batch
+        std::string m_sSendBuffer;
+
         pthread_mutex_t m_oMutex; ///< mutex protecting entire object
 
     public:
@@ -151,6 +178,27 @@ class EHSConnection {
          */
         void EnableKeepAlive(bool enable = true);
 
+        /**
+         * Resumes reading from this connection.
+         * Reading is paused, if RequestBodyHandler::OnBodyData returns false.
+         * May be called from any thread, but not from within a RequestBodyHandler method.
+         */
+        void ResumeReading();
+
+        /**
+         * Sends an informational (1xx) response ahead of the final
+         * response to a request, e.g. 103 Early Hints with Link headers.
+         * Interim responses are only sent while the request is the only one
+         * being processed on this connection, because responses to earlier
+         * requests must go out first. HTTP/1.0 clients never get any.
+         * @param request The request being handled.
+         * @param code The informational response code.
+         * @param headers The headers to be sent with the interim response.
+         * @return true, if the interim response has been sent.
+         */
+        bool SendInterimResponse(HttpRequest *request, ResponseCode code,
+                const StringCaseMap &headers);
+
     private:
 
         /// Constructor
@@ -161,14 +209,17 @@ class EHSConnection {
         ~EHSConnection();
 
         /// updates the last activity to the current time
-        void UpdateLastActivity() { m_nLastActivity = time(NULL); }
+        void UpdateLastActivity() { m_nLastActivity = CachedClock::Now(); }
 
         /// returns the time of last activity
-        time_t LastActivity() { return m_bIdleHandling ? m_nLastActivity : time(NULL); }
+        time_t LastActivity() { return m_bIdleHandling ? m_nLastActivity : CachedClock::Now(); }
 
         /// returns whether we're still reading from this socket -- mutex must be locked
         bool StillReading() { return !m_bDoneReading; }
 
+        /// returns whether reading has been paused by a RequestBodyHandler
+        bool ReadPaused() const { return m_bReadPaused; }
+
         /// call when no more reads will be performed on this object.
         ///  ibDisconnected is true when client has disconnected
         void DoneReading ( bool ibDisconnected );
@@ -185,12 +236,54 @@ class EHSConnection {
             ADDBUFFER_OK,
             ADDBUFFER_INVALIDREQUEST,
             ADDBUFFER_TOOBIG,
-            ADDBUFFER_NORESOURCE
+            ADDBUFFER_NORESOURCE,
+            ADDBUFFER_REJECTED
         };
 
-        /// adds new data to psBuffer
+        /**
+         * Provides space for reading directly into the input buffer.
+         * @param rnSize Receives the number of bytes that may be read.
+         * @return A pointer to the space to read into.
+         */
+        char *GetReadBuffer(size_t & rnSize);
+
+        /**
+         * Parses data that has been read into the space provided by GetReadBuffer.
+         * @param inSize The number of bytes read.
+         */
+        AddBufferResult AddBuffer(int inSize);
+
+        /// adds new data to the input buffer
         AddBufferResult AddBuffer(char * ipsData, int inSize);
 
+        /**
+         * Parses the data in the input buffer into requests.
+         * @param mh The helper holding our mutex.
+         */
+        AddBufferResult ParseInput(MutexHelper & mh);
+
+        /**
+         * Parses the data left in the input buffer, after reading has been resumed.
+         * @return ADDBUFFER_INVALID, if reading has not been resumed since the last call.
+         */
+        AddBufferResult ParseResumedInput();
+
+        /**
+         * Decides on the expectation of the current request, before its body is read.
+         * Sends 100 Continue, if the top-level EHS accepts the request.
+         * @return ADDBUFFER_REJECTED, if a final response (stored in
+         *   m_nRejectCode) has to be sent instead.
+         */
+        AddBufferResult HandleExpectation();
+
+        /**
+         * Sends an interim response -- mutex must be locked.
+         * @param code The informational response code.
+         * @param headers The headers to be sent with the interim response.
+         * @return true on success.
+         */
+        bool SendInterim(ResponseCode code, const StringCaseMap &headers);
+
         /**
          * Sends the actual data back to the client
          * @param response Pointer to the response to be sent.
@@ -199,6 +292,23 @@ class EHSConnection {
          */ 
         void SendResponse(GenericResponse *response);
 
+        /**
+         * Sends several responses with a single gathering write.
+         * Only the last response may be a non-HTTP response, switch protocols
+         * or have a file body.
+         * @param responses Pointer to an array of responses to be sent in order.
+         * @param count The number of elements in responses (at least 1).
+         * @param head The buffer for serializing the status lines and headers.
+         */
+        void SendResponses(GenericResponse **responses, size_t count, std::string &head);
+
+        /**
+         * Sends the body of a response with a ResponseProducer -- mutex must not be locked.
+         * @param response The response, whose headers have been sent already.
+         * @return 0 on success, -1 if the connection has to be closed.
+         */
+        int SendProduced(HttpResponse *response);
+
         /// returns true of httprequestlist is not empty
         int RequestsPending() { return (0 != m_nActiveRequests) || !m_oHttpRequestList.empty(); }
 
@@ -208,10 +318,28 @@ class EHSConnection {
         /// Sets the maximum request size
         void SetMaxRequestSize(size_t n) { m_nMaxRequestSize = n; }
 
+        /// Sets the size above which multipart attachments are written to temporary files
+        void SetMultipartSpillSize(size_t n) { m_nMultipartSpillSize = n; }
+
+        /**
+         * Configures decoding of compressed request bodies.
+         * @param enable If true, bodies with a Content-Encoding of gzip or deflate are decoded.
+         * @param maxsize The maximum decoded size of a streamed body, 0 = unlimited.
+         * @param maxratio The maximum ratio between decoded and encoded size, 0 = unlimited.
+         */
+        void SetInflateBodies(bool enable, size_t maxsize, size_t maxratio)
+        {
+            m_bInflateBodies = enable;
+            m_nMaxInflatedSize = maxsize;
+            m_nMaxInflateRatio = maxratio;
+        }
+
         /// Sets the content type to parse form data for
         void SetParseContentType(const std::string & s) { m_sParseContentType = s; }
 
         friend class EHSServer;
+        friend class EHSFuzzDriver; ///< parser fuzz harness (fuzz/ehs_fuzz.cpp)
+        friend class EHSBenchmark; ///< microbenchmarks (bench/ehs_bench.cpp)
 };
 
 #endif // _EHSCONNECTION_H_
@@ -26,6 +26,27 @@
 #ifndef _EHSSERVER_H_
 #define _EHSSERVER_H_
 
+#include <map>
+
+#include "responsecompressor.h"
+#include "rangeresponder.h"
+
+/// An application timer, scheduled by EHS::ScheduleTimer
+struct EHSTimer {
+    /// The handler to invoke
+    TimerHandler *handler;
+    /// Time of next expiry in milliseconds (monotonic clock)
+    unsigned long long due;
+    /// Period in milliseconds, 0 for one-shot timers
+    unsigned long interval;
+};
+
+/// Scheduled timers, mapped by Id
+typedef std::map < int, EHSTimer > EHSTimerMap;
+
+/// Timer Ids, ordered by expiry time
+typedef std::multimap < unsigned long long, int > EHSTimerQueue;
+
 /**
  * EHSServer contains all the network related services for EHS.
  * It is responsible for accepting new connections and getting
@@ -89,6 +110,18 @@ class EHSServer {
         /// Returns number of requests pending
         int RequestsPending() const { return m_nRequestsPending; }
 
+        /**
+         * Schedules an application timer.
+         * @see EHS::ScheduleTimer
+         */
+        int AddTimer(TimerHandler *handler, unsigned long delay, unsigned long interval);
+
+        /**
+         * Cancels an application timer.
+         * @see EHS::CancelTimer
+         */
+        bool RemoveTimer(int id);
+
         /**
          * Static pthread worker.
          * Required by pthread as thread routine.
@@ -104,6 +137,55 @@ class EHSServer {
         /// Increments the number of pending requests
         void IncrementRequestsPending() { m_nRequestsPending++; }
 
+        /**
+         * Creates the response for a request.
+         * Interprets the request's body, routes the request to
+         * the appropriate EHS instance, answers conditional and range
+         * requests and compresses the response.
+         * @param request The request to be handled.
+         * @return The response to be sent.
+         */
+        ehs_autoptr<HttpResponse> ProcessRequest(HttpRequest *request);
+
+        /// Dispatches the processing of a pending request onto our Executor
+        void DispatchRequest();
+
+        /**
+         * Passes a task to our Executor. Tasks for an Executor, provided
+         * by the application, are wrapped, so that the thread hooks
+         * of the top level EHS instance are run around each task.
+         * @param task The task to be executed. Ownership is transferred.
+         */
+        void Execute(ExecutorTask *task);
+
+        /// Processes a single pending request. Called by dispatched tasks.
+        void HandleRequestTask();
+
+        /// Decrements m_nTasks. Called by the destructor of dispatched tasks.
+        void TaskDone();
+
+        /**
+         * Calculates the select timeout, taking pending timers into account.
+         * @param timeout The maximum timeout in milliseconds.
+         * @return The timeout in milliseconds until the next timer expires.
+         */
+        int NextTimerTimeout(int timeout);
+
+        /**
+         * Invokes (or dispatches) all expired timers.
+         * @param tid Thread Id of the thread calling this method.
+         */
+        void RunTimers(ehs_threadid_t tid);
+
+        /**
+         * Invokes a timer handler, unless the timer has been cancelled.
+         * Called by dispatched tasks.
+         */
+        void HandleTimerTask(TimerHandler *handler, int id, bool periodic);
+
+        /// Interrupts a pending select() of the server loop
+        void Wakeup();
+
         /**
          * Removes the specified EHSConnection object.
          * @param ipoEHSConnection Pointer to the connection to remove.
@@ -122,6 +204,17 @@ class EHSServer {
         /// check clients that are already connected
         void CheckClientSockets();
 
+        /// parse buffered data of connections on which reading has been resumed
+        void CheckResumedConnections();
+
+        /**
+         * Handles the result of parsing a connection's input.
+         * On errors, sends an error response and stops reading from the connection.
+         * @param ipoConnection The connection whose input has been parsed.
+         * @param inResult The result of the parse.
+         */
+        void HandleAddBufferResult(EHSConnection *ipoConnection, EHSConnection::AddBufferResult inResult);
+
         /// check the listen socket for a new connection
         void CheckAcceptSocket();
 
@@ -181,7 +274,44 @@ class EHSServer {
         /// Thread creation attributes (for setting stack size)
         pthread_attr_t m_oThreadAttr;
 
+        /// Executor for processing requests in threadpool mode
+        Executor *m_poExecutor;
+
+        /// Executor created by ourselves, NULL if an external one is used
+        Executor *m_poOwnExecutor;
+
+        /// Number of tasks dispatched onto m_poExecutor, which have not finished yet
+        int m_nTasks;
+
+        /// Scheduled application timers
+        EHSTimerMap m_oTimers;
+
+        /// Scheduled application timers, ordered by expiry
+        EHSTimerQueue m_oTimerQueue;
+
+        /// Id of the most recently scheduled timer
+        int m_nLastTimerId;
+
+        /// Expiry (monotonic milliseconds) of the currently pending select(), 0 if none
+        unsigned long long m_nSelectDeadline;
+
+        /// Pipe for interrupting select(): read end, write end
+        ehs_socket_t m_aWakeupFds[2];
+
+        /// Flag: generate ETags and answer conditional requests with 304
+        bool m_bConditional;
+
+        /// Byte range requests
+        RangeResponder m_oRanges;
+
+        /// Negotiated compression of response bodies
+        ResponseCompressor m_oCompressor;
+
         friend class EHSConnection;
+        friend class EHSWorkerPool;
+        friend class EHSRequestTask;
+        friend class EHSTimerTask;
+        friend class EHSForeignTask;
 };
 
 #endif // _EHSSERVER_H_
@@ -0,0 +1,173 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+/**
+ * A unit of work, which can be dispatched onto an Executor.
+ */
+class ExecutorTask {
+
+    public:
+
+        /**
+         * Performs the actual work.
+         * Called by the Executor on one of its threads.
+         */
+        virtual void Run() = 0;
+
+        /// Destructor
+        virtual ~ExecutorTask ( ) { }
+};
+
+/**
+ * Interface for running ExecutorTasks on a set of threads.
+ * EHSServer dispatches the processing of HttpRequests onto an
+ * Executor. By default, every server creates its own ThreadPoolExecutor
+ * with "threadcount" threads. Applications running multiple EHS
+ * instances can share a single Executor between all of them by
+ * using EHS::SetExecutor() before starting the servers or they can
+ * implement this interface on top of an existing task system.
+ */
+class Executor {
+
+    public:
+
+        /**
+         * Schedules a task for execution.
+         * The Executor takes ownership of the task and must delete
+         * it, after its Run method has returned. Tasks, which are
+         * never run (e.g. when stopping), must be deleted as well.
+         * This method should not block until the task has been run.
+         * @param task The task to be run.
+         */
+        virtual void Execute(ExecutorTask *task) = 0;
+
+        /// Destructor
+        virtual ~Executor ( ) { }
+};
+
+/**
+ * Default implementation of the Executor interface.
+ * Runs tasks in FIFO order on a fixed number of threads.
+ */
+class ThreadPoolExecutor : public Executor {
+
+    private:
+
+        ThreadPoolExecutor(const ThreadPoolExecutor &);
+
+        ThreadPoolExecutor & operator=(const ThreadPoolExecutor &);
+
+    public:
+
+        /**
+         * Constructs a new instance and starts its threads.
+         * @param threads The number of threads to start. With 0 (or less),
+         *   no threads are started and tasks are not run, until Start()
+         *   has been called.
+         * @param stacksize The minimum stack size of the threads.
+         *   If 0, the system default is used.
+         * @throws A std::runtime_error, if a thread could not be created.
+         */
+        ThreadPoolExecutor(int threads = 1, size_t stacksize = 0);
+
+        /**
+         * Destructor.
+         * Stops all threads. Tasks which have not been run yet are discarded.
+         */
+        virtual ~ThreadPoolExecutor();
+
+        virtual void Execute(ExecutorTask *task);
+
+        /**
+         * Retrieves the number of threads in this pool.
+         * @return The number of running threads.
+         */
+        int ThreadCount() const { return static_cast<int>(m_oThreads.size()); }
+
+    protected:
+
+        /**
+         * Hook for thread startup.
+         * Called at the start of each pool thread. The default
+         * implementation does nothing.
+         * @return true, if the thread should start processing tasks.
+         */
+        virtual bool ThreadInitHandler() { return true; }
+
+        /**
+         * Hook for thread shutdown.
+         * Called just before a pool thread terminates. The default
+         * implementation does nothing.
+         */
+        virtual void ThreadExitHandler() { }
+
+        /**
+         * Starts the threads of this pool.
+         * Called by the constructor, unless its thread count is 0. Derived classes which override the thread
+         * hooks must pass 0 as thread count to the base constructor, call this
+         * method from their own constructor and call Stop() from their own
+         * destructor. Otherwise, the hooks might run on a partially constructed
+         * (or already destroyed) instance.
+         * @param threads The number of threads to start. Values less
+         *   than 1 are treated as 1.
+         * @param stacksize The minimum stack size of the threads.
+         */
+        void Start(int threads, size_t stacksize);
+
+        /// Stops and joins all threads. Tasks not yet run are discarded.
+        void Stop();
+
+    private:
+
+        /// Thread routine
+        static void *ThreadStub(void *ipData);
+
+        /// The worker loop of a single thread
+        void Worker();
+
+        /// Tasks waiting to be run
+        std::deque<ExecutorTask *> m_oTasks;
+
+        /// Our threads
+        std::vector<pthread_t> m_oThreads;
+
+        /// Mutex protecting the task queue
+        pthread_mutex_t m_oMutex;
+
+        /// Condition for signalling new tasks or termination
+        pthread_cond_t m_oCond;
+
+        /// Flag: Threads should terminate
+        bool m_bStopping;
+};
+
+#endif // EXECUTOR_H
@@ -49,6 +49,14 @@ class FormValue {
         /// the body of the value.  For non-MIME-style attachments, this is the only part used.
         std::string m_sBody; 
 
+        /**
+         * For MIME attachments only: the name of a temporary file holding the body.
+         * Set instead of m_sBody, if the attachment was larger than "multipartspillsize".
+         * The file is removed together with the HttpRequest, unless it has been
+         * renamed or this member has been cleared.
+         */
+        std::string m_sTempFile;
+
         /// Default constructor
         FormValue();
 
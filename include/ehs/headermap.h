@@ -0,0 +1,214 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef HEADERMAP_H
+#define HEADERMAP_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/**
+ * Well known HTTP headers.
+ * These can be accessed in constant time in a HeaderMap.
+ */
+enum KnownHeader {
+    HEADER_ACCEPT = 0,
+    HEADER_ACCEPT_CHARSET,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_ACCEPT_RANGES,
+    HEADER_AUTHORIZATION,
+    HEADER_CACHE_CONTROL,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_DISPOSITION,
+    HEADER_CONTENT_ENCODING,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_RANGE,
+    HEADER_CONTENT_TYPE,
+    HEADER_COOKIE,
+    HEADER_DATE,
+    HEADER_ETAG,
+    HEADER_EXPECT,
+    HEADER_HOST,
+    HEADER_IF_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_RANGE,
+    HEADER_LAST_MODIFIED,
+    HEADER_LOCATION,
+    HEADER_RANGE,
+    HEADER_REFERER,
+    HEADER_SERVER,
+    HEADER_SET_COOKIE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_UPGRADE,
+    HEADER_USER_AGENT,
+    HEADER_VARY,
+    HEADER_SEC_WEBSOCKET_KEY,
+    HEADER_COUNT, ///< Number of well known headers
+    HEADER_UNKNOWN = HEADER_COUNT ///< Returned by HeaderMap::Lookup for other headers
+};
+
+/**
+ * Case insensitive string => string map for HTTP headers.
+ * Entries are stored in a flat vector in the order of their insertion.
+ * Well known headers are identified by a perfect hash and their
+ * position is kept in a small index, so that finding them does not
+ * require any string comparisons. Other headers are found by a
+ * linear search in small maps and through a hash index of all
+ * entries in larger ones, so that many distinct header names don't
+ * make parsing a request quadratic. The interface mimics the parts of std::map
+ * that are commonly used with headers. Like with std::vector,
+ * insertions and removals invalidate iterators and references.
+ */
+class HeaderMap {
+
+    public:
+
+        typedef std::string key_type;
+        typedef std::string mapped_type;
+        typedef std::pair<std::string, std::string> value_type;
+        typedef std::vector<value_type>::iterator iterator;
+        typedef std::vector<value_type>::const_iterator const_iterator;
+        typedef std::vector<value_type>::size_type size_type;
+
+        /// Default constructor
+        HeaderMap();
+
+        iterator begin() { return m_oFields.begin(); }
+
+        const_iterator begin() const { return m_oFields.begin(); }
+
+        iterator end() { return m_oFields.end(); }
+
+        const_iterator end() const { return m_oFields.end(); }
+
+        size_type size() const { return m_oFields.size(); }
+
+        bool empty() const { return m_oFields.empty(); }
+
+        /// Removes all entries.
+        void clear();
+
+        /**
+         * Finds a header by name (case insensitive).
+         * @param name The name of the header to find.
+         * @return An iterator to the header or end(), if not found.
+         */
+        iterator find(const std::string & name);
+
+        /// @copydoc find(const std::string &)
+        const_iterator find(const std::string & name) const;
+
+        /**
+         * Finds a well known header.
+         * @param header The header to find.
+         * @return An iterator to the header or end(), if not found.
+         */
+        iterator find(KnownHeader header);
+
+        /// @copydoc find(KnownHeader)
+        const_iterator find(KnownHeader header) const;
+
+        /**
+         * Counts the entries with a given name.
+         * @param name The name of the header.
+         * @return 1, if the header exists, 0 otherwise.
+         */
+        size_type count(const std::string & name) const { return (end() == find(name)) ? 0 : 1; }
+
+        /**
+         * Accesses a header value, inserting an empty value if necessary.
+         * @param name The name of the header.
+         * @return A reference to the header's value.
+         */
+        std::string & operator[](const std::string & name);
+
+        /**
+         * Inserts an entry, unless a header with the same name exists.
+         * @param value The name/value pair to insert.
+         * @return An iterator to the entry with that name and true, if it was inserted.
+         */
+        std::pair<iterator, bool> insert(const value_type & value);
+
+        /**
+         * Removes an entry.
+         * @param pos An iterator to the entry to remove.
+         */
+        void erase(iterator pos);
+
+        /**
+         * Removes a header by name.
+         * @param name The name of the header to remove.
+         * @return The number of removed entries.
+         */
+        size_type erase(const std::string & name);
+
+        /**
+         * Identifies a well known header.
+         * @param name The header name (case insensitive).
+         * @param len The length of the header name.
+         * @return The corresponding KnownHeader or HEADER_UNKNOWN.
+         */
+        static KnownHeader Lookup(const char *name, size_t len);
+
+        /**
+         * Retrieves the canonical name of a well known header.
+         * @param header The header.
+         * @return The name of the header.
+         */
+        static const char *Name(KnownHeader header);
+
+    private:
+
+        /// Appends a new entry and updates the index.
+        iterator Append(const std::string & name, const std::string & value, KnownHeader known);
+
+        /// Search for a header which is not well known.
+        size_type FindOther(const std::string & name) const;
+
+        /// Adds the entry at pos to m_oIndex.
+        void IndexField(size_type pos) const;
+
+        /// (Re)builds m_oIndex for all entries.
+        void BuildIndex() const;
+
+        /// The headers in order of insertion.
+        std::vector<value_type> m_oFields;
+
+        /**
+         * Open addressing hash table over the names of all entries:
+         * Their position in m_oFields plus one or 0 for a free slot.
+         * Built on demand, once the map holds more than a few entries.
+         */
+        mutable std::vector<unsigned int> m_oIndex;
+
+        /// For each well known header: Its position in m_oFields plus one or 0, if absent.
+        unsigned int m_aKnown[HEADER_COUNT];
+};
+
+#endif // HEADERMAP_H
@@ -30,6 +30,19 @@
 # pragma warning(disable : 4786)
 #endif
 
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+class InputBuffer;
+class RequestBodyHandler;
+class BodyDecoder;
+class MultipartParser;
+
+/// Maps decoded form element names to their decoded values
+typedef std::map<std::string, const std::string *> ParamMap;
+
 /// UNKNOWN must be the last one, as these must match up with RequestMethodStrings *exactly*
 enum RequestMethod {
     REQUESTMETHOD_OPTIONS, /* not implemented */
@@ -43,6 +56,15 @@ enum RequestMethod {
     REQUESTMETHOD_UNKNOWN ///< used until we find the method
 };
 
+/// Tokens of the Connection, Upgrade and Transfer-Encoding headers
+enum HeaderToken {
+    HEADERTOKEN_CONNECTION_CLOSE = 0x01,
+    HEADERTOKEN_CONNECTION_KEEPALIVE = 0x02,
+    HEADERTOKEN_CONNECTION_UPGRADE = 0x04,
+    HEADERTOKEN_UPGRADE_WEBSOCKET = 0x08,
+    HEADERTOKEN_TRANSFERENCODING_CHUNKED = 0x10
+};
+
 /**
  * This class represents a clients HTTP request.
  * It contans pre-parsed data like cookies, form data and
@@ -56,7 +78,8 @@ class HttpRequest {
          * Constructs a ne instance.
          * @param inRequestId A unique Id (normally incremented by EHS).
          * @param ipoSourceEHSConnection The connection on which this request was received.
-         * @param irsParseContentType Content type to parse form data for, empty string to always parse
+         * @param irsParseContentType Content type of bodies to parse form data from.
+         *   An empty string selects application/x-www-form-urlencoded, "*" selects any type.
          */
         HttpRequest (int inRequestId, EHSConnection *ipoSourceEHSConnection,
             const std::string & irsParseContentType);
@@ -142,6 +165,12 @@ class HttpRequest {
          */
         const std::string &Uri() const { return m_sUri; }
 
+        /**
+         * Retrieves the complete URI of this request, before any
+         * part of it has been consumed by routing.
+         */
+        const std::string &OriginalUri() const { return m_sOriginalUri; }
+
         /**
          * Retrieves the HTTP version.
          * @return The HTTP version string as received in the request header.
@@ -150,10 +179,25 @@ class HttpRequest {
 
         /**
          * Retrieves this request's body.
+         * A multipart/form-data body is parsed into FormValues while it
+         * is received, so it is not available here.
          * @return The body content of this request.
          */
         const std::string &Body() const { return m_sBody; }
 
+        /**
+         * Retrieves the trailer fields of a chunked request body.
+         * @return The trailer fields, if any.
+         */
+        const StringCaseMap &Trailers() const { return m_oTrailers; }
+
+        /**
+         * Retrieves the body streaming status.
+         * @return true if the body has been passed to a RequestBodyHandler
+         *   instead of being stored in Body().
+         */
+        bool BodyStreamed() const { return m_bBodyStreamed; }
+
         /**
          * Retrieves HTTP headers.
          * @return A StringCaseMap of the HTTP headers from this request.
@@ -162,15 +206,25 @@ class HttpRequest {
 
         /**
          * Retrieves form values.
+         * Form data from the URI and the body is parsed on the first call.
          * @return All form values of this request.
          */
-        FormValueMap &FormValues() { return m_oFormValueMap; }
+        FormValueMap &FormValues()
+        {
+            ParseFormValues();
+            return m_oFormValueMap;
+        }
 
         /**
          * Retrieves cookies.
+         * The Cookie header is parsed on the first call.
          * @return All cookies of this request.
          */
-        CookieMap &Cookies() { return m_oCookieMap; }
+        CookieMap &Cookies()
+        {
+            ParseCookies();
+            return m_oCookieMap;
+        }
 
         /**
          * Retrieves a specific form value.
@@ -179,6 +233,7 @@ class HttpRequest {
          */
         FormValue &FormValues(const std::string & name)
         {
+            ParseFormValues();
             return m_oFormValueMap[name];
         }
 
@@ -195,6 +250,14 @@ class HttpRequest {
             return std::string();
         }
 
+        /**
+         * Checks for a token in the Connection, Upgrade or Transfer-Encoding header.
+         * The tokens are determined once, when the request's headers are parsed.
+         * @param token The token to check for.
+         * @return true, if the received request contained the token.
+         */
+        bool HasHeaderToken(HeaderToken token) const { return 0 != (m_nHeaderTokens & token); }
+
         /**
          * Sets a single request header.
          * This method is intended for generating synthetic headers (for
@@ -214,12 +277,58 @@ class HttpRequest {
          */
         std::string Cookies(const std::string & name)
         {
+            ParseCookies();
             if (m_oCookieMap.find(name) != m_oCookieMap.end()) {
                 return m_oCookieMap[name];
             }
             return std::string();
         }
 
+        /**
+         * Retrieves all form values in decoded form.
+         * Names and values from the URI or an URL-encoded body are
+         * percent-decoded once per request. Values without escapes
+         * are not copied, multipart values are returned as they are.
+         * The pointers remain valid until the request is destroyed
+         * or the form values are modified.
+         * @return All decoded form values of this request.
+         */
+        const ParamMap &Params();
+
+        /**
+         * Retrieves a specific form value in decoded form.
+         * @param name The decoded name of the form element to be retrieved.
+         * @return The decoded value or NULL, if there is no such form element.
+         */
+        const std::string *Param(const std::string & name);
+
+        /**
+         * Retrieves a specific form value as integer.
+         * @param name The decoded name of the form element to be retrieved.
+         * @param value Receives the value.
+         * @return true, if the form element exists and is a complete decimal integer.
+         */
+        bool ParamInt(const std::string & name, long long & value);
+
+        /**
+         * Retrieves a specific form value as floating point number.
+         * @param name The decoded name of the form element to be retrieved.
+         * @param value Receives the value.
+         * @return true, if the form element exists and is a complete number.
+         */
+        bool ParamDouble(const std::string & name, double & value);
+
+        /**
+         * Decodes URL-encoded form data.
+         * Percent escapes are decoded and '+' is translated into a space.
+         * Malformed escapes are kept literally.
+         * @param irsString The string to decode.
+         * @param rsDecoded Receives the decoded string. Left untouched,
+         *   if irsString contains no escapes.
+         * @return false, if irsString contains no escapes.
+         */
+        static bool UrlDecode(const std::string & irsString, std::string & rsDecoded);
+
     private:
 
         /// Disable copy constructor
@@ -228,8 +337,21 @@ class HttpRequest {
         /// Disable = operator
         HttpRequest & operator=(const HttpRequest &);
 
-        /// Interprets the given string as if it's name=value pairs and puts them into oFormElements
-        void GetFormDataFromString(const std::string &irsString);
+        /**
+         * Interprets the given string as if it's name=value pairs and puts them into m_oFormValueMap.
+         * @param irsString The string to parse.
+         * @param overwrite If false, existing form values are not replaced.
+         */
+        void GetFormDataFromString(const std::string &irsString, bool overwrite = true);
+
+        /// Parses form data from the URI and the body, unless already done.
+        void ParseFormValues();
+
+        /// Parses the Cookie header, unless already done.
+        void ParseCookies();
+
+        /// Checks, whether the body's content type is selected for form data parsing.
+        bool IsFormContentType();
 
         /// Enumeration for the state of the current HTTP parsing
         enum HttpParseStates {
@@ -237,13 +359,53 @@ class HttpRequest {
             HTTPPARSESTATE_REQUEST,
             HTTPPARSESTATE_HEADERS,
             HTTPPARSESTATE_BODY,
-            HTTPPARSESTATE_BODYCHUNK,
-            HTTPPARSESTATE_BODYTRAILER,
-            HTTPPARSESTATE_BODYTRAILER2,
             HTTPPARSESTATE_COMPLETEREQUEST,
             HTTPPARSESTATE_INVALIDREQUEST
         };
 
+        /// Enumeration for the byte level position of the request scanner
+        enum HttpScanStates {
+            HTTPSCAN_REQUESTSTART = 0,
+            HTTPSCAN_EMPTYLINELF,
+            HTTPSCAN_METHOD,
+            HTTPSCAN_URI,
+            HTTPSCAN_VERSIONPREFIX,
+            HTTPSCAN_VERSIONMAJOR,
+            HTTPSCAN_VERSIONMINOR,
+            HTTPSCAN_REQUESTLINELF,
+            HTTPSCAN_HEADERSTART,
+            HTTPSCAN_HEADERNAME,
+            HTTPSCAN_HEADERWS,
+            HTTPSCAN_HEADERVALUE,
+            HTTPSCAN_HEADERLF,
+            HTTPSCAN_HEADERSENDLF,
+            HTTPSCAN_BODY,
+            HTTPSCAN_CHUNKSIZE,
+            HTTPSCAN_CHUNKEXT,
+            HTTPSCAN_CHUNKSIZELF,
+            HTTPSCAN_CHUNKDATA,
+            HTTPSCAN_CHUNKDATACR,
+            HTTPSCAN_CHUNKDATALF,
+            HTTPSCAN_TRAILERSTART,
+            HTTPSCAN_TRAILER,
+            HTTPSCAN_TRAILERLF,
+            HTTPSCAN_TRAILERSENDLF,
+            HTTPSCAN_DONE
+        };
+
+        /**
+         * Location of a received header line within the input buffer.
+         * Header lines are recorded as offsets while scanning and are
+         * only copied into m_oRequestHeaders once the header block is complete.
+         * A zero name length denotes a continuation line.
+         */
+        struct HeaderField {
+            size_t name;
+            size_t namelen;
+            size_t value;
+            size_t valuelen;
+        };
+
         /// Enumeration of error codes for ParseMultipartFormDataResult
         enum ParseMultipartFormDataResult { 
             PARSEMULTIPARTFORMDATA_INVALID = 0,
@@ -251,26 +413,84 @@ class HttpRequest {
             PARSEMULTIPARTFORMDATA_FAILED 
         };
 
-        /// Enumeration of error codes for ParseSubbody
-        enum ParseSubbodyResult {
-            PARSESUBBODY_INVALID = 0,
-            PARSESUBBODY_SUCCESS,
-            PARSESUBBODY_INVALIDSUBBODY, // no blank line?
-            PARSESUBBODY_FAILED // other reason
-        };
-
-        /// treats the body as if it's a multipart form data as specified in RFC not sure what the number is and I'll probably forget to look it up
+        /// treats the body as multipart form data as specified in RFC 2046 and RFC 7578
         ParseMultipartFormDataResult ParseMultipartFormData();
 
         /**
-         * Goes through a subbody and parses out elements.
-         * @param sSubBody The string in which to look for subbody stuff
-         * @return A ParseSubbodyResult reflecting the result.
+         * Scans data received from the client.
+         * This is a resumable byte level state machine: Each invocation
+         * continues at the position where the previous one stopped, so
+         * no byte is looked at twice. Data belonging to this request is
+         * consumed from the buffer when the header block, a chunk of the body
+         * or the whole request has been handled.
+         * @param ioBuffer The connection's input buffer.
+         * @return The resulting parse state.
+         */
+        HttpParseStates ParseData(InputBuffer & ioBuffer);
+
+        /**
+         * Copies the recorded header lines into m_oRequestHeaders
+         * and determines how the body (if any) is framed.
+         * @param data The unconsumed data of the connection's input buffer.
+         * @return false, if the header block is invalid.
          */
-        ParseSubbodyResult ParseSubbody(std::string sSubBody);
+        bool ProcessHeaders(const char *data);
 
-        /// this function is given data that is read from the client and it deals with it
-        HttpParseStates ParseData(std::string & irsData);
+        /**
+         * Prepares for receiving the body, once the headers are processed
+         * (and any expectation has been met): offers the body to the
+         * RequestBodyHandler and checks its size.
+         * @return false, if the body is too large.
+         */
+        bool BeginBody();
+
+        /**
+         * Handles a piece of the body: decodes it, if it has a Content-Encoding,
+         * and appends it to m_sBody, feeds it to m_poMultipart or passes it
+         * to the RequestBodyHandler.
+         * @return false, if the body is invalid or too large.
+         */
+        bool AddBodyData(const char *data, size_t len);
+
+        /**
+         * Feeds a piece of a multipart body to m_poMultipart,
+         * unless parsing has failed already.
+         */
+        void FeedMultipart(const char *data, size_t len);
+
+        /**
+         * Finishes a body, once all of its data has been handled by AddBodyData.
+         * Finishes parsing a multipart body.
+         * @return false, if a compressed body is truncated.
+         */
+        bool CompleteBody();
+
+        /**
+         * Passes a piece of a streamed body to the RequestBodyHandler.
+         * Sets m_bPauseReading, if the handler wants to pause reading.
+         */
+        void StreamBodyData(const char *data, size_t len);
+
+        /// Notifies the RequestBodyHandler about the end of a streamed body.
+        void CompleteStreamedBody();
+
+        /**
+         * Stores a trailer field of a chunked body.
+         * @param line The start of the field line.
+         * @param end The end of the field line (the CR).
+         * @return false, if the field is malformed.
+         */
+        bool AddTrailer(const char *line, const char *end);
+
+        /**
+         * Interprets the multipart body of a complete request.
+         * ParseData only frames the request, so that this potentially expensive
+         * work is done by the thread that handles the request instead of
+         * the thread performing network IO. Other form data is parsed
+         * on demand by FormValues().
+         * @return false, if the body is malformed.
+         */
+        bool ParseBody();
 
         /// takes the cookie header and breaks it down into usable chunks -- returns number of name/value pairs found
         int ParseCookieData (std::string & irsData);
@@ -293,9 +513,6 @@ class HttpRequest {
         /// Binary data, not NULL terminated
         std::string m_sBody; 
 
-        /// Name of last HTTP header seen.
-        std::string m_sLastHeaderName;
-
         /// whether or not this came over secure channels
         bool m_bSecure;
 
@@ -314,15 +531,108 @@ class HttpRequest {
         /// connection object from which this request came
         EHSConnection * m_poSourceEHSConnection;
 
+        /// the current position of the byte level scanner
+        HttpScanStates m_nScanState;
+
+        /// offset of the next unscanned byte, relative to the unconsumed input
+        size_t m_nParseOffset;
+
+        /// offset of the token currently being scanned
+        size_t m_nTokenStart;
+
+        /// number of bytes matched in the current fixed-length token
+        size_t m_nScanCount;
+
+        /// header lines seen so far
+        std::vector<HeaderField> m_oHeaderFields;
+
+        /// HeaderToken flags found in the request headers
+        unsigned int m_nHeaderTokens;
+
         bool m_bChunked;
 
         size_t m_nChunkLen;
 
-        /// content-type to parse form data for. if empty, always parse
+        /// value of the Content-Length header
+        size_t m_nContentLength;
+
+        /// content-type to parse form data for. if empty, application/x-www-form-urlencoded
         std::string m_sParseContentType;
 
+        /// Flag: The body has been interpreted by ParseBody (or there is none)
+        bool m_bBodyParsed;
+
+        /// Flag: m_oFormValueMap contains the form data from URI and body
+        bool m_bFormValuesParsed;
+
+        /// Flag: m_oCookieMap contains the cookies from the Cookie header
+        bool m_bCookiesParsed;
+
+        /// Decoded form values, built by Params()
+        ParamMap m_oParamMap;
+
+        /// Storage for decoded strings referenced by m_oParamMap
+        std::deque<std::string> m_oDecodedParams;
+
+        /// Flag: m_oParamMap has been built
+        bool m_bParamsDecoded;
+
+        /// Handler offered or receiving the streamed body, NULL once it has been notified of the end
+        RequestBodyHandler *m_poBodyHandler;
+
+        /// Flag: The body is passed to m_poBodyHandler
+        bool m_bBodyStreamed;
+
+        /// size above which multipart attachments are written to temporary files, 0 = never
+        size_t m_nMultipartSpillSize;
+
+        /// Flag: m_poBodyHandler asked to pause reading from the connection
+        bool m_bPauseReading;
+
+        /// trailer fields of a chunked body
+        StringCaseMap m_oTrailers;
+
+        /// maximum size of a body that is not streamed (after removing the chunked encoding)
+        size_t m_nMaxBodySize;
+
+        /// Flag: the request is invalid, because its body exceeds m_nMaxBodySize
+        bool m_bBodyTooLarge;
+
+        /// Flag: the request has an Expect header, reading the body waits for EHSConnection's decision
+        bool m_bExpectPending;
+
+        /// Flag: decode bodies with a Content-Encoding of gzip or deflate
+        bool m_bInflateBody;
+
+        /// maximum decoded size of a streamed body, 0 = unlimited
+        size_t m_nMaxInflatedSize;
+
+        /// maximum ratio between decoded and encoded size of a body, 0 = unlimited
+        size_t m_nMaxInflateRatio;
+
+        /// decoder of the body's Content-Encoding, if any
+        BodyDecoder *m_poDecoder;
+
+        /// decoded data of a streamed body, not yet passed to m_poBodyHandler
+        std::string m_sDecoded;
+
+        /// Flag: the request is invalid, because its Content-Encoding is not supported
+        bool m_bUnsupportedEncoding;
+
+        /// parser of a multipart body, fed while the body is received instead of collecting m_sBody
+        MultipartParser *m_poMultipart;
+
+        /// number of (decoded) body bytes fed to m_poMultipart
+        size_t m_nMultipartLength;
+
+        /// outcome of parsing a multipart body with m_poMultipart, PARSEMULTIPARTFORMDATA_INVALID if not done yet
+        ParseMultipartFormDataResult m_nMultipartResult;
+
         friend class EHSConnection;
+        friend class EHSServer;
         friend class EHS;
+        friend class EHSFuzzDriver; ///< parser fuzz harness (fuzz/ehs_fuzz.cpp)
+        friend class EHSBenchmark; ///< microbenchmarks (bench/ehs_bench.cpp)
 };
 
 
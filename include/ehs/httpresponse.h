@@ -28,11 +28,16 @@
 
 #include "ehstypes.h"
 
+class ResponseProducer;
+
 /// different response codes and their corresponding phrases -- defined in EHS.cpp
 enum ResponseCode {
     HTTPRESPONSECODE_INVALID = 0,
+    HTTPRESPONSECODE_100_CONTINUE = 100,
     HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS = 101,
+    HTTPRESPONSECODE_103_EARLYHINTS = 103,
     HTTPRESPONSECODE_200_OK = 200,
+    HTTPRESPONSECODE_206_PARTIAL_CONTENT = 206,
     HTTPRESPONSECODE_301_MOVEDPERMANENTLY = 301,
     HTTPRESPONSECODE_302_FOUND = 302,
     HTTPRESPONSECODE_304_NOT_MODIFIED = 304,
@@ -40,7 +45,11 @@ enum ResponseCode {
     HTTPRESPONSECODE_401_UNAUTHORIZED = 401,
     HTTPRESPONSECODE_403_FORBIDDEN = 403,
     HTTPRESPONSECODE_404_NOTFOUND = 404,
+    HTTPRESPONSECODE_405_METHOD_NOT_ALLOWED = 405,
     HTTPRESPONSECODE_413_TOOLARGE = 413,
+    HTTPRESPONSECODE_415_UNSUPPORTEDMEDIATYPE = 415,
+    HTTPRESPONSECODE_416_RANGE_NOT_SATISFIABLE = 416,
+    HTTPRESPONSECODE_417_EXPECTATIONFAILED = 417,
     HTTPRESPONSECODE_426_UPGRADE_REQUIRED = 426,
     HTTPRESPONSECODE_500_INTERNALSERVERERROR = 500,
     HTTPRESPONSECODE_503_SERVICEUNAVAILABLE = 503
@@ -50,6 +59,9 @@ enum ResponseCode {
  * This class represents what is sent back to the client.
  * It contains the actual body, any headers specified,
  * and the response code.
+ * The default headers (Date, Last-Modified, Cache-Control, Content-Type
+ * and Content-Length) are not stored, but added when the response
+ * is sent, unless they have been set explicitly or switched off.
  */
 class HttpResponse : public GenericResponse {
 
@@ -58,6 +70,16 @@ class HttpResponse : public GenericResponse {
         HttpResponse &operator = (const HttpResponse &);
 
     public:
+        /// Flags for the default headers, see SetDefaultHeaders.
+        enum DefaultHeader {
+            DEFAULT_DATE = 1, ///< Date: the current time
+            DEFAULT_LAST_MODIFIED = 2, ///< Last-Modified: the current time
+            DEFAULT_CACHE_CONTROL = 4, ///< Cache-Control: no-cache
+            DEFAULT_CONTENT_TYPE = 8, ///< Content-Type: text/html
+            DEFAULT_CONTENT_LENGTH = 16, ///< Content-Length: the length of the body
+            DEFAULT_ALL = 31 ///< All of the above (initial setting)
+        };
+
         /**
          * Constructs a new instance.
          * @param inResponseId A unique Id (normally derived from the corresponding request Id).
@@ -91,8 +113,16 @@ class HttpResponse : public GenericResponse {
          */
         static const char *GetPhrase(ResponseCode code);
 
+        /**
+         * Appends the status line (including CRLF) for a response code.
+         * The status lines of all known response codes are precomputed.
+         * @param code The response code.
+         * @param out The string to append to.
+         */
+        static void AppendStatusLine(ResponseCode code, std::string &out);
+
         /// Destructor
-        virtual ~HttpResponse ( ) { }
+        virtual ~HttpResponse ( );
 
         /**
          * Sets the body of this instance.
@@ -102,6 +132,76 @@ class HttpResponse : public GenericResponse {
          */
         void SetBody(const char *ipsBody, size_t inBodyLength);
 
+        /**
+         * Sets a file as the body of this instance. The file is not read
+         * into memory, but sent with sendfile() where possible.
+         * Also sets the Last-Modified header to the modification time of the file.
+         * @param path The name of the file.
+         * @return false, if the file could not be opened or is not a regular file.
+         */
+        bool SetBodyFile(const std::string & path);
+
+        /**
+         * Sets a part of an open file as the body of this instance.
+         * The response takes ownership of the file descriptor and closes it.
+         * @param fd The file descriptor of the file.
+         * @param offset The offset of the first byte to send.
+         * @param length The number of bytes to send.
+         */
+        void SetBodyFile(int fd, off_t offset, size_t length);
+
+        /**
+         * Sets a producer, which generates the body while it is sent.
+         * The response takes ownership of the producer and deletes it.
+         * Unless a Content-Length header is set explicitly, the body is sent
+         * chunked to HTTP/1.1 clients and delimited by closing the connection
+         * otherwise.
+         * @param producer The producer of the body.
+         */
+        void SetBodyProducer(ResponseProducer *producer);
+
+        /// Retrieves the producer of the body or NULL.
+        ResponseProducer *GetBodyProducer() const { return m_poProducer; }
+
+        /**
+         * Determines, whether the body is sent with chunked transfer encoding.
+         * @return true, if a producer is set and neither an explicit Content-Length
+         *   nor an HTTP/1.0 client prevents chunking.
+         */
+        bool IsChunked() const;
+
+        /**
+         * Determines, whether the end of the body is signalled by closing the connection.
+         * @return true, if a producer is set for an HTTP/1.0 client without an explicit Content-Length.
+         */
+        bool IsCloseDelimited() const;
+
+        /**
+         * Determines, whether the body of this instance is a file.
+         * @return true, if SetBodyFile has been used.
+         */
+        bool HasBodyFile() const { return (-1 != m_nBodyFd); }
+
+        /**
+         * Determines, whether this is the response to a HEAD request.
+         * Such responses are sent with all headers, including Content-Length,
+         * but without the body.
+         * @return true, if the body is not sent.
+         */
+        bool IsHeadOnly() const { return m_bHeadOnly; }
+
+        /// Retrieves the file descriptor of a file body or -1.
+        int GetBodyFd() const { return m_nBodyFd; }
+
+        /// Retrieves the offset of the first byte of a file body.
+        off_t GetBodyFileOffset() const { return m_nBodyFileOffset; }
+
+        /**
+         * Retrieves the length of the body.
+         * @return The length of the file body, if set. Otherwise the length of the body.
+         */
+        size_t BodyLength() const { return HasBodyFile() ? m_nBodyFileLength : m_sBody.length(); }
+
         /**
          * Sets cookies for this response.
          * @param iroCookieParameters The cookies to set.
@@ -120,10 +220,24 @@ class HttpResponse : public GenericResponse {
         ResponseCode GetResponseCode() { return m_nResponseCode; }
 
         /**
-         * Retrieves the headers of this this response.
+         * Retrieves the explicitly set headers of this this response.
+         * Default headers are not included, see SetDefaultHeaders.
          */
         StringCaseMap& GetHeaders() { return m_oResponseHeaders; }
 
+        /**
+         * Selects the default headers, which are added when sending this response.
+         * A default header is only added, if it has not been set explicitly.
+         * @param flags A combination of DefaultHeader flags.
+         */
+        void SetDefaultHeaders(unsigned int flags) { m_nDefaultHeaders = flags; }
+
+        /**
+         * Retrieves the selected default headers.
+         * @return A combination of DefaultHeader flags.
+         */
+        unsigned int GetDefaultHeaders() const { return m_nDefaultHeaders; }
+
         /**
          * Retrieves the cookies of this this response.
          */
@@ -140,13 +254,10 @@ class HttpResponse : public GenericResponse {
         }
 
         /**
-         * Removes an HTTP header.
+         * Removes an HTTP header. Removing a default header switches it off.
          * @param name The case insensitive name of the HTTP header to remove.
          */
-        void RemoveHeader(const std::string & name)
-        {
-            m_oResponseHeaders.erase(name);
-        }
+        void RemoveHeader(const std::string & name);
 
         /**
          * Retrieves the status string of this this response.
@@ -174,21 +285,73 @@ class HttpResponse : public GenericResponse {
          */
         std::string HttpTime(time_t stamp);
 
+        /**
+         * Declares the validators of this response before its body is created.
+         * Sets the ETag and (optionally) the Last-Modified header and checks
+         * the conditional headers of the request. If the client's copy is
+         * current, the response is turned into a 304 and the handler can
+         * return HTTPRESPONSECODE_304_NOT_MODIFIED without creating a body.
+         * @param request The request to which this response refers.
+         * @param etag The entity tag including the quotes, e.g. "\"v42\"".
+         * @param lastModified The modification time or 0, if unknown.
+         * @return true, if the response has been turned into a 304.
+         */
+        bool SetValidators(HttpRequest *request, const std::string & etag, time_t lastModified = 0);
+
+        /**
+         * Checks If-None-Match and If-Modified-Since of a GET or HEAD request
+         * against the ETag and the explicitly set Last-Modified header.
+         * @param request The request to which this response refers.
+         * @return true, if the client's copy is current.
+         */
+        bool IsNotModified(HttpRequest *request);
+
+        /**
+         * Turns this response into a 304 Not Modified. The body is discarded,
+         * as well as the headers describing it.
+         */
+        void SetNotModified();
+
+        /**
+         * Sets a strong ETag, unless one has been set already. A body set
+         * with SetBody is hashed, a file body is identified by the modification
+         * time of the file, its offset and length. Bodies of producers get no ETag.
+         */
+        void GenerateETag();
+
         /**
          * Retrieves a specific HTTP header.
          * @param name The name of the HTTP header to be retrieved.
-         * @return The value of the specified header.
+         * @return The value of the specified header, including default headers.
          */
-        std::string Header(const std::string & name)
-        {
-            if (m_oResponseHeaders.find(name) != m_oResponseHeaders.end()) {
-                return m_oResponseHeaders[name];
-            }
-            return std::string();
-        }
+        std::string Header(const std::string & name);
+
+        /**
+         * Retrieves the number of body bytes to be sent. This is the length
+         * of the body (or the file body), limited by an explicitly set
+         * Content-Length header.
+         */
+        size_t ContentLength();
+
+        /**
+         * Appends the status line, all headers and cookies, followed by an
+         * empty line. The default headers are resolved here.
+         * @param out The string to append to.
+         */
+        void AppendHead(std::string &out);
 
     private:
 
+        /// Finds the flag for a default header.
+        static unsigned int DefaultFlag(KnownHeader header);
+
+        /// Determines, whether a default header is to be added.
+        bool UseDefault(unsigned int flag, KnownHeader header) const
+        {
+            return (0 != (m_nDefaultHeaders & flag)) &&
+                (m_oResponseHeaders.end() == m_oResponseHeaders.find(header));
+        }
+
         /// the response code to be sent back
         ResponseCode m_nResponseCode;
 
@@ -198,6 +361,31 @@ class HttpResponse : public GenericResponse {
 
         /// cookies waiting to be sent
         StringList m_oCookieList;
+
+        /// default headers to be added when sending, a combination of DefaultHeader flags
+        unsigned int m_nDefaultHeaders;
+
+        /// file descriptor of a file body or -1
+        int m_nBodyFd;
+
+        /// offset of the first byte of the file body
+        off_t m_nBodyFileOffset;
+
+        /// length of the file body
+        size_t m_nBodyFileLength;
+
+        /// producer of the body or NULL
+        ResponseProducer *m_poProducer;
+
+        /// Flag: the client understands chunked transfer encoding (HTTP/1.1)
+        bool m_bChunkedAllowed;
+
+        /// Flag: the request method is HEAD, the body is not sent
+        bool m_bHeadOnly;
+
+        friend class EHS;
+        friend class ResponseCompressor;
+        friend class RangeResponder;
 };
 
 #endif // HTTPRESPONSE_H
@@ -0,0 +1,118 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef _INPUTBUFFER_H_
+#define _INPUTBUFFER_H_
+
+#include <cstddef>
+
+/**
+ * Contiguous receive buffer of a connection.
+ * The network layer reads directly into the free space at the end
+ * of the buffer. The request parser works on the unconsumed part
+ * and calls Consume once a request (or part of its body) has been
+ * handled. Unconsumed data is moved to the front of the buffer only
+ * if there is not enough room left for the next read, so the bytes
+ * before the start of the current request are the only ones that get
+ * reclaimed. The size of each read adapts to the data rate of the peer.
+ */
+class InputBuffer {
+    public:
+        /**
+         * Constructs a new instance.
+         * @param minread The smallest amount of free space to offer for a read.
+         * @param maxread The largest amount of free space to offer for a read.
+         */
+        InputBuffer(size_t minread = 4096, size_t maxread = 65536);
+
+        /// Destructor
+        ~InputBuffer();
+
+        /**
+         * Retrieves the unconsumed data.
+         * @return A pointer to the first unconsumed byte.
+         */
+        const char *Data() const { return m_pBuffer + m_nStart; }
+
+        /**
+         * Retrieves the amount of unconsumed data.
+         * @return The number of unconsumed bytes.
+         */
+        size_t Length() const { return m_nEnd - m_nStart; }
+
+        /**
+         * Provides free space for reading from the network.
+         * @param limit The maximum number of bytes wanted by the caller.
+         * @param rnSize Receives the number of bytes that may be written.
+         * @return A pointer to the free space.
+         */
+        char *WriteSpace(size_t limit, size_t & rnSize);
+
+        /**
+         * Marks data written into the space provided by WriteSpace as valid.
+         * @param n The number of bytes actually written.
+         */
+        void Commit(size_t n);
+
+        /**
+         * Copies data into the buffer.
+         * @param data The data to be appended.
+         * @param n The length of the data.
+         */
+        void Append(const char *data, size_t n);
+
+        /**
+         * Consumes data at the front of the buffer.
+         * @param n The number of bytes to consume.
+         */
+        void Consume(size_t n);
+
+    private:
+
+        InputBuffer(const InputBuffer &);
+
+        InputBuffer & operator=(const InputBuffer &);
+
+        /// Ensures that at least n bytes are free at the end of the buffer.
+        void MakeRoom(size_t n);
+
+        char *m_pBuffer;
+
+        size_t m_nCapacity;
+
+        size_t m_nStart; ///< offset of the first unconsumed byte
+
+        size_t m_nEnd; ///< offset of the first free byte
+
+        size_t m_nReadSize; ///< current size of a read
+
+        size_t m_nOffered; ///< size offered by the last WriteSpace
+
+        size_t m_nMinRead;
+
+        size_t m_nMaxRead;
+};
+
+#endif
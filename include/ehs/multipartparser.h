@@ -0,0 +1,156 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef MULTIPARTPARSER_H
+#define MULTIPARTPARSER_H
+
+#include <string>
+#include <cstdio>
+#include <cstddef>
+
+#include "ehstypes.h"
+
+/**
+ * Incremental parser for multipart/form-data bodies.
+ * The body may be fed in pieces of any size, e.g. from
+ * RequestBodyHandler::OnBodyData, so it never has to be kept in memory
+ * as a whole. Boundaries are located with a Boyer-Moore-Horspool search,
+ * so every byte of the body is looked at only once. Each part with a
+ * Content-Disposition name is stored as a FormValue. Parts that grow
+ * beyond a given size are written to a temporary file instead of
+ * FormValue::m_sBody; the file name is stored in FormValue::m_sTempFile
+ * and the caller is responsible for removing it.
+ */
+class MultipartParser {
+
+    private:
+
+        /// Disable copy constructor
+        MultipartParser(const MultipartParser &);
+
+        /// Disable = operator
+        MultipartParser & operator=(const MultipartParser &);
+
+    public:
+
+        /**
+         * Constructs a new instance.
+         * @param irsBoundary The boundary, as specified in the Content-Type header.
+         * @param roFormValues The map which receives the parts.
+         * @param inSpillSize The size above which a part is written to a
+         *   temporary file, 0 to always keep parts in memory.
+         */
+        MultipartParser(const std::string & irsBoundary, FormValueMap & roFormValues,
+                size_t inSpillSize = 0);
+
+        /// Destructor
+        ~MultipartParser();
+
+        /**
+         * Extracts the boundary parameter of a multipart content type.
+         * @param irsContentType The value of a Content-Type header.
+         * @param rsBoundary Receives the boundary.
+         * @return false, if irsContentType has no valid boundary parameter.
+         */
+        static bool GetBoundary(const std::string & irsContentType, std::string & rsBoundary);
+
+        /**
+         * Parses the next piece of the body.
+         * @param data The data to be parsed.
+         * @param len The length of the data.
+         * @return false, if the body is malformed or a temporary file could not be written.
+         */
+        bool Feed(const char *data, size_t len);
+
+        /**
+         * Finishes parsing, after the whole body has been fed.
+         * @return false, if the body is malformed or incomplete.
+         */
+        bool Finish();
+
+    private:
+
+        /// The states of the parser
+        enum ParseState {
+            MULTIPART_START,     ///< expecting the first delimiter
+            MULTIPART_PREAMBLE,  ///< skipping data before the first delimiter
+            MULTIPART_DELIMITER, ///< after a delimiter, expecting CRLF or "--"
+            MULTIPART_HEADERS,   ///< collecting the header block of a part
+            MULTIPART_BODY,      ///< within the body of a part
+            MULTIPART_DONE,      ///< after the close delimiter
+            MULTIPART_INVALID    ///< malformed body
+        };
+
+        /**
+         * Parses as much as possible of the given data.
+         * @return The number of bytes consumed.
+         */
+        size_t Process(const char *data, size_t len);
+
+        /**
+         * Searches the delimiter.
+         * @return The position of the delimiter or NULL, if it is not found.
+         */
+        const char *FindDelimiter(const char *data, size_t len) const;
+
+        /**
+         * Interprets the header block of a part and starts a new part.
+         * @param data The header block, including the CRLF of the last header line.
+         * @param len The length of the header block.
+         */
+        void StartPart(const char *data, size_t len);
+
+        /// Adds data to the current part.
+        bool AppendPart(const char *data, size_t len);
+
+        /// Finishes the current part.
+        bool EndPart();
+
+        /// CRLF, two dashes and the boundary
+        std::string m_sDelimiter;
+
+        /// Boyer-Moore-Horspool shift table for m_sDelimiter
+        size_t m_aShift[256];
+
+        /// receives the parts
+        FormValueMap & m_roFormValues;
+
+        /// part size above which parts are written to a temporary file
+        size_t m_nSpillSize;
+
+        /// the current parse state
+        ParseState m_nState;
+
+        /// unconsumed data of previous calls to Feed
+        std::string m_sPending;
+
+        /// the part currently being parsed, NULL if it is discarded
+        FormValue *m_poPart;
+
+        /// temporary file of the current part, NULL if it is kept in memory
+        FILE *m_pSpillFile;
+};
+
+#endif // MULTIPARTPARSER_H
@@ -28,9 +28,20 @@
 
 #include <string>
 #include <cstdlib>
+#include <sys/types.h>
 
 class PrivilegedBindHelper;
 
+/**
+ * A piece of outgoing data for NetworkAbstraction::SendBuffers.
+ */
+struct NetworkBuffer {
+    /// Pointer to the data to be sent.
+    const void *data;
+    /// The number of bytes to send.
+    size_t len;
+};
+
 #ifdef _WIN32
 typedef SOCKET ehs_socket_t;
 #else
@@ -144,6 +155,40 @@ class NetworkAbstraction {
          */
         virtual int Send(const void *buf, size_t buflen, int flags = 0) = 0;
 
+        /**
+         * Sends several buffers with as few system calls as possible.
+         * The default implementation calls Send for every buffer, implementations
+         * override this with a gathering write.
+         * @param bufs Pointer to an array of buffers to be sent in order.
+         * @param count The number of elements in bufs.
+         * @return The total number of bytes that have been sent or -1 if an error occured.
+         */
+        virtual int SendBuffers(const NetworkBuffer *bufs, size_t count)
+        {
+            int ret = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (0 < bufs[i].len) {
+                    int r = Send(bufs[i].data, bufs[i].len);
+                    if (-1 == r) {
+                        return -1;
+                    }
+                    ret += r;
+                }
+            }
+            return ret;
+        }
+
+        /**
+         * Sends a part of a file.
+         * The default implementation reads the file in chunks and calls Send,
+         * implementations override this with a zero-copy transfer, if possible.
+         * @param fd The file descriptor of the file to send.
+         * @param offset The offset of the first byte to send.
+         * @param length The number of bytes to send.
+         * @return 0 on success or -1 if an error occured (including a file, that is too short).
+         */
+        virtual int SendFile(int fd, off_t offset, size_t length);
+
         /// Closes the underlying socket.
         virtual void Close() = 0;
 
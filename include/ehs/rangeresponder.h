@@ -0,0 +1,91 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef _RANGERESPONDER_H_
+#define _RANGERESPONDER_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "ehs.h"
+
+/**
+ * Answers byte range requests (RFC 7233). A single range is served
+ * directly from the body or the file body, which then is sent starting
+ * at the requested offset. Multiple ranges are sent as multipart/byteranges,
+ * reading only the requested parts of a file body while sending.
+ * Unsatisfiable ranges are answered with 416. Ranges are served only
+ * for file bodies and for responses with an ETag or a Last-Modified header.
+ */
+class RangeResponder {
+
+    public:
+
+        /// A range of bytes: first and last position (inclusive)
+        typedef std::pair<size_t, size_t> Range;
+
+        /// Constructor
+        RangeResponder();
+
+        /**
+         * Reads the settings from the server parameters.
+         * @param params The parameters of the top level EHS instance.
+         */
+        void Configure(EHSServerParameters & params);
+
+        /// Returns whether range requests are answered.
+        bool Enabled() const { return (0 != m_nMaxRanges); }
+
+        /**
+         * Turns a 200 response to a GET request with a Range header into
+         * a 206 or 416 response, unless an If-Range condition fails.
+         * @param request The request to which the response refers.
+         * @param response The response to be modified.
+         */
+        void Apply(HttpRequest *request, HttpResponse *response);
+
+        /**
+         * Parses the value of a Range header.
+         * Unsatisfiable ranges are dropped, the remaining ones are sorted
+         * and overlapping or adjacent ranges are merged.
+         * @param spec The value of the Range header.
+         * @param length The length of the complete body.
+         * @param ranges Receives the satisfiable ranges.
+         * @return false, if the header is malformed (e.g. has no range at all)
+         *   or not in bytes.
+         */
+        static bool Parse(const std::string & spec, size_t length, std::vector<Range> & ranges);
+
+    private:
+
+        /// Checks an If-Range header against the validators of the response.
+        static bool IfRangeMatches(const std::string & condition, HttpResponse *response);
+
+        /// Maximum number of ranges, more are answered with the full body
+        size_t m_nMaxRanges;
+};
+
+#endif // _RANGERESPONDER_H_
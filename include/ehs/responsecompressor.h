@@ -0,0 +1,114 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef _RESPONSECOMPRESSOR_H_
+#define _RESPONSECOMPRESSOR_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "ehs.h"
+
+/**
+ * Compresses response bodies with a content coding, negotiated from
+ * the Accept-Encoding header of the request. gzip and deflate are built
+ * in, further codings can be added with EHS::AddContentCoding().
+ * Small bodies, file bodies and content types which are compressed
+ * already are sent unchanged. Bodies of producers are compressed piece
+ * by piece while they are sent.
+ */
+class ResponseCompressor {
+
+    public:
+
+        /// Constructor. Compression is disabled until Configure is called.
+        ResponseCompressor();
+
+        /// Destructor
+        ~ResponseCompressor();
+
+        /**
+         * Reads the settings from the server parameters.
+         * @param params The parameters of the top level EHS instance.
+         * @param codings Codings added by the application, in order of preference.
+         */
+        void Configure(EHSServerParameters & params, const ContentCodingList & codings);
+
+        /// Returns whether compression has been enabled.
+        bool Enabled() const { return m_bEnabled; }
+
+        /**
+         * Compresses the body of a response, if the client accepts a coding
+         * and the response is worth compressing. Adds Vary: Accept-Encoding
+         * to all responses, whose representation depends on the negotiation.
+         * @param request The request to which the response refers.
+         * @param response The response to be compressed.
+         */
+        void Apply(HttpRequest *request, HttpResponse *response);
+
+        /**
+         * Finds the compression level for a content type.
+         * @param type The value of a Content-Type header.
+         * @return The level from 1 to 9 or 0, if the type is not to be compressed.
+         */
+        int Level(const std::string & type) const;
+
+        /**
+         * Selects a coding from the value of an Accept-Encoding header.
+         * @param accept The value of the Accept-Encoding header.
+         * @return The coding with the highest quality or NULL, if none is acceptable.
+         */
+        ContentCoding *Negotiate(const std::string & accept) const;
+
+    private:
+
+        ResponseCompressor(const ResponseCompressor &);
+
+        ResponseCompressor & operator=(const ResponseCompressor &);
+
+        /// A content type (or type/* pattern) and its compression level
+        typedef std::pair<std::string, int> TypeLevel;
+
+        /// Flag: compression is enabled
+        bool m_bEnabled;
+
+        /// Static bodies smaller than this are not compressed
+        size_t m_nMinSize;
+
+        /// Compression level for types without a specific level
+        int m_nLevel;
+
+        /// Configured levels by content type, checked before the built-in ones
+        std::vector<TypeLevel> m_oLevels;
+
+        /// All codings in order of preference
+        std::vector<ContentCoding *> m_oCodings;
+
+        /// The built-in codings, owned by this instance
+        std::vector<ContentCoding *> m_oOwnCodings;
+};
+
+#endif // _RESPONSECOMPRESSOR_H_
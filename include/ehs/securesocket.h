@@ -82,6 +82,10 @@ class SecureSocket : public Socket
 
         virtual int Send(const void *buf, size_t buflen, int flags = 0);
 
+        virtual int SendBuffers(const NetworkBuffer *bufs, size_t count);
+
+        virtual int SendFile(int fd, off_t offset, size_t length);
+
         virtual void Close();
 
         virtual void ThreadCleanup();
@@ -122,6 +126,9 @@ class SecureSocket : public Socket
         /// The PassPhraseHandler to use for retrieving certificate passphrases.
         PassphraseHandler * m_poPassphraseHandler;
 
+        /// Buffer for coalescing small pieces of data in SendBuffers.
+        std::string m_sSendBuffer;
+
     private:
 
         /// Dynamic portion of the SSL locking mechanism.
@@ -48,6 +48,9 @@
 #ifdef HAVE_SYS_SOCKET_H
 # include <sys/socket.h>
 #endif
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>
+#endif
 #ifdef HAVE_SYS_IOCTL_H
 # include <sys/ioctl.h>
 #endif
@@ -114,6 +117,10 @@ class Socket : public NetworkAbstraction {
 
         virtual int Send(const void *buf, size_t buflen, int flags = 0);
 
+        virtual int SendBuffers(const NetworkBuffer *bufs, size_t count);
+
+        virtual int SendFile(int fd, off_t offset, size_t length);
+
         virtual void Close();
 
         virtual NetworkAbstraction *Accept();
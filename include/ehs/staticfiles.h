@@ -0,0 +1,265 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifndef _STATICFILES_H_
+#define _STATICFILES_H_
+
+#include <pthread.h>
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+
+#include "ehs.h"
+
+/**
+ * Serves the files below a directory.
+ * Register an instance with RegisterEHS; the rest of the request path
+ * (after the registered path) names the file. Small files are kept in
+ * an LRU cache bounded by the total number of bytes. Of larger files,
+ * only an open descriptor is cached and they are sent with sendfile().
+ * A hot working set is therefore served without any disk I/O or open().
+ * On Linux, cached entries are invalidated using inotify, elsewhere files
+ * are checked with stat() at most once per second.
+ * Responses carry ETag and Last-Modified, so conditional and range
+ * requests are answered as described for the "etags" and "maxranges"
+ * parameters. If used as top level instance, start the server with
+ * the "norouterequest" parameter.
+ */
+class StaticFiles : public EHS {
+
+    private:
+
+        StaticFiles(const StaticFiles &);
+
+        StaticFiles & operator=(const StaticFiles &);
+
+    public:
+
+        /**
+         * Constructs a new instance.
+         * @param root The directory, from which files are served.
+         */
+        StaticFiles(const std::string & root);
+
+        /// Destructor
+        virtual ~StaticFiles();
+
+        /**
+         * Sets the maximum total size of the cached file contents.
+         * @param bytes The size in bytes. Default: 32 MB.
+         */
+        void SetCacheSize(size_t bytes) { m_nCacheSize = bytes; }
+
+        /**
+         * Sets the size up to which the contents of a file are cached.
+         * Of larger files, only the open descriptor is cached.
+         * @param bytes The size in bytes. Default: 256 kB.
+         */
+        void SetMaxCachedFileSize(size_t bytes) { m_nMaxFileSize = bytes; }
+
+        /**
+         * Sets the maximum number of cached files.
+         * @param count The number of files. Default: 1024.
+         */
+        void SetMaxCachedFiles(size_t count) { m_nMaxEntries = count; }
+
+        /**
+         * Sets the maximum number of open descriptors of large files,
+         * which are kept in the cache. Beyond that, the least recently
+         * used ones are closed. With 0, large files are opened for every request.
+         * @param count The number of descriptors. Default: 64.
+         */
+        void SetMaxCachedDescriptors(size_t count) { m_nMaxFds = count; }
+
+        /**
+         * Sets the file, which is served for requests of a directory.
+         * @param name The name of the file. Default: index.html.
+         */
+        void SetIndexFile(const std::string & name) { m_sIndexFile = name; }
+
+        /**
+         * Adds or replaces a mapping from a file extension to a content type.
+         * @param extension The extension without the dot, e.g. "md".
+         * @param type The content type, e.g. "text/markdown".
+         */
+        void AddContentType(const std::string & extension, const std::string & type);
+
+        /**
+         * Determines the content type of a file by its extension.
+         * @param path The name of the file.
+         * @return The content type or application/octet-stream, if unknown.
+         */
+        std::string ContentType(const std::string & path) const;
+
+        /**
+         * Converts a request path into a relative file name.
+         * Removes query and fragment, decodes %-escapes and resolves
+         * "." and ".." segments.
+         * @param uri The request path.
+         * @param path Receives the relative file name. It ends with a slash,
+         *   if the request path does.
+         * @return false, if the path leaves the root directory, contains
+         *   a NUL or backslash or an invalid escape.
+         */
+        static bool NormalizePath(const std::string & uri, std::string & path);
+
+        /**
+         * Serves a GET or HEAD request from the cache or the file system.
+         * @param request The request to be handled.
+         * @param response The response to be filled.
+         * @return The response code.
+         */
+        virtual ResponseCode HandleRequest(HttpRequest *request, HttpResponse *response);
+
+    private:
+
+        /// A cached file
+        struct CacheEntry {
+            CacheEntry() :
+                data(),
+                fd(-1),
+                size(0),
+                mtime(0),
+                etag(),
+                type(),
+                checked(0),
+                watched(false),
+                lru()
+            {
+            }
+
+            /// The contents of a small file
+            std::string data;
+            /// The open descriptor of a large file or -1
+            int fd;
+            /// The size of the file
+            size_t size;
+            /// The modification time of the file
+            time_t mtime;
+            /// The entity tag, derived from mtime and size
+            std::string etag;
+            /// The content type
+            std::string type;
+            /// Time of the last check with stat() (if not watched)
+            time_t checked;
+            /// Flag: the directory is watched with inotify
+            bool watched;
+            /// Position in m_oLru
+            std::list<std::string>::iterator lru;
+        };
+
+        /// Cached files, mapped by their full name
+        typedef std::map<std::string, CacheEntry> CacheMap;
+
+        /// Result of Load
+        enum LoadResult {
+            LOAD_OK,
+            LOAD_NOTFOUND,
+            LOAD_DIRECTORY
+        };
+
+        /**
+         * Opens a file and reads it, if it is small.
+         * @param path The full name of the file.
+         * @param entry Receives the file.
+         */
+        LoadResult Load(const std::string & path, CacheEntry & entry);
+
+        /// Inserts an entry and evicts the least recently used ones -- m_oMutex must be locked.
+        CacheMap::iterator Insert(const std::string & path, CacheEntry & entry);
+
+        /// Removes an entry -- m_oMutex must be locked.
+        void Remove(CacheMap::iterator it);
+
+        /// Removes all entries below a directory -- m_oMutex must be locked.
+        void RemoveBelow(const std::string & dir);
+
+        /**
+         * Watches all directories from the root down to a file for
+         * changes -- m_oMutex must be locked.
+         * @return false, if changes are not notified.
+         */
+        bool Watch(const std::string & path);
+
+        /// Watches a single directory -- m_oMutex must be locked.
+        bool WatchDir(const std::string & dir);
+
+        /// Removes the watches of a directory and all directories below -- m_oMutex must be locked.
+        void UnwatchBelow(const std::string & dir);
+
+        /// Reads pending change notifications -- m_oMutex must be locked.
+        void ProcessEvents();
+
+        /// The directory, from which files are served
+        std::string m_sRoot;
+
+        /// The root directory with all symbolic links resolved
+        std::string m_sRealRoot;
+
+        /// Maximum total size of cached contents
+        size_t m_nCacheSize;
+
+        /// Maximum size of a file whose contents are cached
+        size_t m_nMaxFileSize;
+
+        /// Maximum number of cached files
+        size_t m_nMaxEntries;
+
+        /// Maximum number of cached descriptors
+        size_t m_nMaxFds;
+
+        /// The file served for directories
+        std::string m_sIndexFile;
+
+        /// Content types added with AddContentType, mapped by extension
+        std::map<std::string, std::string> m_oTypes;
+
+        /// The cached files
+        CacheMap m_oCache;
+
+        /// Names of the cached files, most recently used first
+        std::list<std::string> m_oLru;
+
+        /// Total size of the cached contents
+        size_t m_nCachedBytes;
+
+        /// Number of cached descriptors
+        size_t m_nCachedFds;
+
+        /// Protects the cache
+        pthread_mutex_t m_oMutex;
+
+        /// inotify descriptor or -1
+        int m_nNotifyFd;
+
+        /// Watched directories, mapped by watch descriptor
+        std::map<int, std::string> m_oWatches;
+
+        /// Watch descriptors, mapped by directory
+        std::map<std::string, int> m_oWatchedDirs;
+};
+
+#endif // _STATICFILES_H_
@@ -0,0 +1,114 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "inputbuffer.h"
+
+#include <cstring>
+#include <algorithm>
+
+InputBuffer::InputBuffer(size_t minread, size_t maxread) :
+    m_pBuffer(NULL),
+    m_nCapacity(0),
+    m_nStart(0),
+    m_nEnd(0),
+    m_nReadSize(minread),
+    m_nOffered(0),
+    m_nMinRead(minread),
+    m_nMaxRead(maxread)
+{
+}
+
+InputBuffer::~InputBuffer()
+{
+    delete [] m_pBuffer;
+}
+
+void InputBuffer::MakeRoom(size_t n)
+{
+    if ((m_nCapacity - m_nEnd) >= n) {
+        return;
+    }
+    size_t len = Length();
+    if ((len + n) <= m_nCapacity) {
+        // Enough space, if the unconsumed data is moved to the front.
+        memmove(m_pBuffer, m_pBuffer + m_nStart, len);
+    } else {
+        size_t cap = std::max(m_nCapacity * 2, len + n);
+        char *buf = new char[cap];
+        if (0 < len) {
+            memcpy(buf, m_pBuffer + m_nStart, len);
+        }
+        delete [] m_pBuffer;
+        m_pBuffer = buf;
+        m_nCapacity = cap;
+    }
+    m_nStart = 0;
+    m_nEnd = len;
+}
+
+char *InputBuffer::WriteSpace(size_t limit, size_t & rnSize)
+{
+    m_nOffered = std::max(std::min(m_nReadSize, limit), static_cast<size_t>(1));
+    MakeRoom(m_nOffered);
+    rnSize = m_nOffered;
+    return m_pBuffer + m_nEnd;
+}
+
+void InputBuffer::Commit(size_t n)
+{
+    m_nEnd += std::min(n, m_nCapacity - m_nEnd);
+    // Adapt the read size: A read that filled the entire space
+    // indicates that more data is waiting.
+    if ((n >= m_nOffered) && (m_nOffered >= m_nReadSize)) {
+        m_nReadSize = std::min(m_nReadSize * 2, m_nMaxRead);
+    } else if (n < (m_nReadSize / 4)) {
+        m_nReadSize = std::max(m_nReadSize / 2, m_nMinRead);
+    }
+}
+
+void InputBuffer::Append(const char *data, size_t n)
+{
+    MakeRoom(n);
+    memcpy(m_pBuffer + m_nEnd, data, n);
+    m_nEnd += n;
+}
+
+void InputBuffer::Consume(size_t n)
+{
+    m_nStart += std::min(n, Length());
+    if (m_nStart == m_nEnd) {
+        m_nStart = m_nEnd = 0;
+        // Don't keep a large buffer around on an idle connection.
+        if (m_nCapacity > (m_nMaxRead * 2)) {
+            delete [] m_pBuffer;
+            m_pBuffer = NULL;
+            m_nCapacity = 0;
+        }
+    }
+}
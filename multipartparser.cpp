@@ -0,0 +1,440 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "multipartparser.h"
+#include "formvalue.h"
+#include "contentdisposition.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+
+#ifndef _WIN32
+# include <unistd.h>
+#endif
+
+using namespace std;
+
+/// Maximum size of the header block of a single part
+static const size_t MAX_PART_HEADERS = 16 * 1024;
+
+/// Maximum length of a boundary (RFC 2046 allows 70 characters)
+static const size_t MAX_BOUNDARY = 200;
+
+static inline bool IsLinearWhiteSpace(char c)
+{
+    return (' ' == c) || ('\t' == c);
+}
+
+/// Trims linear white space from both ends of [begin, end)
+static string TrimmedString(const char *begin, const char *end)
+{
+    while ((begin < end) && IsLinearWhiteSpace(*begin)) {
+        ++begin;
+    }
+    while ((begin < end) && IsLinearWhiteSpace(end[-1])) {
+        --end;
+    }
+    return string(begin, end);
+}
+
+/**
+ * Splits a header value of the form "type; name=value; name=\"value\"".
+ * Parameter values may be quoted strings with backslash escapes.
+ * @return The part before the first semicolon.
+ */
+static string ParseParameters(const string & irsValue, StringCaseMap & roParams)
+{
+    const char *p = irsValue.data();
+    const char *end = p + irsValue.length();
+    const char *semi = static_cast<const char *>(memchr(p, ';', end - p));
+    string ret(TrimmedString(p, semi ? semi : end));
+    p = semi;
+    while (p && (p < end)) {
+        // skip the semicolon
+        ++p;
+        const char *eq = p;
+        while ((eq < end) && ('=' != *eq) && (';' != *eq)) {
+            ++eq;
+        }
+        string sName(TrimmedString(p, eq));
+        string sValue;
+        p = eq;
+        if ((p < end) && ('=' == *p)) {
+            ++p;
+            while ((p < end) && IsLinearWhiteSpace(*p)) {
+                ++p;
+            }
+            if ((p < end) && ('"' == *p)) {
+                for (++p; (p < end) && ('"' != *p); ++p) {
+                    if (('\\' == *p) && ((p + 1) < end)) {
+                        ++p;
+                    }
+                    sValue += *p;
+                }
+                p = static_cast<const char *>(memchr(p, ';', end - p));
+            } else {
+                const char *vend = static_cast<const char *>(memchr(p, ';', end - p));
+                sValue = TrimmedString(p, vend ? vend : end);
+                p = vend;
+            }
+        }
+        if (!sName.empty()) {
+            roParams[sName] = sValue;
+        }
+    }
+    return ret;
+}
+
+/**
+ * Creates a temporary file for a spilled part.
+ * @param rsPath Receives the path of the new file.
+ * @return The open file or NULL on error.
+ */
+static FILE *CreateTempFile(string & rsPath)
+{
+#ifdef _WIN32
+    char *name = _tempnam(NULL, "ehs");
+    if (NULL == name) {
+        return NULL;
+    }
+    rsPath = name;
+    free(name);
+    return fopen(rsPath.c_str(), "wb");
+#else
+    const char *dir = getenv("TMPDIR");
+    if ((NULL == dir) || ('\0' == *dir)) {
+        dir = "/tmp";
+    }
+    string sTemplate(dir);
+    sTemplate.append("/ehsXXXXXX");
+    vector<char> name(sTemplate.begin(), sTemplate.end());
+    name.push_back('\0');
+    int fd = mkstemp(&name[0]);
+    if (0 > fd) {
+        return NULL;
+    }
+    FILE *f = fdopen(fd, "wb");
+    if (NULL == f) {
+        close(fd);
+        unlink(&name[0]);
+        return NULL;
+    }
+    rsPath = &name[0];
+    return f;
+#endif
+}
+
+MultipartParser::MultipartParser(const string & irsBoundary,
+        FormValueMap & roFormValues, size_t inSpillSize) :
+    m_sDelimiter("\r\n--"),
+    m_aShift(),
+    m_roFormValues(roFormValues),
+    m_nSpillSize(inSpillSize),
+    m_nState(MULTIPART_START),
+    m_sPending(),
+    m_poPart(NULL),
+    m_pSpillFile(NULL)
+{
+    m_sDelimiter.append(irsBoundary);
+    size_t last = m_sDelimiter.length() - 1;
+    for (size_t i = 0; i < 256; ++i) {
+        m_aShift[i] = m_sDelimiter.length();
+    }
+    for (size_t i = 0; i < last; ++i) {
+        m_aShift[static_cast<unsigned char>(m_sDelimiter[i])] = last - i;
+    }
+    if (irsBoundary.empty() || (irsBoundary.length() > MAX_BOUNDARY)) {
+        m_nState = MULTIPART_INVALID;
+    }
+}
+
+MultipartParser::~MultipartParser()
+{
+    if (NULL != m_pSpillFile) {
+        fclose(m_pSpillFile);
+    }
+}
+
+bool MultipartParser::GetBoundary(const string & irsContentType, string & rsBoundary)
+{
+    StringCaseMap oParams;
+    string sType(ParseParameters(irsContentType, oParams));
+    if (!boost::istarts_with(sType, "multipart/")) {
+        return false;
+    }
+    StringCaseMap::const_iterator i = oParams.find("boundary");
+    if ((oParams.end() == i) || i->second.empty() || (i->second.length() > MAX_BOUNDARY)) {
+        return false;
+    }
+    rsBoundary = i->second;
+    return true;
+}
+
+const char *MultipartParser::FindDelimiter(const char *data, size_t len) const
+{
+    const char *d = m_sDelimiter.data();
+    size_t dlen = m_sDelimiter.length();
+    size_t last = dlen - 1;
+    size_t i = 0;
+    while ((i + dlen) <= len) {
+        unsigned char c = static_cast<unsigned char>(data[i + last]);
+        if ((static_cast<unsigned char>(d[last]) == c) && (0 == memcmp(data + i, d, last))) {
+            return data + i;
+        }
+        i += m_aShift[c];
+    }
+    return NULL;
+}
+
+void MultipartParser::StartPart(const char *data, size_t len)
+{
+    StringMap oHeaders;
+    StringCaseMap oParams;
+    string sDisposition;
+    const char *end = data + len;
+    string sName;
+    string sValue;
+    // each header line is terminated by CRLF
+    while (data < end) {
+        const char *eol = static_cast<const char *>(memchr(data, '\r', end - data));
+        if (NULL == eol) {
+            eol = end;
+        }
+        if (IsLinearWhiteSpace(*data)) {
+            // obsolete line folding
+            sValue.append(" ").append(TrimmedString(data, eol));
+        } else {
+            if (!sName.empty()) {
+                oHeaders[sName] = sValue;
+            }
+            const char *colon = static_cast<const char *>(memchr(data, ':', eol - data));
+            if (NULL == colon) {
+                sName.clear();
+            } else {
+                sName = TrimmedString(data, colon);
+                sValue = TrimmedString(colon + 1, eol);
+            }
+        }
+        data = eol + 2;
+    }
+    if (!sName.empty()) {
+        oHeaders[sName] = sValue;
+    }
+    for (StringMap::iterator i = oHeaders.begin(); i != oHeaders.end(); ++i) {
+        if (boost::iequals(i->first, "Content-Disposition")) {
+            sDisposition = ParseParameters(i->second, oParams);
+            oHeaders.erase(i);
+            break;
+        }
+    }
+    m_poPart = NULL;
+    StringCaseMap::const_iterator name = oParams.find("name");
+    if (oParams.end() == name) {
+        // without a name, there is nowhere to store this part
+        return;
+    }
+    FormValue & roPart = m_roFormValues[name->second];
+    if (!roPart.m_sTempFile.empty()) {
+        // replaced by a part of the same name
+        remove(roPart.m_sTempFile.c_str());
+        roPart.m_sTempFile.clear();
+    }
+    roPart.m_oFormHeaders.swap(oHeaders);
+    roPart.m_oContentDisposition.m_sContentDisposition = sDisposition;
+    roPart.m_oContentDisposition.m_oContentDispositionHeaders = oParams;
+    roPart.m_sBody.clear();
+    m_poPart = &roPart;
+}
+
+bool MultipartParser::AppendPart(const char *data, size_t len)
+{
+    if ((NULL == m_poPart) || (0 == len)) {
+        return true;
+    }
+    if ((NULL == m_pSpillFile) && (0 != m_nSpillSize) &&
+            ((m_poPart->m_sBody.length() + len) > m_nSpillSize)) {
+        m_pSpillFile = CreateTempFile(m_poPart->m_sTempFile);
+        if (NULL == m_pSpillFile) {
+            return false;
+        }
+        if (!m_poPart->m_sBody.empty()) {
+            if (1 != fwrite(m_poPart->m_sBody.data(), m_poPart->m_sBody.length(), 1, m_pSpillFile)) {
+                return false;
+            }
+            string().swap(m_poPart->m_sBody);
+        }
+    }
+    if (NULL != m_pSpillFile) {
+        return (1 == fwrite(data, len, 1, m_pSpillFile));
+    }
+    m_poPart->m_sBody.append(data, len);
+    return true;
+}
+
+bool MultipartParser::EndPart()
+{
+    m_poPart = NULL;
+    if (NULL != m_pSpillFile) {
+        int res = fclose(m_pSpillFile);
+        m_pSpillFile = NULL;
+        return (0 == res);
+    }
+    return true;
+}
+
+size_t MultipartParser::Process(const char *data, size_t len)
+{
+    size_t pos = 0;
+    while (true) {
+        switch (m_nState) {
+            case MULTIPART_START:
+                // the first delimiter is not preceded by CRLF
+                if ((len - pos) < (m_sDelimiter.length() - 2)) {
+                    return pos;
+                }
+                if (0 == memcmp(data + pos, m_sDelimiter.data() + 2, m_sDelimiter.length() - 2)) {
+                    pos += m_sDelimiter.length() - 2;
+                    m_nState = MULTIPART_DELIMITER;
+                } else {
+                    m_nState = MULTIPART_PREAMBLE;
+                }
+                break;
+
+            case MULTIPART_PREAMBLE:
+            case MULTIPART_BODY:
+                {
+                    const char *d = FindDelimiter(data + pos, len - pos);
+                    size_t n;
+                    if (NULL == d) {
+                        // Keep what might be the start of a delimiter
+                        n = len - pos;
+                        n = (n < m_sDelimiter.length()) ? 0 : (n - m_sDelimiter.length() + 1);
+                    } else {
+                        n = d - (data + pos);
+                    }
+                    if ((MULTIPART_BODY == m_nState) && (!AppendPart(data + pos, n))) {
+                        m_nState = MULTIPART_INVALID;
+                        return pos;
+                    }
+                    pos += n;
+                    if (NULL == d) {
+                        return pos;
+                    }
+                    pos += m_sDelimiter.length();
+                    if ((MULTIPART_BODY == m_nState) && (!EndPart())) {
+                        m_nState = MULTIPART_INVALID;
+                        return pos;
+                    }
+                    m_nState = MULTIPART_DELIMITER;
+                }
+                break;
+
+            case MULTIPART_DELIMITER:
+                // RFC 2046: a delimiter may be followed by white space before the CRLF
+                while ((pos < len) && IsLinearWhiteSpace(data[pos])) {
+                    ++pos;
+                }
+                if ((len - pos) < 2) {
+                    return pos;
+                }
+                if (('-' == data[pos]) && ('-' == data[pos + 1])) {
+                    // close delimiter, ignore the epilogue
+                    m_nState = MULTIPART_DONE;
+                    return len;
+                }
+                if (('\r' != data[pos]) || ('\n' != data[pos + 1])) {
+                    m_nState = MULTIPART_INVALID;
+                    return pos;
+                }
+                pos += 2;
+                m_nState = MULTIPART_HEADERS;
+                break;
+
+            case MULTIPART_HEADERS:
+                {
+                    if (((len - pos) >= 2) && ('\r' == data[pos]) && ('\n' == data[pos + 1])) {
+                        // no headers at all
+                        StartPart(data + pos, 0);
+                        pos += 2;
+                        m_nState = MULTIPART_BODY;
+                        break;
+                    }
+                    static const char s_sHeadersEnd[] = "\r\n\r\n";
+                    const char *end = data + len;
+                    const char *e = search(data + pos, end, s_sHeadersEnd, s_sHeadersEnd + 4);
+                    if (end == e) {
+                        if ((len - pos) > MAX_PART_HEADERS) {
+                            m_nState = MULTIPART_INVALID;
+                        }
+                        return pos;
+                    }
+                    StartPart(data + pos, (e + 2) - (data + pos));
+                    pos = (e + 4) - data;
+                    m_nState = MULTIPART_BODY;
+                }
+                break;
+
+            case MULTIPART_DONE:
+                return len;
+
+            case MULTIPART_INVALID:
+            default:
+                return pos;
+        }
+    }
+}
+
+bool MultipartParser::Feed(const char *data, size_t len)
+{
+    if (MULTIPART_INVALID == m_nState) {
+        return false;
+    }
+    if (m_sPending.empty()) {
+        size_t n = Process(data, len);
+        m_sPending.assign(data + n, len - n);
+    } else {
+        m_sPending.append(data, len);
+        size_t n = Process(m_sPending.data(), m_sPending.length());
+        m_sPending.erase(0, n);
+    }
+    return (MULTIPART_INVALID != m_nState);
+}
+
+bool MultipartParser::Finish()
+{
+    if (MULTIPART_DONE != m_nState) {
+        EndPart();
+        m_nState = MULTIPART_INVALID;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "networkabstraction.h"
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef _WIN32
+# include <io.h>
+#endif
+#include <cerrno>
+
+int NetworkAbstraction::SendFile(int fd, off_t offset, size_t length)
+{
+    // Used for TLS and on platforms without sendfile, hence only a small buffer.
+    char buf[16384];
+#ifdef _WIN32
+    if (-1 == _lseeki64(fd, offset, SEEK_SET)) {
+        return -1;
+    }
+#endif
+    while (0 < length) {
+        size_t n = (length < sizeof(buf)) ? length : sizeof(buf);
+#ifdef _WIN32
+        int r = _read(fd, buf, static_cast<unsigned int>(n));
+#else
+        ssize_t r = pread(fd, buf, n, offset);
+#endif
+        if (r < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        if (0 == r) {
+            // The file has been truncated.
+            return -1;
+        }
+        if (-1 == Send(buf, r)) {
+            return -1;
+        }
+        offset += r;
+        length -= r;
+    }
+    return 0;
+}
@@ -0,0 +1,381 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "rangeresponder.h"
+#include "httpresponse.h"
+#include "httprequest.h"
+#include "cachedclock.h"
+#include "debug.h"
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef _WIN32
+# include <io.h>
+#endif
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+
+// size of the pieces produced for multipart/byteranges of a file body
+static const size_t RANGE_PIECE = 65536;
+
+/**
+ * Produces a multipart/byteranges body from parts of a file.
+ * Only the requested bytes are read, one piece at a time.
+ */
+class FileRangesProducer : public ResponseProducer {
+
+    public:
+
+        /// A part of the file and the part headers preceding it
+        struct Part {
+            Part() : head(), offset(0), length(0) { }
+            string head;
+            off_t offset;
+            size_t length;
+        };
+
+        FileRangesProducer(int fd, const vector<Part> & parts, const string & trailer) :
+            m_nFd(fd),
+            m_oParts(parts),
+            m_sTrailer(trailer),
+            m_nPart(0),
+            m_nDone(0),
+            m_bHeadSent(false)
+        {
+        }
+
+        virtual ~FileRangesProducer()
+        {
+            close(m_nFd);
+        }
+
+        virtual bool Produce(HttpResponse *, string &out)
+        {
+            while ((out.length() < RANGE_PIECE) && (m_nPart < m_oParts.size())) {
+                const Part & p = m_oParts[m_nPart];
+                if (!m_bHeadSent) {
+                    out.append(p.head);
+                    m_bHeadSent = true;
+                }
+                size_t room = (out.length() < RANGE_PIECE) ? RANGE_PIECE - out.length() : 0;
+                size_t n = min(p.length - m_nDone, room);
+                Read(p.offset + m_nDone, n, out);
+                m_nDone += n;
+                if (m_nDone == p.length) {
+                    m_nPart++;
+                    m_nDone = 0;
+                    m_bHeadSent = false;
+                }
+            }
+            if (m_nPart < m_oParts.size()) {
+                return true;
+            }
+            out.append(m_sTrailer);
+            return false;
+        }
+
+    private:
+
+        FileRangesProducer(const FileRangesProducer &);
+
+        FileRangesProducer & operator=(const FileRangesProducer &);
+
+        /// Appends length bytes of the file, starting at offset, to out.
+        void Read(off_t offset, size_t length, string &out)
+        {
+            size_t used = out.length();
+            out.resize(used + length);
+#ifdef _WIN32
+            if (-1 == _lseeki64(m_nFd, offset, SEEK_SET)) {
+                throw runtime_error("FileRangesProducer::Read: Could not seek.");
+            }
+#endif
+            while (0 < length) {
+#ifdef _WIN32
+                int r = _read(m_nFd, &out[used], static_cast<unsigned int>(length));
+#else
+                ssize_t r = pread(m_nFd, &out[used], length, offset);
+#endif
+                if ((0 > r) && (EINTR == errno)) {
+                    continue;
+                }
+                if (0 >= r) {
+                    // error or truncated file
+                    throw runtime_error("FileRangesProducer::Read: Could not read file.");
+                }
+                used += r;
+                offset += r;
+                length -= r;
+            }
+        }
+
+        int m_nFd;
+
+        vector<Part> m_oParts;
+
+        /// the closing boundary
+        string m_sTrailer;
+
+        /// index of the current part
+        size_t m_nPart;
+
+        /// bytes of the current part, which have been produced
+        size_t m_nDone;
+
+        /// Flag: the head of the current part has been produced
+        bool m_bHeadSent;
+};
+
+/**
+ * Parses a decimal position.
+ * @return false, if str is empty or contains anything but digits.
+ */
+static bool ParsePosition(const string & str, size_t & pos)
+{
+    if (str.empty() || (string::npos != str.find_first_not_of("0123456789"))) {
+        return false;
+    }
+    errno = 0;
+    unsigned long long n = strtoull(str.c_str(), NULL, 10);
+    if ((ERANGE == errno) || (n != static_cast<size_t>(n))) {
+        // larger than any body
+        n = static_cast<size_t>(-1);
+    }
+    pos = static_cast<size_t>(n);
+    return true;
+}
+
+RangeResponder::RangeResponder() :
+    m_nMaxRanges(0)
+{
+}
+
+void RangeResponder::Configure(EHSServerParameters & params)
+{
+    if (params.find("maxranges") != params.end()) {
+        m_nMaxRanges = (unsigned long)params["maxranges"];
+    }
+}
+
+bool RangeResponder::Parse(const string & spec, size_t length, vector<Range> & ranges)
+{
+    string s = boost::trim_copy(spec);
+    if (!boost::istarts_with(s, "bytes=")) {
+        return false;
+    }
+    vector<string> items;
+    boost::split(items, s.substr(6), boost::is_any_of(","));
+    // RFC 7233 requires at least one range-spec, empty list items don't count
+    bool seen = false;
+    for (size_t i = 0; i < items.size(); ++i) {
+        string item = boost::trim_copy(items[i]);
+        if (item.empty()) {
+            continue;
+        }
+        seen = true;
+        size_t dash = item.find('-');
+        if (string::npos == dash) {
+            return false;
+        }
+        string first = boost::trim_copy(item.substr(0, dash));
+        string last = boost::trim_copy(item.substr(dash + 1));
+        size_t a, b;
+        if (first.empty()) {
+            // suffix range: the last b bytes
+            if (!ParsePosition(last, b)) {
+                return false;
+            }
+            if ((0 < b) && (0 < length)) {
+                ranges.push_back(Range((b < length) ? length - b : 0, length - 1));
+            }
+            continue;
+        }
+        if (!ParsePosition(first, a)) {
+            return false;
+        }
+        if (last.empty()) {
+            b = length - 1;
+        } else if ((!ParsePosition(last, b)) || (b < a)) {
+            return false;
+        }
+        if (a < length) {
+            ranges.push_back(Range(a, min(b, length - 1)));
+        }
+    }
+    if (ranges.empty()) {
+        return seen;
+    }
+    sort(ranges.begin(), ranges.end());
+    // merge overlapping and adjacent ranges
+    size_t n = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].first <= ranges[n].second + 1) {
+            ranges[n].second = max(ranges[n].second, ranges[i].second);
+        } else {
+            ranges[++n] = ranges[i];
+        }
+    }
+    ranges.resize(n + 1);
+    return true;
+}
+
+bool RangeResponder::IfRangeMatches(const string & condition, HttpResponse *response)
+{
+    StringCaseMap & headers = response->GetHeaders();
+    string c = boost::trim_copy(condition);
+    if (0 == c.compare(0, 2, "W/")) {
+        // weak tags never match (strong comparison)
+        return false;
+    }
+    if (0 == c.compare(0, 1, "\"")) {
+        StringCaseMap::const_iterator etag = headers.find(HEADER_ETAG);
+        return (headers.end() != etag) && (etag->second == c);
+    }
+    // a date must be identical to an explicitly set Last-Modified
+    StringCaseMap::const_iterator lm = headers.find(HEADER_LAST_MODIFIED);
+    if (headers.end() == lm) {
+        return false;
+    }
+    time_t modified = CachedClock::Parse(lm->second);
+    return (-1 != modified) && (modified == CachedClock::Parse(c));
+}
+
+void RangeResponder::Apply(HttpRequest *request, HttpResponse *response)
+{
+    if ((0 == m_nMaxRanges) || (HTTPRESPONSECODE_200_OK != response->GetResponseCode()) ||
+            (REQUESTMETHOD_GET != request->Method())) {
+        return;
+    }
+    // Produced bodies have an unknown length and an explicit Content-Length
+    // means, the application takes care of the body.
+    StringCaseMap & headers = response->GetHeaders();
+    if ((NULL != response->GetBodyProducer()) ||
+            (headers.end() != headers.find(HEADER_CONTENT_LENGTH))) {
+        return;
+    }
+    // Without a validator, a client resuming a download can't tell,
+    // whether a dynamic body has changed in the meantime.
+    if ((!response->HasBodyFile()) && (headers.end() == headers.find(HEADER_ETAG)) &&
+            (headers.end() == headers.find(HEADER_LAST_MODIFIED))) {
+        return;
+    }
+    headers["Accept-Ranges"] = "bytes";
+    StringCaseMap & rh = request->Headers();
+    StringCaseMap::const_iterator range = rh.find(HEADER_RANGE);
+    if (rh.end() == range) {
+        return;
+    }
+    StringCaseMap::const_iterator ifrange = rh.find(HEADER_IF_RANGE);
+    if ((rh.end() != ifrange) && (!IfRangeMatches(ifrange->second, response))) {
+        return;
+    }
+    size_t length = response->BodyLength();
+    vector<Range> ranges;
+    if ((!Parse(range->second, length, ranges)) || (ranges.size() > m_nMaxRanges)) {
+        return;
+    }
+    char buf[96];
+    if (ranges.empty()) {
+        EHS_TRACE("Unsatisfiable range '%s'", range->second.c_str());
+        response->SetBody("", 0);
+        response->SetResponseCode(HTTPRESPONSECODE_416_RANGE_NOT_SATISFIABLE);
+        snprintf(buf, sizeof(buf), "bytes */%lu", static_cast<unsigned long>(length));
+        headers["Content-Range"] = buf;
+        return;
+    }
+    response->SetResponseCode(HTTPRESPONSECODE_206_PARTIAL_CONTENT);
+    if (1 == ranges.size()) {
+        const Range & r = ranges[0];
+        snprintf(buf, sizeof(buf), "bytes %lu-%lu/%lu", static_cast<unsigned long>(r.first),
+                static_cast<unsigned long>(r.second), static_cast<unsigned long>(length));
+        headers["Content-Range"] = buf;
+        if (response->HasBodyFile()) {
+            // sendfile() starts at the requested offset
+            response->m_nBodyFileOffset += r.first;
+            response->m_nBodyFileLength = r.second - r.first + 1;
+        } else {
+            string & body = response->GetBody();
+            body.erase(r.second + 1);
+            body.erase(0, r.first);
+        }
+        return;
+    }
+
+    // multipart/byteranges
+    string type = response->Header("Content-Type");
+    snprintf(buf, sizeof(buf), "%08lx%016lx", static_cast<unsigned long>(CachedClock::Now()),
+            static_cast<unsigned long>(reinterpret_cast<size_t>(response)));
+    string boundary(buf);
+    vector<FileRangesProducer::Part> parts(ranges.size());
+    size_t total = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        string & head = parts[i].head;
+        head.assign((0 == i) ? "--" : "\r\n--").append(boundary).append("\r\n");
+        if (!type.empty()) {
+            head.append("Content-Type: ").append(type).append("\r\n");
+        }
+        snprintf(buf, sizeof(buf), "Content-Range: bytes %lu-%lu/%lu\r\n\r\n",
+                static_cast<unsigned long>(ranges[i].first),
+                static_cast<unsigned long>(ranges[i].second), static_cast<unsigned long>(length));
+        head.append(buf);
+        parts[i].offset = ranges[i].first;
+        parts[i].length = ranges[i].second - ranges[i].first + 1;
+        total += head.length() + parts[i].length;
+    }
+    string trailer = "\r\n--" + boundary + "--\r\n";
+    total += trailer.length();
+    headers["Content-Type"] = "multipart/byteranges; boundary=" + boundary;
+    if (response->HasBodyFile()) {
+        for (size_t i = 0; i < parts.size(); ++i) {
+            parts[i].offset += response->m_nBodyFileOffset;
+        }
+        // The producer takes over the file descriptor.
+        int fd = response->m_nBodyFd;
+        response->m_nBodyFd = -1;
+        response->SetBodyProducer(new FileRangesProducer(fd, parts, trailer));
+        snprintf(buf, sizeof(buf), "%lu", static_cast<unsigned long>(total));
+        headers["Content-Length"] = buf;
+    } else {
+        string & body = response->GetBody();
+        string out;
+        out.reserve(total);
+        for (size_t i = 0; i < parts.size(); ++i) {
+            out.append(parts[i].head).append(body, parts[i].offset, parts[i].length);
+        }
+        out.append(trailer);
+        body.swap(out);
+    }
+}
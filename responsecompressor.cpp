@@ -0,0 +1,405 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "responsecompressor.h"
+#include "httpresponse.h"
+#include "httprequest.h"
+#include "debug.h"
+
+#include <zlib.h>
+#include <cstdlib>
+#include <stdexcept>
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+
+/**
+ * Encoder for the zlib based codings.
+ */
+class ZlibEncoder : public ResponseEncoder {
+
+    public:
+
+        ZlibEncoder() : m_oStream() { }
+
+        virtual ~ZlibEncoder()
+        {
+            // safe, even if Init has failed
+            deflateEnd(&m_oStream);
+        }
+
+        /**
+         * Initializes the compressor.
+         * @param level The compression level (1 - 9).
+         * @param windowBits 15 for the zlib format, 16 + 15 for gzip.
+         * @return false, if zlib could not be initialized.
+         */
+        bool Init(int level, int windowBits)
+        {
+            return (Z_OK == deflateInit2(&m_oStream, level, Z_DEFLATED,
+                        windowBits, 8, Z_DEFAULT_STRATEGY));
+        }
+
+        virtual bool Encode(const char *data, size_t len, bool finish, string &out)
+        {
+            if ((0 == len) && !finish) {
+                return true;
+            }
+            m_oStream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            m_oStream.avail_in = len;
+            // Intermediate pieces are flushed to a byte boundary, so that
+            // the client can decode everything which has been sent so far.
+            int flush = finish ? Z_FINISH : Z_SYNC_FLUSH;
+            for (;;) {
+                size_t used = out.length();
+                size_t room = deflateBound(&m_oStream, m_oStream.avail_in) + 16;
+                out.resize(used + room);
+                m_oStream.next_out = reinterpret_cast<Bytef *>(&out[used]);
+                m_oStream.avail_out = room;
+                int r = deflate(&m_oStream, flush);
+                out.resize(used + room - m_oStream.avail_out);
+                if (Z_STREAM_END == r) {
+                    return true;
+                }
+                if ((Z_OK != r) && (Z_BUF_ERROR != r)) {
+                    return false;
+                }
+                if (0 != m_oStream.avail_out) {
+                    // All output has been flushed. With Z_FINISH, this
+                    // would have returned Z_STREAM_END.
+                    return !finish;
+                }
+            }
+        }
+
+    private:
+
+        ZlibEncoder(const ZlibEncoder &);
+
+        ZlibEncoder & operator=(const ZlibEncoder &);
+
+        z_stream m_oStream;
+};
+
+/**
+ * The built-in codings gzip and deflate.
+ * deflate means the zlib format (RFC 7230, Section 4.2.2).
+ */
+class ZlibCoding : public ContentCoding {
+
+    public:
+
+        ZlibCoding(const char *name, int windowBits) :
+            m_sName(name),
+            m_nWindowBits(windowBits)
+        {
+        }
+
+        virtual const char *Name() const { return m_sName; }
+
+        virtual ResponseEncoder *CreateEncoder(int level)
+        {
+            ZlibEncoder *ret = new ZlibEncoder();
+            if (!ret->Init(level, m_nWindowBits)) {
+                delete ret;
+                return NULL;
+            }
+            return ret;
+        }
+
+    private:
+
+        ZlibCoding(const ZlibCoding &);
+
+        ZlibCoding & operator=(const ZlibCoding &);
+
+        const char *m_sName;
+
+        int m_nWindowBits;
+};
+
+/**
+ * Wraps the producer of a response and compresses each piece.
+ */
+class EncodingProducer : public ResponseProducer {
+
+    public:
+
+        EncodingProducer(ResponseProducer *producer, ResponseEncoder *encoder) :
+            m_poProducer(producer),
+            m_poEncoder(encoder),
+            m_sPiece("")
+        {
+        }
+
+        virtual ~EncodingProducer()
+        {
+            delete m_poProducer;
+            delete m_poEncoder;
+        }
+
+        virtual bool Produce(HttpResponse *response, string &out)
+        {
+            m_sPiece.clear();
+            bool more = m_poProducer->Produce(response, m_sPiece);
+            if (!m_poEncoder->Encode(m_sPiece.data(), m_sPiece.length(), !more, out)) {
+                throw runtime_error("EncodingProducer::Produce: Could not compress body.");
+            }
+            return more;
+        }
+
+    private:
+
+        EncodingProducer(const EncodingProducer &);
+
+        EncodingProducer & operator=(const EncodingProducer &);
+
+        ResponseProducer *m_poProducer;
+
+        ResponseEncoder *m_poEncoder;
+
+        /// uncompressed piece, reused for each call
+        string m_sPiece;
+};
+
+/// Content types, which are compressed already and therefore sent unchanged.
+static const char *s_aCompressedTypes[] = {
+    "image/*", "video/*", "audio/*", "font/woff", "font/woff2",
+    "application/zip", "application/gzip", "application/x-gzip",
+    "application/zstd", "application/x-bzip2", "application/x-xz",
+    "application/x-7z-compressed", "application/x-rar-compressed",
+    "application/vnd.rar", NULL
+};
+
+/**
+ * Matches a content type against a pattern.
+ * @param type The content type, in lower case without parameters.
+ * @param pattern A content type, or a wildcard like "image/" followed by an asterisk,
+ *   which matches all subtypes.
+ */
+static bool MatchType(const string & type, const string & pattern)
+{
+    size_t plen = pattern.length();
+    if ((2 < plen) && (0 == pattern.compare(plen - 2, 2, "/*"))) {
+        return (type.length() > plen - 1) && (0 == type.compare(0, plen - 1, pattern, 0, plen - 1));
+    }
+    return type == pattern;
+}
+
+ResponseCompressor::ResponseCompressor() :
+    m_bEnabled(false),
+    m_nMinSize(1024),
+    m_nLevel(6),
+    m_oLevels(vector<TypeLevel>()),
+    m_oCodings(vector<ContentCoding *>()),
+    m_oOwnCodings(vector<ContentCoding *>())
+{
+    m_oOwnCodings.push_back(new ZlibCoding("gzip", 16 + 15));
+    m_oOwnCodings.push_back(new ZlibCoding("deflate", 15));
+    m_oCodings = m_oOwnCodings;
+}
+
+ResponseCompressor::~ResponseCompressor()
+{
+    for (size_t i = 0; i < m_oOwnCodings.size(); ++i) {
+        delete m_oOwnCodings[i];
+    }
+}
+
+void ResponseCompressor::Configure(EHSServerParameters & params, const ContentCodingList & codings)
+{
+    if (params.find("compressresponses") != params.end()) {
+        m_bEnabled = (0 != (unsigned long)params["compressresponses"]);
+    }
+    if (params.find("compressminsize") != params.end()) {
+        m_nMinSize = (unsigned long)params["compressminsize"];
+    }
+    if (params.find("compresslevel") != params.end()) {
+        m_nLevel = max(0, min(9, params["compresslevel"].GetInt()));
+    }
+    m_oLevels.clear();
+    if (params.find("compresslevels") != params.end()) {
+        // "type=level,type/*=level,..."
+        string spec = params["compresslevels"];
+        vector<string> items;
+        boost::split(items, spec, boost::is_any_of(","));
+        for (size_t i = 0; i < items.size(); ++i) {
+            size_t eq = items[i].find('=');
+            if (string::npos == eq) {
+                continue;
+            }
+            string type = boost::to_lower_copy(boost::trim_copy(items[i].substr(0, eq)));
+            int level = atoi(items[i].c_str() + eq + 1);
+            if (!type.empty()) {
+                m_oLevels.push_back(TypeLevel(type, max(0, min(9, level))));
+            }
+        }
+    }
+    m_oCodings.assign(codings.begin(), codings.end());
+    m_oCodings.insert(m_oCodings.end(), m_oOwnCodings.begin(), m_oOwnCodings.end());
+}
+
+int ResponseCompressor::Level(const string & contenttype) const
+{
+    string type = boost::to_lower_copy(boost::trim_copy(contenttype.substr(0, contenttype.find(';'))));
+    // exact matches take precedence over type/* patterns
+    for (int wild = 0; wild < 2; ++wild) {
+        for (size_t i = 0; i < m_oLevels.size(); ++i) {
+            const string & p = m_oLevels[i].first;
+            bool isWild = (2 < p.length()) && (0 == p.compare(p.length() - 2, 2, "/*"));
+            if ((isWild == (1 == wild)) && MatchType(type, p)) {
+                return m_oLevels[i].second;
+            }
+        }
+    }
+    // SVG is text, despite being an image
+    if (type != "image/svg+xml") {
+        for (const char **p = s_aCompressedTypes; NULL != *p; ++p) {
+            if (MatchType(type, *p)) {
+                return 0;
+            }
+        }
+    }
+    return m_nLevel;
+}
+
+ContentCoding *ResponseCompressor::Negotiate(const string & accept) const
+{
+    // qualities of the listed codings, -1 = not listed
+    vector<double> quality(m_oCodings.size(), -1.0);
+    double star = -1.0;
+    vector<string> items;
+    boost::split(items, accept, boost::is_any_of(","));
+    for (size_t i = 0; i < items.size(); ++i) {
+        size_t semi = items[i].find(';');
+        string name = boost::to_lower_copy(boost::trim_copy(items[i].substr(0, semi)));
+        double q = 1.0;
+        while (string::npos != semi) {
+            size_t next = items[i].find(';', semi + 1);
+            string param = boost::trim_copy(items[i].substr(semi + 1,
+                        (string::npos == next) ? string::npos : next - semi - 1));
+            if ((2 <= param.length()) && ('=' == param[1]) && ('q' == tolower(param[0]))) {
+                q = strtod(param.c_str() + 2, NULL);
+            }
+            semi = next;
+        }
+        if ("*" == name) {
+            star = q;
+            continue;
+        }
+        if ("x-gzip" == name) {
+            name = "gzip";
+        }
+        for (size_t c = 0; c < m_oCodings.size(); ++c) {
+            if (boost::iequals(name, m_oCodings[c]->Name())) {
+                quality[c] = q;
+            }
+        }
+    }
+    // On equal quality, the first coding wins.
+    ContentCoding *ret = NULL;
+    double best = 0.0;
+    for (size_t c = 0; c < m_oCodings.size(); ++c) {
+        double q = (0.0 <= quality[c]) ? quality[c] : star;
+        if (q > best) {
+            best = q;
+            ret = m_oCodings[c];
+        }
+    }
+    return ret;
+}
+
+void ResponseCompressor::Apply(HttpRequest *request, HttpResponse *response)
+{
+    if (!m_bEnabled) {
+        return;
+    }
+    ResponseCode code = response->GetResponseCode();
+    if ((200 > code) || (HTTPRESPONSECODE_304_NOT_MODIFIED == code) ||
+            (HTTPRESPONSECODE_206_PARTIAL_CONTENT == code) || (204 == code) ||
+            (HTTPRESPONSECODE_416_RANGE_NOT_SATISFIABLE == code)) {
+        return;
+    }
+    // File bodies are sent with sendfile() and an explicit Content-Length
+    // or Content-Encoding means, the application takes care of the body.
+    StringCaseMap & headers = response->GetHeaders();
+    if (response->HasBodyFile() ||
+            (headers.end() != headers.find(HEADER_CONTENT_ENCODING)) ||
+            (headers.end() != headers.find(HEADER_CONTENT_LENGTH))) {
+        return;
+    }
+    ResponseProducer *producer = response->GetBodyProducer();
+    string & body = response->GetBody();
+    if ((NULL == producer) && (body.length() < m_nMinSize)) {
+        return;
+    }
+    int level = Level(response->Header("Content-Type"));
+    if (0 >= level) {
+        return;
+    }
+
+    // From here on, the representation depends on Accept-Encoding.
+    StringCaseMap::iterator vary = headers.find(HEADER_VARY);
+    if (headers.end() == vary) {
+        headers["Vary"] = "Accept-Encoding";
+    } else if ((vary->second != "*") && !boost::icontains(vary->second, "accept-encoding")) {
+        vary->second.append(", Accept-Encoding");
+    }
+
+    StringCaseMap::iterator ae = request->Headers().find(HEADER_ACCEPT_ENCODING);
+    if (request->Headers().end() == ae) {
+        return;
+    }
+    ContentCoding *coding = Negotiate(ae->second);
+    if (NULL == coding) {
+        return;
+    }
+    ResponseEncoder *encoder = coding->CreateEncoder(level);
+    if (NULL == encoder) {
+        EHS_TRACE("Could not create encoder for %s", coding->Name());
+        return;
+    }
+    if (NULL != producer) {
+        response->m_poProducer = new EncodingProducer(producer, encoder);
+    } else {
+        string out;
+        bool ok = encoder->Encode(body.data(), body.length(), true, out);
+        delete encoder;
+        if ((!ok) || (out.length() >= body.length())) {
+            return;
+        }
+        body.swap(out);
+    }
+    headers["Content-Encoding"] = coding->Name();
+    // A strong validator must not be shared by different encodings.
+    StringCaseMap::iterator etag = headers.find(HEADER_ETAG);
+    if ((headers.end() != etag) && (0 == etag->second.compare(0, 1, "\""))) {
+        etag->second.insert(0, "W/");
+    }
+}
@@ -74,7 +74,7 @@ class TestHarness : public EHS
             << "<tr><td>client-address:</td><td>" << request->RemoteAddress() << "</td></tr>" << endl
             << "<tr><td>client-port:</td><td>" << request->RemotePort() << "</td></tr>" << endl;
 
-        for (StringMap::iterator i = request->Headers().begin();
+        for (StringCaseMap::iterator i = request->Headers().begin();
                 i != request->Headers().end(); ++i) {
             oss << "<tr><td>Request Header:</td><td>"
                 << i->first << " => " << i->second << "</td></tr>" << endl;
@@ -99,7 +99,7 @@ class TestHarness : public EHS
      */
     bool CheckAuthHeader(HttpRequest *r)
     {
-        StringMap::iterator i;
+        StringCaseMap::iterator i;
         for (i = r->Headers().begin() ; i != r->Headers().end() ; ++i) {
             if (0 == i->first.compare("Authorization")) {
                 if (0 == i->second.compare(0, 6, "Basic ")) {
@@ -73,7 +73,7 @@ class TestHarness : public EHS
             << "<tr><td>client-address:</td><td>" << request->RemoteAddress ( ) << "</td></tr>" << endl
             << "<tr><td>client-port:</td><td>" << request->RemotePort ( ) << "</td></tr>" << endl;
 
-        for ( StringMap::iterator i = request->Headers().begin ( );
+        for ( StringCaseMap::iterator i = request->Headers().begin ( );
                 i != request->Headers().end ( ); ++i ) {
             oss << "<tr><td>Request Header:</td><td>" << i->first << " => " << i->second << "</td></tr>" << endl;
         }
@@ -33,6 +33,8 @@
 #include <iostream>
 #include <sstream>
 #include <cstdlib>
+#include <cstdio>
+#include <sys/stat.h>
 #include "common.h"
 #ifdef _WIN32
 #include <io.h>
@@ -68,9 +70,16 @@ ResponseCode FileUploader::HandleRequest ( HttpRequest * request, HttpResponse *
     }
 
     if (sUri == "/upload.html") {
-        int nFileSize = request->FormValues("file").m_sBody.length();
-        string sFileName = request->FormValues("file").
-            m_oContentDisposition.m_oContentDispositionHeaders["filename"];
+        FormValue & roFile = request->FormValues("file");
+        int nFileSize = roFile.m_sBody.length();
+        if (!roFile.m_sTempFile.empty()) {
+            // Large uploads have been written to a temporary file
+            struct stat st;
+            if (0 == stat(roFile.m_sTempFile.c_str(), &st)) {
+                nFileSize = st.st_size;
+            }
+        }
+        string sFileName = roFile.m_oContentDisposition.m_oContentDispositionHeaders["filename"];
         cerr << "nFileSize = " << nFileSize << endl;
         cerr << "sFileName = '" << sFileName << "'" << endl;
         CookieParameters statusCookie;
@@ -83,11 +92,26 @@ ResponseCode FileUploader::HandleRequest ( HttpRequest * request, HttpResponse *
             if (!sFileName.empty()) {
                 // For safety reasons, we do not allow writing to existing files.
                 if (0 != access(sFileName.c_str(), F_OK)) {
-                    cerr << "Writing " << nFileSize << " bytes to file" << endl;
-                    ofstream outfile(sFileName.c_str(), ios::out | ios::trunc | ios::binary );
-                    outfile.write(request->FormValues("file").m_sBody.c_str(), nFileSize);
-                    outfile.close();
-                    statusCookie["value"] = "Uploaded file successfully.";
+                    if (roFile.m_sTempFile.empty()) {
+                        cerr << "Writing " << nFileSize << " bytes to file" << endl;
+                        ofstream outfile(sFileName.c_str(), ios::out | ios::trunc | ios::binary );
+                        outfile.write(roFile.m_sBody.c_str(), nFileSize);
+                        outfile.close();
+                        statusCookie["value"] = "Uploaded file successfully.";
+                    } else if (0 == rename(roFile.m_sTempFile.c_str(), sFileName.c_str())) {
+                        // The file is ours now, so EHS must not remove it.
+                        cerr << "Moved " << nFileSize << " bytes to file" << endl;
+                        roFile.m_sTempFile.clear();
+                        statusCookie["value"] = "Uploaded file successfully.";
+                    } else {
+                        // Different file system, copy it. EHS removes the temporary file.
+                        cerr << "Copying " << nFileSize << " bytes to file" << endl;
+                        ifstream infile(roFile.m_sTempFile.c_str(), ios::in | ios::binary);
+                        ofstream outfile(sFileName.c_str(), ios::out | ios::trunc | ios::binary );
+                        outfile << infile.rdbuf();
+                        outfile.close();
+                        statusCookie["value"] = "Uploaded file successfully.";
+                    }
                 } else {
                     statusCookie["value"] = "No permission to overwrite a file.";
                 }
@@ -120,6 +144,7 @@ int main(int argc, char ** argv)
     oSP["port"] = argv[1];
     oSP["mode"] = "threadpool";
     oSP["maxrequestsize"] = 1024 * 1024 * 10;
+    oSP["multipartspillsize"] = 1024 * 64;
     try {
         srv.StartServer(oSP);
         kbdio kbd;
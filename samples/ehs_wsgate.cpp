@@ -35,7 +35,6 @@
 #include <vector>
 #include <sstream>
 #include <iostream>
-#include <fstream>
 #include <stdexcept>
 #include <typeinfo>
 #include <cstdlib>
@@ -107,21 +106,10 @@ class WsGate : public EHS
     ResponseCode HandleRequest(HttpRequest *request, HttpResponse *response)
     {
         if ((0 == request->Uri().compare("/")) || (0 == request->Uri().compare("/index.html"))) {
-            ifstream f("samples/wstest.html", ios::binary);
-            if (f.fail()) {
-                f.open("wstest.html", ios::binary);
-                if (f.fail()) {
-                    throw tracing::runtime_error("Failed to open html source");
-                }
+            if (!(response->SetBodyFile("samples/wstest.html") ||
+                        response->SetBodyFile("wstest.html"))) {
+                throw tracing::runtime_error("Failed to open html source");
             }
-            f.seekg (0, ios::end);
-            size_t fsize = f.tellg();
-            f.seekg (0, ios::beg);
-            char *buf = new char [fsize];
-            f.read (buf,fsize);
-            f.close();
-            response->SetBody(buf, fsize);
-            delete[] buf;
             return HTTPRESPONSECODE_200_OK;
         }
         if (0 == request->Uri().compare("/wsgate")) {
@@ -166,10 +154,7 @@ class WsGate : public EHS
                 digest[i] = htonl(digest[i]);
             }
 
-            response->RemoveHeader("Content-Type");
-            response->RemoveHeader("Content-Length");
-            response->RemoveHeader("Last-Modified");
-            response->RemoveHeader("Cache-Control");
+            response->SetDefaultHeaders(HttpResponse::DEFAULT_DATE);
 
             if (!MultivalHeaderContains(wsver, "13")) {
                 response->SetHeader("Sec-WebSocket-Version", "13");
@@ -59,7 +59,8 @@ SecureSocket::SecureSocket (const std::string & certfile,
     Socket(),
     m_pSsl(NULL),
     m_sCertFile(certfile),
-    m_poPassphraseHandler(handler)
+    m_poPassphraseHandler(handler),
+    m_sSendBuffer("")
 { 
     pthread_mutex_lock(&s_mutex);
     s_refcount++;
@@ -73,7 +74,8 @@ SecureSocket::SecureSocket (SSL *ssl, ehs_socket_t fd, sockaddr_in *peer) :
     Socket(fd, peer),
     m_pSsl(ssl),
     m_sCertFile(""),
-    m_poPassphraseHandler(NULL)
+    m_poPassphraseHandler(NULL),
+    m_sSendBuffer("")
 {
     pthread_mutex_lock(&s_mutex);
     s_refcount++;
@@ -373,6 +375,54 @@ again:
     return ret;
 }
 
+int SecureSocket::SendBuffers(const NetworkBuffer *bufs, size_t count)
+{
+    // Coalesce small pieces into TLS records of up to 16k, so that
+    // a header and its body do not end up in separate records.
+    static const size_t maxRecord = 16384;
+    int ret = 0;
+    m_sSendBuffer.clear();
+    for (size_t i = 0; i < count; ++i) {
+        const char *data = reinterpret_cast<const char *>(bufs[i].data);
+        if (m_sSendBuffer.length() + bufs[i].len <= maxRecord) {
+            m_sSendBuffer.append(data, bufs[i].len);
+            continue;
+        }
+        if (!m_sSendBuffer.empty()) {
+            int r = Send(m_sSendBuffer.data(), m_sSendBuffer.length());
+            m_sSendBuffer.clear();
+            if (-1 == r) {
+                return -1;
+            }
+            ret += r;
+        }
+        if (bufs[i].len < maxRecord) {
+            m_sSendBuffer.assign(data, bufs[i].len);
+        } else {
+            int r = Send(data, bufs[i].len);
+            if (-1 == r) {
+                return -1;
+            }
+            ret += r;
+        }
+    }
+    if (!m_sSendBuffer.empty()) {
+        int r = Send(m_sSendBuffer.data(), m_sSendBuffer.length());
+        m_sSendBuffer.clear();
+        if (-1 == r) {
+            return -1;
+        }
+        ret += r;
+    }
+    return ret;
+}
+
+int SecureSocket::SendFile(int fd, off_t offset, size_t length)
+{
+    // The data has to be encrypted, so sendfile cannot be used.
+    return NetworkAbstraction::SendFile(fd, offset, length);
+}
+
 void SecureSocket::Close()
 {
     Socket::Close();
@@ -54,6 +54,12 @@
 #include "socket.h"
 #include "debug.h"
 
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+# include <signal.h>
+# include <pthread.h>
+#endif
+
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0 // no support
 #endif // MSG_NOSIGNAL
@@ -282,6 +288,105 @@ again:
     return ret;
 }
 
+int Socket::SendBuffers(const NetworkBuffer *bufs, size_t count)
+{
+#if defined(_WIN32) || !defined(HAVE_SYS_UIO_H)
+    return NetworkAbstraction::SendBuffers(bufs, count);
+#else
+    // Maximum number of buffers per sendmsg call. Anything beyond
+    // is sent by subsequent calls.
+    static const size_t maxIov = 64;
+    struct iovec iov[maxIov];
+    int ret = 0;
+    // Index of the first buffer not sent completely and the number
+    // of bytes of that buffer which have been sent already.
+    size_t first = 0;
+    size_t skip = 0;
+    while (first < count) {
+        size_t n = 0;
+        for (size_t i = first; (i < count) && (n < maxIov); ++i) {
+            size_t offset = (i == first) ? skip : 0;
+            if (bufs[i].len > offset) {
+                iov[n].iov_base = const_cast<char *>(reinterpret_cast<const char *>(bufs[i].data)) + offset;
+                iov[n].iov_len = bufs[i].len - offset;
+                ++n;
+            }
+        }
+        if (0 == n) {
+            break;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t r = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+        if (r < 0) {
+            if ((EAGAIN == net_errno) || (EINTR == net_errno)) {
+                continue;
+            }
+            EHS_TRACE("sendmsg: %s", net_strerror());
+            return -1;
+        }
+        ret += r;
+        // Skip everything, that has been sent (a partial write is possible).
+        size_t sent = r;
+        while ((first < count) && (sent >= bufs[first].len - skip)) {
+            sent -= bufs[first].len - skip;
+            skip = 0;
+            ++first;
+        }
+        skip += sent;
+    }
+    return ret;
+#endif
+}
+
+int Socket::SendFile(int fd, off_t offset, size_t length)
+{
+#ifdef HAVE_SYS_SENDFILE_H
+    // sendfile has no MSG_NOSIGNAL, so SIGPIPE is blocked while sending
+    // and a SIGPIPE, raised by us, is consumed afterwards.
+    sigset_t pipeset;
+    sigset_t oldset;
+    sigemptyset(&pipeset);
+    sigaddset(&pipeset, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeset, &oldset);
+    int ret = 0;
+    while (0 < length) {
+        // Linux transfers at most 0x7ffff000 bytes per call.
+        size_t n = (length < 0x7ffff000) ? length : 0x7ffff000;
+        ssize_t r = sendfile(m_fd, fd, &offset, n);
+        if (r < 0) {
+            if ((EAGAIN == errno) || (EINTR == errno)) {
+                continue;
+            }
+            EHS_TRACE("sendfile: %s", strerror(errno));
+            if ((EINVAL == errno) || (ENOSYS == errno)) {
+                // Not supported for this kind of file, so read it.
+                pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+                return NetworkAbstraction::SendFile(fd, offset, length);
+            }
+            if (EPIPE == errno) {
+                struct timespec ts = { 0, 0 };
+                sigtimedwait(&pipeset, NULL, &ts);
+            }
+            ret = -1;
+            break;
+        }
+        if (0 == r) {
+            // The file has been truncated.
+            ret = -1;
+            break;
+        }
+        length -= r;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    return ret;
+#else
+    return NetworkAbstraction::SendFile(fd, offset, length);
+#endif
+}
+
 void Socket::Close()
 {
     if (INVALID_SOCKET == m_fd)
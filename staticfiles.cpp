@@ -0,0 +1,557 @@
+/* $Id$
+ *
+ * EHS is a library for embedding HTTP(S) support into a C++ application
+ *
+ * Copyright (C) 2004 Zachary J. Hansen
+ *
+ * Code cleanup, new features and bugfixes: Copyright (C) 2010 Fritz Elfert
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License version 2.1 as published by the Free Software Foundation;
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    This can be found in the 'COPYING' file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "staticfiles.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+#include "cachedclock.h"
+#include "mutexhelper.h"
+#include "debug.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef _WIN32
+# include <io.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <stdexcept>
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+
+/// Content types of common file extensions.
+static const char *s_aContentTypes[][2] = {
+    { "html", "text/html" },
+    { "htm", "text/html" },
+    { "css", "text/css" },
+    { "js", "text/javascript" },
+    { "mjs", "text/javascript" },
+    { "json", "application/json" },
+    { "map", "application/json" },
+    { "txt", "text/plain" },
+    { "csv", "text/csv" },
+    { "md", "text/markdown" },
+    { "xml", "application/xml" },
+    { "svg", "image/svg+xml" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "webp", "image/webp" },
+    { "avif", "image/avif" },
+    { "ico", "image/x-icon" },
+    { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf", "font/ttf" },
+    { "otf", "font/otf" },
+    { "mp3", "audio/mpeg" },
+    { "ogg", "audio/ogg" },
+    { "wav", "audio/wav" },
+    { "mp4", "video/mp4" },
+    { "webm", "video/webm" },
+    { "zip", "application/zip" },
+    { "gz", "application/gzip" },
+    { "tar", "application/x-tar" },
+    { NULL, NULL }
+};
+
+StaticFiles::StaticFiles(const string & root) :
+    EHS(),
+    m_sRoot(root),
+    m_sRealRoot(root),
+    m_nCacheSize(32 * 1024 * 1024),
+    m_nMaxFileSize(256 * 1024),
+    m_nMaxEntries(1024),
+    m_nMaxFds(64),
+    m_sIndexFile("index.html"),
+    m_oTypes(map<string, string>()),
+    m_oCache(CacheMap()),
+    m_oLru(list<string>()),
+    m_nCachedBytes(0),
+    m_nCachedFds(0),
+    m_oMutex(pthread_mutex_t()),
+    m_nNotifyFd(-1),
+    m_oWatches(map<int, string>()),
+    m_oWatchedDirs(map<string, int>())
+{
+    // The rest of the path names the file.
+    m_bNoRouting = true;
+    while ((1 < m_sRoot.length()) && ('/' == m_sRoot[m_sRoot.length() - 1])) {
+        m_sRoot.erase(m_sRoot.length() - 1);
+    }
+#ifndef _WIN32
+    char *real = realpath(m_sRoot.c_str(), NULL);
+    if (NULL == real) {
+        throw runtime_error("StaticFiles::StaticFiles: Invalid root directory.");
+    }
+    m_sRealRoot = real;
+    free(real);
+#endif
+    pthread_mutex_init(&m_oMutex, NULL);
+#ifdef HAVE_SYS_INOTIFY_H
+    m_nNotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (-1 == m_nNotifyFd) {
+        EHS_TRACE("inotify_init1 failed, falling back to stat()", "");
+    }
+#endif
+}
+
+StaticFiles::~StaticFiles()
+{
+    while (!m_oCache.empty()) {
+        Remove(m_oCache.begin());
+    }
+    if (-1 != m_nNotifyFd) {
+        close(m_nNotifyFd);
+    }
+    pthread_mutex_destroy(&m_oMutex);
+}
+
+void StaticFiles::AddContentType(const string & extension, const string & type)
+{
+    m_oTypes[boost::to_lower_copy(extension)] = type;
+}
+
+string StaticFiles::ContentType(const string & path) const
+{
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if ((string::npos == dot) || ((string::npos != slash) && (dot < slash))) {
+        return "application/octet-stream";
+    }
+    string ext = boost::to_lower_copy(path.substr(dot + 1));
+    map<string, string>::const_iterator i = m_oTypes.find(ext);
+    if (m_oTypes.end() != i) {
+        return i->second;
+    }
+    for (size_t n = 0; NULL != s_aContentTypes[n][0]; ++n) {
+        if (ext == s_aContentTypes[n][0]) {
+            return s_aContentTypes[n][1];
+        }
+    }
+    return "application/octet-stream";
+}
+
+bool StaticFiles::NormalizePath(const string & uri, string & path)
+{
+    string raw = uri.substr(0, uri.find_first_of("?#"));
+    string decoded;
+    decoded.reserve(raw.length());
+    for (size_t i = 0; i < raw.length(); ++i) {
+        char c = raw[i];
+        if ('%' == c) {
+            if ((i + 2 >= raw.length()) || !isxdigit(static_cast<unsigned char>(raw[i + 1])) ||
+                    !isxdigit(static_cast<unsigned char>(raw[i + 2]))) {
+                return false;
+            }
+            c = static_cast<char>(strtol(raw.substr(i + 1, 2).c_str(), NULL, 16));
+            i += 2;
+        }
+        // Backslashes are separators on Windows.
+        if (('\0' == c) || ('\\' == c)) {
+            return false;
+        }
+        decoded.push_back(c);
+    }
+    // Resolve the segments after decoding, so that escaped dots and
+    // slashes cannot be used to leave the root directory.
+    vector<string> segments;
+    boost::split(segments, decoded, boost::is_any_of("/"));
+    vector<string> out;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        if (segments[i].empty() || ("." == segments[i])) {
+            continue;
+        }
+        if (".." == segments[i]) {
+            if (out.empty()) {
+                return false;
+            }
+            out.pop_back();
+            continue;
+        }
+        out.push_back(segments[i]);
+    }
+    path = boost::join(out, "/");
+    if ((!path.empty()) && ('/' == decoded[decoded.length() - 1])) {
+        path.append("/");
+    }
+    return true;
+}
+
+StaticFiles::LoadResult StaticFiles::Load(const string & path, CacheEntry & entry)
+{
+#ifdef _WIN32
+    int fd = open(path.c_str(), O_RDONLY | O_BINARY);
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if (-1 == fd) {
+        return LOAD_NOTFOUND;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st)) {
+        close(fd);
+        return LOAD_NOTFOUND;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        close(fd);
+        return LOAD_DIRECTORY;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        return LOAD_NOTFOUND;
+    }
+#ifndef _WIN32
+    // Symbolic links must not lead out of the root directory.
+    char *real = realpath(path.c_str(), NULL);
+    string r;
+    if (NULL != real) {
+        r = real;
+        free(real);
+    }
+    const string & root = m_sRealRoot;
+    bool inside = (!r.empty()) && (("/" == root) || ((r.length() > root.length()) &&
+                (0 == r.compare(0, root.length(), root)) && ('/' == r[root.length()])));
+    if (!inside) {
+        EHS_TRACE("'%s' is outside of the root directory", path.c_str());
+        close(fd);
+        return LOAD_NOTFOUND;
+    }
+#endif
+    entry.fd = -1;
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtime;
+    entry.type = ContentType(path);
+    entry.checked = CachedClock::Now();
+    // Same format as HttpResponse::GenerateETag for file bodies
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%lx-0-%lx\"", static_cast<unsigned long>(entry.mtime),
+            static_cast<unsigned long>(entry.size));
+    entry.etag = buf;
+    if (entry.size > m_nMaxFileSize) {
+        entry.fd = fd;
+        return LOAD_OK;
+    }
+    entry.data.resize(entry.size);
+    size_t done = 0;
+    while (done < entry.size) {
+#ifdef _WIN32
+        int r = _read(fd, &entry.data[done], static_cast<unsigned int>(entry.size - done));
+#else
+        ssize_t r = read(fd, &entry.data[done], entry.size - done);
+#endif
+        if ((0 > r) && (EINTR == errno)) {
+            continue;
+        }
+        if (0 >= r) {
+            // error or truncated while reading
+            close(fd);
+            return LOAD_NOTFOUND;
+        }
+        done += r;
+    }
+    close(fd);
+    return LOAD_OK;
+}
+
+StaticFiles::CacheMap::iterator StaticFiles::Insert(const string & path, CacheEntry & entry)
+{
+    CacheMap::iterator it = m_oCache.find(path);
+    if (m_oCache.end() != it) {
+        // loaded by another thread meanwhile
+        Remove(it);
+    }
+    it = m_oCache.insert(CacheMap::value_type(path, CacheEntry())).first;
+    CacheEntry & e = it->second;
+    e.data.swap(entry.data);
+    e.fd = entry.fd;
+    entry.fd = -1;
+    e.size = entry.size;
+    e.mtime = entry.mtime;
+    e.etag = entry.etag;
+    e.type = entry.type;
+    e.checked = entry.checked;
+    m_oLru.push_front(path);
+    e.lru = m_oLru.begin();
+    m_nCachedBytes += e.data.length();
+    if (-1 != e.fd) {
+        m_nCachedFds++;
+    }
+    e.watched = Watch(path);
+    // The new entry is never evicted, it has been checked to fit.
+    while ((1 < m_oCache.size()) &&
+            ((m_nCachedBytes > m_nCacheSize) || (m_oCache.size() > m_nMaxEntries))) {
+        Remove(m_oCache.find(m_oLru.back()));
+    }
+    // Descriptors count nothing against the size, so they are limited
+    // separately, closing the least recently used ones.
+    list<string>::iterator pos = m_oLru.end();
+    while ((m_nCachedFds > m_nMaxFds) && (m_oLru.begin() != pos)) {
+        CacheMap::iterator victim = m_oCache.find(*--pos);
+        if ((victim != it) && (-1 != victim->second.fd)) {
+            // step back to the successor, Remove erases pos
+            ++pos;
+            Remove(victim);
+        }
+    }
+    return it;
+}
+
+void StaticFiles::Remove(CacheMap::iterator it)
+{
+    if (-1 != it->second.fd) {
+        close(it->second.fd);
+        m_nCachedFds--;
+    }
+    m_nCachedBytes -= it->second.data.length();
+    m_oLru.erase(it->second.lru);
+    m_oCache.erase(it);
+}
+
+void StaticFiles::RemoveBelow(const string & dir)
+{
+    string prefix = dir + "/";
+    CacheMap::iterator it = m_oCache.lower_bound(prefix);
+    while ((m_oCache.end() != it) && (0 == it->first.compare(0, prefix.length(), prefix))) {
+        Remove(it++);
+    }
+}
+
+bool StaticFiles::Watch(const string & path)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    if (-1 == m_nNotifyFd) {
+        return false;
+    }
+    // Renaming or replacing any directory between the root and the file
+    // changes, what path refers to, without an event in the file's own
+    // directory. Hence, all of them are watched.
+    for (size_t pos = path.find('/', m_sRoot.length()); string::npos != pos; pos = path.find('/', pos + 1)) {
+        if (!WatchDir(path.substr(0, pos))) {
+            return false;
+        }
+    }
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+bool StaticFiles::WatchDir(const string & dir)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    if (m_oWatchedDirs.end() != m_oWatchedDirs.find(dir)) {
+        return true;
+    }
+    int wd = inotify_add_watch(m_nNotifyFd, dir.c_str(), IN_MODIFY | IN_ATTRIB |
+            IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+            IN_DELETE_SELF | IN_MOVE_SELF);
+    if (-1 == wd) {
+        EHS_TRACE("Could not watch '%s'", dir.c_str());
+        return false;
+    }
+    m_oWatches[wd] = dir;
+    m_oWatchedDirs[dir] = wd;
+    return true;
+#else
+    (void)dir;
+    return false;
+#endif
+}
+
+void StaticFiles::UnwatchBelow(const string & dir)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    // The watches follow the inodes, which no longer have these names.
+    map<string, int>::iterator it = m_oWatchedDirs.lower_bound(dir);
+    while ((m_oWatchedDirs.end() != it) && (0 == it->first.compare(0, dir.length(), dir)) &&
+            ((it->first.length() == dir.length()) || ('/' == it->first[dir.length()]))) {
+        inotify_rm_watch(m_nNotifyFd, it->second);
+        m_oWatches.erase(it->second);
+        m_oWatchedDirs.erase(it++);
+    }
+#else
+    (void)dir;
+#endif
+}
+
+void StaticFiles::ProcessEvents()
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    if (-1 == m_nNotifyFd) {
+        return;
+    }
+    // aligned for struct inotify_event
+    long buf[1024];
+    for (;;) {
+        ssize_t n = read(m_nNotifyFd, buf, sizeof(buf));
+        if (0 >= n) {
+            // EAGAIN: no more events
+            return;
+        }
+        const char *p = reinterpret_cast<const char *>(buf);
+        const char *end = p + n;
+        while (p < end) {
+            const struct inotify_event *ev = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+            if (0 != (ev->mask & IN_Q_OVERFLOW)) {
+                // events have been lost
+                while (!m_oCache.empty()) {
+                    Remove(m_oCache.begin());
+                }
+                continue;
+            }
+            map<int, string>::iterator w = m_oWatches.find(ev->wd);
+            if (m_oWatches.end() == w) {
+                continue;
+            }
+            if (0 != (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))) {
+                string dir = w->second;
+                RemoveBelow(dir);
+                UnwatchBelow(dir);
+                continue;
+            }
+            if (0 < ev->len) {
+                string name = w->second + "/" + ev->name;
+                CacheMap::iterator it = m_oCache.find(name);
+                if (m_oCache.end() != it) {
+                    EHS_TRACE("Invalidating '%s'", name.c_str());
+                    Remove(it);
+                }
+                // a renamed, removed or replaced subdirectory
+                RemoveBelow(name);
+                UnwatchBelow(name);
+            }
+        }
+    }
+#endif
+}
+
+ResponseCode StaticFiles::HandleRequest(HttpRequest *request, HttpResponse *response)
+{
+    if ((REQUESTMETHOD_GET != request->Method()) && (REQUESTMETHOD_HEAD != request->Method())) {
+        response->SetHeader("Allow", "GET, HEAD");
+        return HTTPRESPONSECODE_405_METHOD_NOT_ALLOWED;
+    }
+    string rel;
+    if (!NormalizePath(request->Uri(), rel)) {
+        return HTTPRESPONSECODE_404_NOTFOUND;
+    }
+    string path(m_sRoot);
+    path.append("/").append(rel);
+    if (rel.empty() || ('/' == rel[rel.length() - 1])) {
+        path.append(m_sIndexFile);
+    }
+
+    MutexHelper mutex(&m_oMutex);
+    ProcessEvents();
+    CacheMap::iterator it = m_oCache.find(path);
+    if ((m_oCache.end() != it) && (!it->second.watched)) {
+        // Without notifications, the file is checked once per second.
+        time_t now = CachedClock::Now();
+        if (now != it->second.checked) {
+            struct stat st;
+            if ((0 != stat(path.c_str(), &st)) || (st.st_mtime != it->second.mtime) ||
+                    (static_cast<size_t>(st.st_size) != it->second.size)) {
+                Remove(it);
+                it = m_oCache.end();
+            } else {
+                it->second.checked = now;
+            }
+        }
+    }
+    if (m_oCache.end() == it) {
+        mutex.Unlock();
+        CacheEntry entry;
+        switch (Load(path, entry)) {
+            case LOAD_NOTFOUND:
+                return HTTPRESPONSECODE_404_NOTFOUND;
+            case LOAD_DIRECTORY:
+                {
+                    // Relative links in the index file need the trailing slash.
+                    string location = request->OriginalUri();
+                    location.insert(min(location.length(), location.find_first_of("?#")), "/");
+                    response->SetHeader("Location", location);
+                    return HTTPRESPONSECODE_301_MOVEDPERMANENTLY;
+                }
+            case LOAD_OK:
+                break;
+        }
+        if ((entry.data.length() > m_nCacheSize) || ((-1 != entry.fd) && (0 == m_nMaxFds))) {
+            // not to be cached
+            if (response->SetValidators(request, entry.etag, entry.mtime)) {
+                if (-1 != entry.fd) {
+                    close(entry.fd);
+                }
+                return HTTPRESPONSECODE_304_NOT_MODIFIED;
+            }
+            response->SetHeader("Content-Type", entry.type);
+            if (-1 == entry.fd) {
+                response->SetBody(entry.data.data(), entry.data.length());
+            } else {
+                // The response closes the descriptor.
+                response->SetBodyFile(entry.fd, 0, entry.size);
+            }
+            return HTTPRESPONSECODE_200_OK;
+        }
+        mutex.Lock();
+        it = Insert(path, entry);
+    } else {
+        m_oLru.splice(m_oLru.begin(), m_oLru, it->second.lru);
+    }
+
+    const CacheEntry & e = it->second;
+    if (response->SetValidators(request, e.etag, e.mtime)) {
+        return HTTPRESPONSECODE_304_NOT_MODIFIED;
+    }
+    response->SetHeader("Content-Type", e.type);
+    if (-1 == e.fd) {
+        response->SetBody(e.data.data(), e.data.length());
+        return HTTPRESPONSECODE_200_OK;
+    }
+    // The response closes its own descriptor.
+    int fd = dup(e.fd);
+    if (-1 == fd) {
+        return HTTPRESPONSECODE_500_INTERNALSERVERERROR;
+    }
+    response->SetBodyFile(fd, 0, e.size);
+    return HTTPRESPONSECODE_200_OK;
+}